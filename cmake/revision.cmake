@@ -0,0 +1,23 @@
+# Writes the git revision of the sources to a header, run at build time so that the revision
+# recorded in the machine-readable results is that of the sources being built. The header is
+# only rewritten when the revision changes, so that the apps are not rebuilt every time.
+#
+# SOURCE_DIR: source tree
+# OUTPUT: header to write, defining CIAN_GIT_REVISION
+
+execute_process             (COMMAND git rev-parse --short HEAD
+                             WORKING_DIRECTORY ${SOURCE_DIR}
+                             OUTPUT_VARIABLE git_revision
+                             OUTPUT_STRIP_TRAILING_WHITESPACE
+                             ERROR_QUIET)
+if                          (NOT git_revision)
+    set                     (git_revision unknown)
+endif                       ()
+
+set                         (header "#define CIAN_GIT_REVISION \"${git_revision}\"\n")
+if                          (EXISTS ${OUTPUT})
+    file                    (READ ${OUTPUT} old_header)
+endif                       ()
+if                          (NOT "${header}" STREQUAL "${old_header}")
+    file                    (WRITE ${OUTPUT} "${header}")
+endif                       ()
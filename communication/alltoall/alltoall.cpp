@@ -23,6 +23,11 @@
 #include <diy/assigner.hpp>
 
 #include "../../include/opts.h"
+#include "../../include/args.h"
+#include "../../include/timing.h"
+#include "../../include/autotune.h"
+#include "../../include/results.h"
+#include "../../include/stats.h"
 
 using namespace std;
 
@@ -173,6 +178,8 @@ struct Exchange
     void operator()(void* b_, const diy::ReduceProxy& rp) const
         {
             Block* b = static_cast<Block*>(b_);
+            size_t received = timing::received_bytes(rp);
+            double t0 = timing::round_timer().begin(rp.round());
 
             // enqueue
             int sz = 0;                       // current location in b-> from which to read
@@ -194,6 +201,9 @@ struct Exchange
                           &b->data[sz]);
                 sz += incoming_sz;
             }
+
+            timing::round_timer().end(rp.round(), t0, rp.gid());
+            timing::round_timer().bytes(rp.round(), timing::sent_bytes(rp), received);
         }
 
     const Decomposer& decomposer;
@@ -211,6 +221,9 @@ struct Exchange
 void DiyAlltoAll(double *diy_time, int run, int k, MPI_Comm comm, diy::Master& master,
                  diy::ContiguousAssigner& assigner, Decomposer& decomposer)
 {
+    timing::round_timer().reset();
+
+    // callbacks may run in several threads: the end of the exchange is the end of the last callback
     MPI_Barrier(comm);
     double t0 = MPI_Wtime();
 
@@ -218,17 +231,17 @@ void DiyAlltoAll(double *diy_time, int run, int k, MPI_Comm comm, diy::Master& m
     diy::all_to_all(master, assigner, Exchange(decomposer), k);
 
     //printf("------------\n");
-    MPI_Barrier(comm);
-    diy_time[run] = MPI_Wtime() - t0;
+    diy_time[run] = timing::elapsed(t0, comm);
 }
 //
 // print results
 //
-// mpi_time, diy_time: times
+// mpi_time, diy_time: times, median over the trials
+// ks: target k of each run, NULL if they were not tuned or looked up
 // min_procs, max_procs: process range
 // min_elems, max_elems: data range
 //
-void PrintResults(double *mpi_time, double *diy_time, int min_procs,
+void PrintResults(double *mpi_time, double *diy_time, const int *ks, int min_procs,
 		  int max_procs, int min_elems, int max_elems)
 {
     int elem_iter = 0;                                            // element iteration number
@@ -243,7 +256,10 @@ void PrintResults(double *mpi_time, double *diy_time, int min_procs,
     {
         fprintf(stderr, "\n# num_elemnts = %d   size @ 4 bytes / element = %d KB\n",
                 num_elems, num_elems * 4 / 1024);
-        fprintf(stderr, "# procs \t mpi_time \t diy_time\n");
+        fprintf(stderr, "# procs \t mpi_time \t diy_time");
+        if (ks)
+            fprintf(stderr, " \t k");
+        fprintf(stderr, "\n");
 
         // iterate over processes
         int groupsize = min_procs;
@@ -251,8 +267,11 @@ void PrintResults(double *mpi_time, double *diy_time, int min_procs,
         while (groupsize <= max_procs)
         {
             int i = proc_iter * num_elem_iters + elem_iter; // index into times
-            fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf\n",
+            fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf",
                     groupsize, mpi_time[i], diy_time[i]);
+            if (ks)
+                fprintf(stderr, " \t\t %d", ks[i]);
+            fprintf(stderr, "\n");
 
             groupsize *= 2; // double the number of processes every time
             proc_iter++;
@@ -274,9 +293,17 @@ void PrintResults(double *mpi_time, double *diy_time, int min_procs,
 // max_elems: maximum number of elements to reduce (output)
 // nb: number of blocks per process (output)
 // target_k: target k-value (output)
+// num_threads: number of threads (output)
+// tune_file: autotune: run all the target k values and write the fastest to this table (output)
+// lookup_file: take the target k values from this table (output)
+// out_file: file for the machine-readable results (results.h), empty = none (output)
+// warmup: number of untimed trials before the timed ones of each run (output)
+// trials: number of timed trials of each run, summarized by their median (output)
 //
 void GetArgs(int argc, char **argv, int &min_procs,
-	     int &min_elems, int &max_elems, int &nb, int &target_k)
+	     int &min_elems, int &max_elems, int &nb, int &target_k, int &num_threads,
+             std::string &tune_file, std::string &lookup_file, std::string &out_file,
+             int &warmup, int &trials)
 {
     using namespace opts;
     Options ops(argc, argv);
@@ -285,6 +312,14 @@ void GetArgs(int argc, char **argv, int &min_procs,
     MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
+    num_threads = 1;
+    ops >> Option('t', "threads", num_threads, "number of threads");
+    ops >> Option('a', "autotune", tune_file,   "run all k values, write the fastest to file")
+        >> Option('l', "lookup",   lookup_file, "read the k values from file");
+    args::run_options(ops, out_file, warmup, trials);
+    std::string trace_prefix;
+    args::profile_options(ops, trace_prefix);
+
     if (ops >> Present('h', "help", "show help") ||
         !(ops >> PosOption(min_procs)
           >> PosOption(min_elems)
@@ -293,10 +328,14 @@ void GetArgs(int argc, char **argv, int &min_procs,
           >> PosOption(target_k)))
     {
         if (rank == 0)
-            fprintf(stderr, "Usage: %s min_procs min_elems max_elems nb target_k\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-t threads] [-a table | -l table] [-o results] "
+                    "[-w warmup] [-n trials] [-f] [-e trace] min_procs min_elems max_elems nb target_k\n",
+                    argv[0]);
         exit(1);
     }
 
+    args::check_threads(num_threads, rank);
+
     // check there is at least one element per block
     if (min_elems < nb * max_procs && rank == 0)
     {
@@ -305,9 +344,14 @@ void GetArgs(int argc, char **argv, int &min_procs,
         exit(1);
     }
 
+    args::check_trials(warmup, trials);
+
+    args::open_trace(trace_prefix, rank);
+
     if (rank == 0)
         fprintf(stderr, "min_procs = %d min_elems = %d max_elems = %d nb = %d "
-                "target_k = %d\n", min_procs, min_elems, max_elems, nb, target_k);
+                "target_k = %d threads = %d warmup = %d trials = %d\n", min_procs, min_elems,
+                max_elems, nb, target_k, num_threads, warmup, trials);
 }
 
 //
@@ -324,11 +368,32 @@ int main(int argc, char **argv)
     int rank, groupsize;      // MPI usual
     int min_procs;            // minimum number of processes
     int max_procs;            // maximum number of processes (groupsize of MPI_COMM_WORLD)
+    int num_threads;          // number of threads diy uses to run the blocks
+    std::string tune_file;    // autotune: table to write the fastest k values to
+    std::string lookup_file;  // table to read the k values from
+    autotune::Table table;    // k values of the runs
+    std::string out_file;     // machine-readable results
+    int warmup, trials;       // number of untimed and timed trials per run
 
     MPI_Init(&argc, &argv);
     MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
 
-    GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, target_k);
+    GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, target_k, num_threads,
+            tune_file, lookup_file, out_file, warmup, trials);
+    if (!results::open(out_file))
+    {
+        fprintf(stderr, "Error: cannot write results to %s\n", out_file.c_str());
+        exit(1);
+    }
+
+    // tuning adds to the entries of other apps and runs already in the table
+    if (!tune_file.empty())
+        table.load(tune_file);
+    else if (!lookup_file.empty() && !table.load(lookup_file))
+    {
+        fprintf(stderr, "Error: cannot read k values from %s\n", lookup_file.c_str());
+        exit(1);
+    }
 
     // data extents, unused
     Bounds domain;
@@ -344,6 +409,7 @@ int main(int argc, char **argv)
     // timing
     double mpi_time[num_runs];
     double diy_time[num_runs];
+    int ks[num_runs];                        // target k of each run
 
     // data for MPI reduce, only for one local block
     float *in_data = new float[max_elems];
@@ -368,7 +434,6 @@ int main(int argc, char **argv)
         // initialize DIY
         tot_blocks = nblocks * groupsize;
         int mem_blocks = -1; // everything in core for now
-        int num_threads = 1; // needed in order to do timing
         diy::mpi::communicator    world(comm);
         diy::FileStorage          storage("./DIY.XXXXXX");
         diy::Master               master(world,
@@ -388,9 +453,28 @@ int main(int argc, char **argv)
         num_elems = min_elems;
         while (num_elems <= max_elems)
         {
+            results::Run res("alltoall");
+            res.procs   = groupsize;
+            res.blocks  = tot_blocks;
+            res.elems   = num_elems;
+            res.threads = num_threads;
+            char point[256];
+            sprintf(point, "procs %d elems %d", groupsize, num_elems);
+
             // MPI alltoall, only for one block per process
             if (tot_blocks == groupsize)
-                MpiAlltoAll(alltoall_data, mpi_time, run, in_data, comm, num_elems);
+            {
+                stats::Samples samples;
+                for (int t = -warmup; t < trials; t++)
+                {
+                    MpiAlltoAll(alltoall_data, mpi_time, run, in_data, comm, num_elems);
+                    if (t >= 0)
+                        samples.add(mpi_time[run], comm);
+                }
+                mpi_time[run] = samples.median();
+                results::emit(res, "mpi_time", samples);
+                stats::record(point, "mpi_time", samples);
+            }
 
             // DIY swap
 
@@ -398,9 +482,65 @@ int main(int argc, char **argv)
             int args[2];
             args[0] = num_elems;
             args[1] = tot_blocks;
-            master.foreach(&ResetBlock, args);
 
-            DiyAlltoAll(diy_time, run, target_k, comm, master, assigner, decomposer);
+            // diy::all_to_all only takes a target k, so the schedules that can be tuned are
+            // those that diy factors from some k
+            int k = target_k;
+            if (!tune_file.empty())
+            {
+                std::vector<std::string> tried;
+                autotune::Entry best;
+                for (int kk = 2; kk <= tot_blocks; kk++)
+                {
+                    autotune::Schedule s = autotune::factor(tot_blocks, kk);
+                    std::string name = autotune::name(s);
+                    if (std::find(tried.begin(), tried.end(), name) != tried.end())
+                        continue;
+                    tried.push_back(name);
+
+                    master.foreach(&ResetBlock, args);
+                    double t;
+                    DiyAlltoAll(&t, 0, kk, comm, master, assigner, decomposer);
+                    if (rank == 0)
+                        fprintf(stderr, "autotune procs %d elems %d k %d schedule %s time %.3lf\n",
+                                groupsize, num_elems, kk, name.c_str(), t);
+                    if (tried.size() == 1 || t < best.time)
+                    {
+                        best.schedule = s;
+                        best.k        = kk;
+                        best.time     = t;
+                    }
+                }
+                if (!tried.empty())
+                {
+                    table.set("alltoall", groupsize, tot_blocks, num_elems, best);
+                    k = best.k;
+                }
+            }
+            else
+            {
+                autotune::Entry e;
+                if (table.find("alltoall", groupsize, tot_blocks, num_elems, e))
+                    k = e.k;
+            }
+            ks[run] = k;
+
+            stats::Samples samples;
+            for (int t = -warmup; t < trials; t++)
+            {
+                master.foreach(&ResetBlock, args);
+                DiyAlltoAll(diy_time, run, k, comm, master, assigner, decomposer);
+                if (t >= 0)
+                    samples.add(timing::round_timer().local, comm);
+            }
+            diy_time[run] = samples.median();
+            res.k = results::k_string(k);
+            results::emit(res, "diy_time", samples);
+            stats::record(point, "diy_time", samples);
+            char label[256];
+            sprintf(label, "procs %d elems %d k %d", groupsize, num_elems, k);
+            timing::print_rounds(label, comm);
+            timing::print_profile(label, comm);
 
             // debug
 //             master.foreach(&PrintBlock);
@@ -420,11 +560,18 @@ int main(int argc, char **argv)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     fflush(stderr);
     if (rank == 0)
-        PrintResults(mpi_time, diy_time, min_procs, max_procs, min_elems, max_elems);
+    {
+        PrintResults(mpi_time, diy_time, (tune_file.empty() && lookup_file.empty()) ? NULL : ks,
+                     min_procs, max_procs, min_elems, max_elems);
+        stats::print(warmup, trials);
+        if (!tune_file.empty() && !table.save(tune_file))
+            fprintf(stderr, "Error: cannot write k values to %s\n", tune_file.c_str());
+    }
 
     // cleanup
     delete[] in_data;
     delete[] alltoall_data;
+    timing::close_trace();
     MPI_Finalize();
 
     return 0;
@@ -23,21 +23,37 @@
 #include <diy/assigner.hpp>
 
 #include "../../include/opts.h"
+#include "../../include/args.h"
+#include "../../include/composite.h"
+#include "../../include/timing.h"
+#include "../../include/spill.h"
+#include "../../include/autotune.h"
+#include "../../include/results.h"
+#include "../../include/stats.h"
 
 using namespace std;
 
 typedef  diy::ContinuousBounds       Bounds;
 typedef  diy::RegularContinuousLink  RCLink;
 
+// compositing kernel counters, accumulated by ComputeMerge during one run
+double kernel_time;       // time spent in the compositing kernel
+size_t kernel_pixels;     // number of pixels composited
+timing::Mutex kernel_mutex;
+
 // function prototypes
 void GetArgs(int argc, char **argv, int &min_procs, int &min_elems,
-	     int &max_elems, int &nb, int &target_k, bool &op);
+	     int &max_elems, int &nb, int &target_k, bool &op, int &num_threads, int &mem_blocks,
+             std::string &tune_file, std::string &lookup_file, std::string &out_file,
+             int &warmup, int &trials);
 void MpiReduce(double *reduce_time, int run, float *in_data, MPI_Comm comm, int num_elems,
                bool op);
-void DiyMerge(double *merge_time, int run, int k, MPI_Comm comm, int dim, int totblocks,
-              bool contiguous, diy::Master& master, diy::ContiguousAssigner& assigner, bool op);
-void PrintResults(double *reduce_time, double *merge_time, int min_procs,
-		  int max_procs, int min_elems, int max_elems);
+void DiyMerge(double *merge_time, double *kernel_rate, int run,
+              const autotune::Schedule& schedule, MPI_Comm comm, int totblocks, bool contiguous,
+              diy::Master& master, diy::ContiguousAssigner& assigner, bool op);
+void PrintResults(double *reduce_time, double *merge_time, double *kernel_rate,
+                  spill::Totals *spill_totals, bool out_of_core, const std::string *schedules,
+                  int min_procs, int max_procs, int min_elems, int max_elems);
 void ComputeMerge(void* b_, const diy::ReduceProxy& rp, const diy::RegularMergePartners&);
 void NoopMerge(void* b_, const diy::ReduceProxy& rp, const diy::RegularMergePartners&);
 void Over(void *in, void *inout, int *len, MPI_Datatype*);
@@ -72,6 +88,26 @@ struct Block
   std::vector<char> contents;
   int gid;
 };
+
+// serialize a block (used when blocks are moved out of core)
+namespace diy
+{
+  template<>
+  struct Serialization<Block>
+  {
+    static void save(BinaryBuffer& bb, const Block& b)
+    {
+      diy::save(bb, b.contents);
+      diy::save(bb, b.gid);
+    }
+
+    static void load(BinaryBuffer& bb, Block& b)
+    {
+      diy::load(bb, b.contents);
+      diy::load(bb, b.gid);
+    }
+  };
+}
 //
 // add blocks to a master
 //
@@ -134,11 +170,33 @@ int main(int argc, char **argv)
   int min_procs;            // minimum number of processes
   int max_procs;            // maximum number of processes (groupsize of MPI_COMM_WORLD)
   bool op;                  // actual operator or no-op
+  int num_threads;          // number of threads diy uses to run the blocks
+  int mem_blocks;           // number of blocks to keep in memory (-1 = all)
+  std::string tune_file;    // autotune: table to write the fastest schedules to
+  std::string lookup_file;  // table to read the schedules from
+  autotune::Table table;    // schedules of the runs
+  std::string out_file;     // machine-readable results
+  int warmup, trials;       // number of untimed and timed trials per run
 
   MPI_Init(&argc, &argv);
   MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
 
-  GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, target_k, op);
+  GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, target_k, op, num_threads,
+          mem_blocks, tune_file, lookup_file, out_file, warmup, trials);
+  if (!results::open(out_file))
+  {
+    fprintf(stderr, "Error: cannot write results to %s\n", out_file.c_str());
+    exit(1);
+  }
+
+  // tuning adds to the entries of other apps and runs already in the table
+  if (!tune_file.empty())
+    table.load(tune_file);
+  else if (!lookup_file.empty() && !table.load(lookup_file))
+  {
+    fprintf(stderr, "Error: cannot read schedules from %s\n", lookup_file.c_str());
+    exit(1);
+  }
 
   // data extents, unused
   Bounds domain;
@@ -154,6 +212,9 @@ int main(int argc, char **argv)
   // timing
   double reduce_time[num_runs];
   double merge_time[num_runs];
+  double kernel_rate[num_runs];
+  spill::Totals spill_totals[num_runs];
+  std::vector<std::string> schedules(num_runs);  // schedule of each run
 
   // data for MPI reduce, only for one local block
   float *in_data = new float[max_elems];
@@ -176,13 +237,11 @@ int main(int argc, char **argv)
 
     // initialize DIY
     tot_blocks = nblocks * groupsize;
-    int mem_blocks = -1;      // everything in core for now
-    int num_threads = 1;      // needed in order to do timing
     diy::mpi::communicator    world(comm);
-    diy::FileStorage          storage("./DIY.XXXXXX");
+    spill::Storage            storage("./DIY.XXXXXX");
     diy::Master               master(world,
                                      num_threads,
-                                     mem_blocks,
+                                     spill::mem_blocks(mem_blocks, num_threads),
                                      &Block::create,
                                      &Block::destroy,
                                      &storage,
@@ -196,18 +255,89 @@ int main(int argc, char **argv)
     num_elems = min_elems;
     while (num_elems <= max_elems)
     {
+      results::Run res("merge");
+      res.procs   = groupsize;
+      res.blocks  = tot_blocks;
+      res.elems   = num_elems;
+      res.op      = op ? "over" : "noop";
+      res.threads = num_threads;
+      char point[256];
+      sprintf(point, "procs %d elems %d", groupsize, num_elems);
+
       // MPI reduce, only for one block per process
       if (tot_blocks == groupsize)
-	MpiReduce(reduce_time, run, in_data, comm, num_elems, op);
+      {
+        stats::Samples samples;
+        for (int t = -warmup; t < trials; t++)
+        {
+          MpiReduce(reduce_time, run, in_data, comm, num_elems, op);
+          if (t >= 0)
+            samples.add(reduce_time[run], comm);
+        }
+        reduce_time[run] = samples.median();
+        results::emit(res, "red_time", samples);
+        stats::record(point, "red_time", samples);
+      }
 
       // DIY merge
       // initialize input data
       int args[2];
       args[0] = num_elems;
       args[1] = tot_blocks;
-      master.foreach(&ResetBlock, args);
 
-      DiyMerge(merge_time, run, target_k, comm, dim, tot_blocks, true, master, assigner, op);
+      // schedule of the merge rounds
+      autotune::Schedule schedule;
+      if (!tune_file.empty())
+      {
+        // autotune: the fastest of all the schedules
+        std::vector<autotune::Schedule> candidates;
+        autotune::schedules(tot_blocks, candidates);
+        autotune::Entry best;
+        for (size_t s = 0; s < candidates.size(); s++)
+        {
+          master.foreach(&ResetBlock, args);
+          double t, rate;
+          DiyMerge(&t, &rate, 0, candidates[s], comm, tot_blocks, true, master, assigner, op);
+          if (rank == 0)
+            fprintf(stderr, "autotune procs %d elems %d schedule %s time %.3lf\n",
+                    groupsize, num_elems, autotune::name(candidates[s]).c_str(), t);
+          if (s == 0 || t < best.time)
+          {
+            best.schedule = candidates[s];
+            best.k        = autotune::max_k(candidates[s]);
+            best.time     = t;
+          }
+        }
+        table.set("merge", groupsize, tot_blocks, num_elems, best);
+        schedule = best.schedule;
+      }
+      else
+        schedule = autotune::lookup(table, "merge", groupsize, tot_blocks, num_elems, target_k);
+      schedules[run] = autotune::name(schedule);
+
+      // the other quantities are those of the last trial
+      stats::Samples samples;
+      for (int t = -warmup; t < trials; t++)
+      {
+        master.foreach(&ResetBlock, args);
+        spill::stats().reset();
+        DiyMerge(merge_time, kernel_rate, run, schedule, comm, tot_blocks, true, master,
+                 assigner, op);
+        if (t >= 0)
+          samples.add(timing::round_timer().local, comm);
+      }
+      merge_time[run] = samples.median();
+      res.k = schedules[run];
+      results::emit(res, "merge_time", samples);
+      stats::record(point, "merge_time", samples);
+      results::emit(comm, res, "kernel_Mpix/s",
+                    kernel_time > 0.0 ? kernel_pixels / kernel_time / 1e6 : 0.0);
+      spill_totals[run] = spill::stats().reduce(comm, timing::round_timer().local);
+      char label[256];
+      sprintf(label, "procs %d elems %d schedule %s", groupsize, num_elems,
+              schedules[run].c_str());
+      timing::print_rounds(label, comm);
+      timing::print_profile(label, comm);
 
       // debug
       //master.foreach(PrintBlock, &tot_blocks);
@@ -226,10 +356,18 @@ int main(int argc, char **argv)
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   fflush(stderr);
   if (rank == 0)
-    PrintResults(reduce_time, merge_time, min_procs, max_procs, min_elems, max_elems);
+  {
+    PrintResults(reduce_time, merge_time, kernel_rate, spill_totals, mem_blocks >= 0,
+                 (tune_file.empty() && lookup_file.empty()) ? NULL : &schedules[0], min_procs,
+                 max_procs, min_elems, max_elems);
+    stats::print(warmup, trials);
+    if (!tune_file.empty() && !table.save(tune_file))
+      fprintf(stderr, "Error: cannot write schedules to %s\n", tune_file.c_str());
+  }
 
   // cleanup
   delete[] in_data;
+  timing::close_trace();
   MPI_Finalize();
 
   return 0;
@@ -287,39 +425,58 @@ void MpiReduce(double *reduce_time, int run, float *in_data, MPI_Comm comm, int
 // DIY merge
 //
 // merge_time: time (output)
+// kernel_rate: compositing kernel pixels per second per process (output)
 // run: run number
-// k: desired k value
+// schedule: k value of each round
 // comm: MPI communicator
-// dim: dimensionality of decompostion
 // totblocks: total number of blocks
 // contiguous: use contiguous partners
 // master, assigner: diy usual
 // op: run actual op or noop
 //
-void DiyMerge(double *merge_time, int run, int k, MPI_Comm comm, int dim, int totblocks,
-              bool contiguous, diy::Master& master, diy::ContiguousAssigner& assigner, bool op)
+void DiyMerge(double *merge_time, double *kernel_rate, int run,
+              const autotune::Schedule& schedule, MPI_Comm comm, int totblocks, bool contiguous,
+              diy::Master& master, diy::ContiguousAssigner& assigner, bool op)
 {
+  kernel_time   = 0.0;
+  kernel_pixels = 0;
+  timing::round_timer().reset();
+
+  // callbacks may run in several threads: the end of the merge is the end of the last callback
   MPI_Barrier(comm);
   double t0 = MPI_Wtime();
 
-  diy::RegularMergePartners  partners(dim, totblocks, k, contiguous);
+  diy::RegularMergePartners  partners =
+    autotune::partners<diy::RegularMergePartners>(totblocks, schedule, contiguous);
   if (op)
-    diy::reduce(master, assigner, partners, &ComputeMerge);
+    diy::reduce(master, assigner, partners,
+                &timing::timed<diy::RegularMergePartners, &ComputeMerge>);
   else
-    diy::reduce(master, assigner, partners, &NoopMerge);
+    diy::reduce(master, assigner, partners,
+                &timing::timed<diy::RegularMergePartners, &NoopMerge>);
 
-  MPI_Barrier(comm);
-  merge_time[run] = MPI_Wtime() - t0;
+  merge_time[run] = timing::elapsed(t0, comm);
+
+  // kernel rate over all processes: total pixels / total time in the kernel
+  double local[2] = { (double)kernel_pixels, kernel_time };
+  double global[2];
+  MPI_Reduce(local, global, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+  kernel_rate[run] = global[1] > 0.0 ? global[0] / global[1] : 0.0;
 }
 //
 // print results
 //
-// reduce_time, merge_time: times
+// reduce_time, merge_time: times, median over the trials
+// kernel_rate: compositing kernel pixels per second per process
+// spill_totals: blocks moved out of core and back during the merge
+// out_of_core: whether to print the spill columns
+// schedules: schedule of each run, NULL if they were not tuned or looked up
 // min_procs, max_procs: process range
 // min_elems, max_elems: data range
 //
-void PrintResults(double *reduce_time, double *merge_time, int min_procs,
-		  int max_procs, int min_elems, int max_elems)
+void PrintResults(double *reduce_time, double *merge_time, double *kernel_rate,
+                  spill::Totals *spill_totals, bool out_of_core, const std::string *schedules,
+                  int min_procs, int max_procs, int min_elems, int max_elems)
 {
   int elem_iter = 0;                                            // element iteration number
   int num_elem_iters = (int)(log2(max_elems / min_elems) + 1);  // number of element iterations
@@ -333,7 +490,12 @@ void PrintResults(double *reduce_time, double *merge_time, int min_procs,
   {
     fprintf(stderr, "\n# num_elemnts = %d   size @ 4 bytes / element = %d KB\n",
 	    num_elems, num_elems * 4 / 1024);
-    fprintf(stderr, "# procs \t red_time \t merge_time\n");
+    fprintf(stderr, "# procs \t red_time \t merge_time \t kernel_Mpix/s");
+    if (out_of_core)
+      fprintf(stderr, " \t comm_time \t spill_MB \t spill_time \t reload_MB \t reload_time");
+    if (schedules)
+      fprintf(stderr, " \t schedule");
+    fprintf(stderr, "\n");
 
     // iterate over processes
     int groupsize = min_procs;
@@ -341,8 +503,19 @@ void PrintResults(double *reduce_time, double *merge_time, int min_procs,
     while (groupsize <= max_procs)
     {
       int i = proc_iter * num_elem_iters + elem_iter; // index into times
-      fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf\n",
-	      groupsize, reduce_time[i], merge_time[i]);
+      fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf \t\t %.1lf",
+	      groupsize, reduce_time[i], merge_time[i], kernel_rate[i] / 1e6);
+      if (out_of_core)
+      {
+        const spill::Totals& st = spill_totals[i];
+        fprintf(stderr, " \t\t %.3lf \t\t %.1lf \t\t %.3lf \t\t %.1lf \t\t %.3lf",
+                st.rest,
+                st.bytes_out / 1048576.0, st.time_out,
+                st.bytes_in  / 1048576.0, st.time_in);
+      }
+      if (schedules)
+        fprintf(stderr, " \t\t %s", schedules[i].c_str());
+      fprintf(stderr, "\n");
 
       groupsize *= 2; // double the number of processes every time
       proc_iter++;
@@ -378,15 +551,13 @@ void ComputeMerge(void* b_, const diy::ReduceProxy& rp, const diy::RegularMergeP
     }
 
     float* in = (float*) &rp.incoming(rp.in_link().target(i).gid).buffer[0];
-    
-    for (int j = 0; j < size / 4; j++)
-    {
-      // NB: the order on the right-hand side is correct to match what MPI is doing
-      data[j * 4    ] = (1.0f - data[j * 4 + 3]) * in[j * 4    ] + data[j * 4    ];
-      data[j * 4 + 1] = (1.0f - data[j * 4 + 3]) * in[j * 4 + 1] + data[j * 4 + 1];
-      data[j * 4 + 2] = (1.0f - data[j * 4 + 3]) * in[j * 4 + 2] + data[j * 4 + 2];
-      data[j * 4 + 3] = (1.0f - data[j * 4 + 3]) * in[j * 4 + 3] + data[j * 4 + 3];
-    }
+
+    // NB: the block is in front of the incoming data to match what MPI is doing
+    double t0 = MPI_Wtime();
+    composite::over_front_to_back(data, in, size / 4);
+    timing::Lock l(kernel_mutex);
+    kernel_time   += MPI_Wtime() - t0;
+    kernel_pixels += size / 4;
   }
   
   // enqueue
@@ -436,34 +607,7 @@ void NoopMerge(void* b_, const diy::ReduceProxy& rp, const diy::RegularMergePart
 //
 void Over(void *in, void *inout, int *len, MPI_Datatype*)
 {
-  for (int i = 0; i < *len / 4; i++)
-  {
-//     fprintf(stderr, "inout = (%.1f %.1f %.1f %.1f)  in = (%.1f %.1f %.1f %.1f)\n",
-//             ((float *)inout)[i * 4], ((float *)inout)[i * 4 + 1],
-//             ((float *)inout)[i * 4 + 2], ((float *)inout)[i * 4 + 3],
-//             ((float *)in)[i * 4], ((float *)in)[i * 4 + 1],
-//             ((float *)in)[i * 4 + 2], ((float *)in)[i * 4 + 3]);
-
-    ((float *)inout)[i * 4] =
-      (1.0f - ((float *)in)[i * 4 + 3]) * ((float *)inout)[i * 4] +
-      ((float *)in)[i * 4];
-
-    ((float *)inout)[i * 4 + 1] =
-      (1.0f - ((float *)in)[i * 4 + 3]) * ((float *)inout)[i * 4 + 1] +
-      ((float *)in)[i * 4 + 1];
-
-    ((float *)inout)[i * 4 + 2] =
-      (1.0f - ((float *)in)[i * 4 + 3]) * ((float *)inout)[i * 4 + 2] +
-      ((float *)in)[i * 4 + 2];
-
-    ((float *)inout)[i * 4 + 3] =
-      (1.0f - ((float *)in)[i * 4 + 3]) * ((float *)inout)[i * 4 + 3] +
-      ((float *)in)[i * 4 + 3];
-
-//     fprintf(stderr, "inout+ = (%.1f %.1f %.1f %.1f)\n",
-//             ((float *)inout)[i * 4], ((float *)inout)[i * 4 + 1],
-//             ((float *)inout)[i * 4 + 2], ((float *)inout)[i * 4 + 3]);
-  }
+  composite::over_back_to_front((float*) in, (float*) inout, *len / 4);
 }
 //
 // gets command line args
@@ -475,9 +619,18 @@ void Over(void *in, void *inout, int *len, MPI_Datatype*)
 // nb: number of blocks per process (output)
 // target_k: target k-value (output)
 // op: whether to run to operator or no op
+// num_threads: number of threads (output)
+// mem_blocks: number of blocks to keep in memory, -1 = all (output)
+// tune_file: autotune: run all the schedules and write the fastest to this table (output)
+// lookup_file: take the schedules from this table instead of target_k (output)
+// out_file: file for the machine-readable results (results.h), empty = none (output)
+// warmup: number of untimed trials before the timed ones of each run (output)
+// trials: number of timed trials of each run, summarized by their median (output)
 //
 void GetArgs(int argc, char **argv, int &min_procs,
-	     int &min_elems, int &max_elems, int &nb, int &target_k, bool &op)
+	     int &min_elems, int &max_elems, int &nb, int &target_k, bool &op, int &num_threads,
+             int &mem_blocks, std::string &tune_file, std::string &lookup_file,
+             std::string &out_file, int &warmup, int &trials)
 {
   using namespace opts;
   Options ops(argc, argv);
@@ -486,6 +639,16 @@ void GetArgs(int argc, char **argv, int &min_procs,
   MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
+  num_threads = 1;
+  mem_blocks  = -1;
+  ops >> Option('t', "threads",    num_threads, "number of threads")
+      >> Option('m', "mem-blocks", mem_blocks,  "number of blocks to keep in memory");
+  ops >> Option('a', "autotune", tune_file,   "run all schedules, write the fastest to file")
+      >> Option('l', "lookup",   lookup_file, "read the schedules from file");
+  args::run_options(ops, out_file, warmup, trials);
+  std::string trace_prefix;
+  args::profile_options(ops, trace_prefix);
+
   if (ops >> Present('h', "help", "show help") ||
       !(ops >> PosOption(min_procs)
         >> PosOption(min_elems)
@@ -495,14 +658,24 @@ void GetArgs(int argc, char **argv, int &min_procs,
         >> PosOption(op)))
   {
     if (rank == 0)
-      fprintf(stderr, "Usage: %s min_procs min_elems max_elems nb target_k op\n", argv[0]);
+      fprintf(stderr, "Usage: %s [-t threads] [-m mem_blocks] [-a table | -l table] "
+              "[-o results] [-w warmup] [-n trials] [-f] [-e trace] "
+              "min_procs min_elems max_elems nb target_k op\n", argv[0]);
     exit(1);
   }
 
+  args::check_threads(num_threads, rank);
+
   // check there is at least four elements (eg., one pixel) per block
   assert(min_elems >= 4 *nb * max_procs); // at least one element per block
 
+  args::check_trials(warmup, trials);
+
+  args::open_trace(trace_prefix, rank);
+
   if (rank == 0)
     fprintf(stderr, "min_procs = %d min_elems = %d max_elems = %d nb = %d op = %d "
-	    "target_k = %d\n", min_procs, min_elems, max_elems, nb, op, target_k);
+	    "target_k = %d threads = %d mem_blocks = %d warmup = %d trials = %d "
+            "compositing kernel = %s\n", min_procs, min_elems, max_elems, nb, op, target_k,
+            num_threads, mem_blocks, warmup, trials, composite::isa_name(composite::isa()));
 }
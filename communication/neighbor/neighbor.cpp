@@ -24,6 +24,11 @@
 #include <diy/decomposition.hpp>
 
 #include "../../include/opts.h"
+#include "../../include/args.h"
+#include "../../include/timing.h"
+#include "../../include/results.h"
+#include "../../include/stats.h"
+#include "../../include/kernel.h"
 
 using namespace std;
 
@@ -33,21 +38,48 @@ typedef  diy::RegularContinuousLink  RCLink;
 // block
 struct block_t
 {
-  vector< vector <int> > items; // received items
+  vector< vector <int> > items; // received items, one vector per item (item mode)
+  vector<int> flat; // received items, back to back (bulk mode)
+  vector<int> offsets; // start of each item in flat, and the end of the last one (bulk mode)
+  vector<float> field; // (side + 2 * ghost)^3 cells, x fastest (halo mode)
+  long long halo_cells; // ghost cells updated by the last halo exchange (halo mode)
+  double sink; // result of the compute kernel, kept so that it is not optimized away
 };
 
 // function prototypes
 void GetArgs(int argc, char **argv, int &min_procs, int &min_items,
-	     int &max_items, int &num_ints, int &nb);
-void PrintResults(double *enqueue_time, double *exchange_time, int min_procs, int max_procs,
-		  int min_items, int max_items, int item_size, int num_item_iters,
-                  int proc_factor, int item_factor);
+	     int &max_items, int &num_ints, int &nb, int &num_threads, std::string &out_file,
+             int &warmup, int &trials, bool &wrap);
+void PrintResults(double *enqueue_time, double *exchange_time, double *bulk_enqueue_time,
+                  double *bulk_exchange_time, double *isend_time, double *nbr_time,
+                  double *compute_time, double *overlap, double *isend_overlap,
+                  double *bytes_imbalance, int min_procs, int max_procs, int min_items,
+                  int max_items, int item_size, int num_item_iters, int proc_factor,
+                  int item_factor);
+void PrintHaloResults(double *pack_time, double *halo_time, double *halo_mbs,
+                      double *halo_updates, int min_procs, int max_procs, int min_side,
+                      int max_side, int num_item_iters, int proc_factor, int item_factor);
 void* create_block();
 void destroy_block(void* b_);
 void save_block(const void* b, diy::BinaryBuffer& bb);
 void load_block(void* b, diy::BinaryBuffer& bb);
 void enqueue(void* b_, const diy::Master::ProxyWithLink& cp, void*);
 void parse(void* b_, const diy::Master::ProxyWithLink& cp, void*);
+void bulk_enqueue(void* b_, const diy::Master::ProxyWithLink& cp, void*);
+void bulk_parse(void* b_, const diy::Master::ProxyWithLink& cp, void*);
+void release_items(void* b_, const diy::Master::ProxyWithLink& cp, void*);
+void init_field(void* b_, const diy::Master::ProxyWithLink& cp, void*);
+void halo_enqueue(void* b_, const diy::Master::ProxyWithLink& cp, void*);
+void halo_parse(void* b_, const diy::Master::ProxyWithLink& cp, void*);
+void compute(void* b_, const diy::Master::ProxyWithLink& cp, void*);
+double Overlap(double comm_time, double comp_time, double overlapped_time);
+int LinkItems(int from, int to);
+void MpiNeighbors(const diy::Master& master, vector<int>& neighbors, vector<int>& gids);
+double MpiIsendIrecv(const vector<int>& neighbors, const vector<int>& send_counts,
+                     const vector<int>& recv_counts, MPI_Comm comm, double mflops);
+double MpiCompute(double mflops, MPI_Comm comm);
+double MpiNeighborAlltoallv(MPI_Comm graph_comm, const vector<int>& send_counts,
+                            const vector<int>& recv_counts);
 
 // add blocks to a master
 struct AddBlock
@@ -76,11 +108,19 @@ namespace diy
     static void save(BinaryBuffer& bb, const block_t& d)
     {
       diy::save(bb, d.items);
+      diy::save(bb, d.flat);
+      diy::save(bb, d.offsets);
+      diy::save(bb, d.field);
+      diy::save(bb, d.halo_cells);
     }
 
     static void load(BinaryBuffer& bb, block_t& d)
     {
       diy::load(bb, d.items);
+      diy::load(bb, d.flat);
+      diy::load(bb, d.offsets);
+      diy::load(bb, d.field);
+      diy::load(bb, d.halo_cells);
     }
   };
 }
@@ -90,6 +130,10 @@ int num_items; // current number of items in a round
 int num_ints; // number of ints in one item
 int proc_factor = 4; // factor for iterating over procs, eg 4X more each time
 int item_factor = 4; // factor for iterating over items, eg 4X more each time
+int ghost = 0; // ghost width of the halo mode, 0 = item exchange instead of halo mode
+double compute_mflops = 0.0; // compute per block in overlap mode (Mflop), 0 = no overlap mode
+volatile double compute_sink; // result of the compute kernel in the MPI baseline
+std::string dist = "even"; // distribution of the number of items per link
 
 //----------------------------------------------------------------------------
 //
@@ -106,13 +150,23 @@ int main(int argc, char **argv)
   double t0; // temp time
   int nblocks; // my local number of blocks
   int num_item_iters; // number of item iterations per process
+  int num_threads; // number of threads diy uses to run the blocks
+  std::string out_file; // machine-readable results
+  int warmup, trials; // number of untimed and timed trials per run
+  bool wrap; // periodic boundaries
 
   MPI_Init(&argc, &argv);
   MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-  GetArgs(argc, argv, min_procs, min_items, max_items, num_ints, nblocks);
+  GetArgs(argc, argv, min_procs, min_items, max_items, num_ints, nblocks, num_threads, out_file,
+          warmup, trials, wrap);
   int item_size = num_ints * sizeof(int);
+  if (!results::open(out_file))
+  {
+    fprintf(stderr, "Error: cannot write results to %s\n", out_file.c_str());
+    exit(1);
+  }
 
   // data extents, unused
   Bounds domain;
@@ -127,6 +181,18 @@ int main(int argc, char **argv)
     (log2(max_items / min_items) + 1));
   double enqueue_time[num_runs]; // enqueue time for each run
   double exchange_time[num_runs]; // exchange time for each run
+  double bulk_enqueue_time[num_runs]; // enqueue time for each run, bulk mode
+  double bulk_exchange_time[num_runs]; // exchange time for each run, bulk mode
+  double isend_time[num_runs]; // MPI Isend/Irecv time for each run
+  double nbr_time[num_runs]; // MPI_Neighbor_alltoallv time for each run
+  double compute_time[num_runs]; // compute kernel time for each run, overlap mode
+  double overlap[num_runs]; // fraction of the DIY exchange hidden by the compute kernel
+  double isend_overlap[num_runs]; // fraction of the Isend/Irecv exchange hidden
+  double bytes_imbalance[num_runs]; // max over mean bytes sent per process for each run
+  double pack_time[num_runs]; // halo pack and enqueue time for each run
+  double halo_time[num_runs]; // halo exchange and unpack time for each run
+  double halo_mbs[num_runs]; // halo bandwidth for each run, MB/s
+  double halo_updates[num_runs]; // halo updates (ghost cells) per second for each run
 
   // iterate over processes
   int run = 0; // run number
@@ -149,7 +215,6 @@ int main(int argc, char **argv)
     // initialize DIY
     tot_blocks = nblocks * groupsize;
     int mem_blocks = -1; // everything in core for now
-    int num_threads = 1; // because of timing
     diy::mpi::communicator    world(mpi_comm);
     diy::FileStorage          storage("./DIY.XXXXXX");
     diy::Master               master(world,
@@ -168,31 +233,258 @@ int main(int argc, char **argv)
     std::vector<int> my_gids;
     assigner.local_gids(rank, my_gids);
     nblocks = my_gids.size();
-    diy::decompose(dim, rank, domain, assigner, create);
+    diy::decompose(dim, rank, domain, assigner, create, vector<bool>(dim, false),
+                   vector<bool>(dim, wrap));
+
+    // MPI baselines on the same link graph, only for one block per process
+    vector<int> neighbors; // ranks of the neighbors of the block
+    vector<int> neighbor_gids; // gids of the neighbors of the block
+    MPI_Comm graph_comm = MPI_COMM_NULL;
+    if (tot_blocks == groupsize && !ghost)
+    {
+      MpiNeighbors(master, neighbors, neighbor_gids);
+#if MPI_VERSION >= 3
+      int degree = neighbors.size();
+      MPI_Dist_graph_create_adjacent(mpi_comm, degree, degree ? &neighbors[0] : NULL,
+                                     MPI_UNWEIGHTED, degree, degree ? &neighbors[0] : NULL,
+                                     MPI_UNWEIGHTED, MPI_INFO_NULL, 0, &graph_comm);
+#endif
+    }
 
     // iterate over number of items
     num_items = min_items;
     num_item_iters = 0; // number of item iterations per process
     while (num_items <= max_items)
     {
-      MPI_Barrier(mpi_comm);
-      t0 = MPI_Wtime();
+      results::Run res("neighbor");
+      char op_name[64];
+      res.procs   = groupsize;
+      res.blocks  = tot_blocks;
+      res.elems   = num_items;
+      res.threads = num_threads;
+      char label[256];
+      sprintf(label, "procs %d items %d", groupsize, num_items);
+
+      // halo exchange of a field of num_items^3 cells per block, instead of the items
+      if (ghost)
+      {
+        sprintf(label, "procs %d side %d", groupsize, num_items);
+        res.elems = (long long)num_items * num_items * num_items;
+        sprintf(op_name, "halo ghost %d%s", ghost, wrap ? " wrap" : "");
+        res.op    = op_name;
+        master.foreach(&init_field);
+
+        stats::Samples pack_samples, halo_samples;
+        for (int t = -warmup; t < trials; t++)
+        {
+          // round 0 = pack and enqueue, round 1 = unpack
+          timing::round_timer().reset();
+          MPI_Barrier(mpi_comm);
+          t0 = MPI_Wtime();
+          master.foreach(&halo_enqueue);
+          double t1 = timing::round_timer().finish(0);
+          master.exchange();
+          master.foreach(&halo_parse);
+          if (t >= 0)
+          {
+            pack_samples.add(t1 - t0, mpi_comm);
+            halo_samples.add(timing::round_timer().finish(1) - t1, mpi_comm);
+          }
+        }
+        pack_time[run] = pack_samples.median();
+        halo_time[run] = halo_samples.median();
+
+        // ghost cells updated over all blocks, the same in every trial
+        long long local_cells = 0, cells;
+        for (int i = 0; i < (int)master.size(); i++)
+          local_cells += static_cast<block_t*>(master.block(i))->halo_cells;
+        MPI_Allreduce(&local_cells, &cells, 1, MPI_LONG_LONG, MPI_SUM, mpi_comm);
+        double time = pack_time[run] + halo_time[run];
+        halo_mbs[run]     = time > 0.0 ? cells * sizeof(float) / time / 1048576.0 : 0.0;
+        halo_updates[run] = time > 0.0 ? cells / time : 0.0;
+
+        results::emit(res, "pack_time", pack_samples);
+        results::emit(res, "exchange_time", halo_samples);
+        results::emit(mpi_comm, res, "halo_MB/s", halo_mbs[run]);
+        results::emit(mpi_comm, res, "halo_updates/s", halo_updates[run]);
+        stats::record(label, "pack_time", pack_samples);
+        stats::record(label, "exchange_time", halo_samples);
+        timing::print_rounds(label, mpi_comm);
+
+        num_items *= item_factor;
+        run++;
+        num_item_iters++;
+        continue;
+      }
 
-      // enqueue the items
-      master.foreach(&enqueue);
+      // bytes sent by this process, over the links of its blocks
+      long long local_bytes = 0, max_bytes, tot_bytes;
+      for (int i = 0; i < (int)master.size(); i++)
+        for (int j = 0; j < master.link(i)->size(); j++)
+          local_bytes += (long long)LinkItems(master.gid(i), master.link(i)->target(j).gid) *
+            item_size;
+      MPI_Allreduce(&local_bytes, &max_bytes, 1, MPI_LONG_LONG, MPI_MAX, mpi_comm);
+      MPI_Allreduce(&local_bytes, &tot_bytes, 1, MPI_LONG_LONG, MPI_SUM, mpi_comm);
+      bytes_imbalance[run] = tot_bytes ? (double)max_bytes * groupsize / tot_bytes : 1.0;
+      sprintf(op_name, "%d-byte items %s", item_size, dist.c_str());
+      res.op = op_name;
+      results::emit(mpi_comm, res, "bytes_sent", (double)local_bytes);
 
-      MPI_Barrier(mpi_comm);
-      enqueue_time[run] = MPI_Wtime() - t0;
-      t0 = MPI_Wtime();
+      // MPI baselines, sending the same items as the bulk mode
+      isend_time[run] = nbr_time[run] = isend_overlap[run] = 0.0;
+      if (tot_blocks == groupsize)
+      {
+        vector<int> send_counts, recv_counts; // ints per neighbor
+        for (int j = 0; j < (int)neighbor_gids.size(); j++)
+        {
+          send_counts.push_back(LinkItems(master.gid(0), neighbor_gids[j]) * num_ints);
+          recv_counts.push_back(LinkItems(neighbor_gids[j], master.gid(0)) * num_ints);
+        }
 
-      // exchange neighbors
-      master.exchange();
+        stats::Samples isend_samples, nbr_samples, comp_samples, ovl_samples;
+        for (int t = -warmup; t < trials; t++)
+        {
+          double isend = MpiIsendIrecv(neighbors, send_counts, recv_counts, mpi_comm, 0.0);
+          if (t >= 0)
+            isend_samples.add(isend, mpi_comm);
 
-      //  parse received items
-      master.foreach(&parse);
+          // overlap mode: the compute kernel alone, and between posting and completing
+          if (compute_mflops > 0.0)
+          {
+            double comp = MpiCompute(compute_mflops, mpi_comm);
+            double ovl  = MpiIsendIrecv(neighbors, send_counts, recv_counts, mpi_comm,
+                                        compute_mflops);
+            if (t >= 0)
+            {
+              comp_samples.add(comp, mpi_comm);
+              ovl_samples.add(ovl, mpi_comm);
+            }
+          }
+        }
+        isend_time[run] = isend_samples.median();
+        results::emit(res, "isend_time", isend_samples);
+        stats::record(label, "isend_time", isend_samples);
+        if (compute_mflops > 0.0)
+        {
+          isend_overlap[run] = Overlap(isend_time[run], comp_samples.median(),
+                                       ovl_samples.median());
+          results::emit(res, "isend_overlapped_time", ovl_samples);
+          results::emit(mpi_comm, res, "isend_overlap", isend_overlap[run]);
+          stats::record(label, "isend_overlapped", ovl_samples);
+        }
 
-      MPI_Barrier(mpi_comm);
-      exchange_time[run] = MPI_Wtime() - t0;
+        if (graph_comm != MPI_COMM_NULL)
+        {
+          for (int t = -warmup; t < trials; t++)
+          {
+            double nbr = MpiNeighborAlltoallv(graph_comm, send_counts, recv_counts);
+            if (t >= 0)
+              nbr_samples.add(nbr, mpi_comm);
+          }
+          nbr_time[run] = nbr_samples.median();
+          results::emit(res, "nbr_alltoallv_time", nbr_samples);
+          stats::record(label, "nbr_alltoallv", nbr_samples);
+        }
+      }
+
+      stats::Samples enqueue_samples, exchange_samples;
+      stats::Samples bulk_enqueue_samples, bulk_exchange_samples;
+      stats::Samples compute_samples, overlapped_samples;
+      for (int t = -warmup; t < trials; t++)
+      {
+        // enqueue and parse may run in several threads, so they are timed per callback:
+        // round 0 = enqueue, round 1 = parse, rounds 2 and 3 = the same in bulk mode,
+        // rounds 4 to 7 = enqueue, compute, parse, and compute alone in overlap mode
+        // the items received by the last pass are released before every pass, outside of its
+        // timing, so that every pass allocates its received items anew
+        timing::round_timer().reset();
+        master.foreach(&release_items);
+        MPI_Barrier(mpi_comm);
+        t0 = MPI_Wtime();
+
+        // enqueue the items one at a time
+        master.foreach(&enqueue);
+        double t1 = timing::round_timer().finish(0);
+
+        // exchange neighbors
+        master.exchange();
+
+        //  parse received items
+        master.foreach(&parse);
+        double t2 = timing::round_timer().finish(1);
+
+        // same items, enqueued as one span per neighbor
+        timing::round_timer().offset = 2;
+        master.foreach(&release_items);
+        MPI_Barrier(mpi_comm);
+        double t3 = MPI_Wtime();
+        master.foreach(&bulk_enqueue);
+        double t4 = timing::round_timer().finish(2);
+        master.exchange();
+        master.foreach(&bulk_parse);
+
+        // overlap mode: compute between enqueueing and exchanging, then compute alone
+        double t5 = 0.0, t6 = 0.0, t7 = 0.0;
+        if (compute_mflops > 0.0)
+        {
+          timing::round_timer().offset = 4;
+          master.foreach(&release_items);
+          MPI_Barrier(mpi_comm);
+          master.foreach(&enqueue);
+          t5 = timing::round_timer().finish(4);
+          timing::round_timer().offset = 5;
+          master.foreach(&compute);
+          master.exchange();
+          master.foreach(&parse);
+          t6 = timing::round_timer().finish(6);
+          timing::round_timer().offset = 7;
+          MPI_Barrier(mpi_comm);
+          t7 = MPI_Wtime();
+          master.foreach(&compute);
+        }
+
+        if (t >= 0)
+        {
+          enqueue_samples.add(t1 - t0, mpi_comm);
+          exchange_samples.add(t2 - t1, mpi_comm);
+          bulk_enqueue_samples.add(t4 - t3, mpi_comm);
+          bulk_exchange_samples.add(timing::round_timer().finish(3) - t4, mpi_comm);
+          if (compute_mflops > 0.0)
+          {
+            overlapped_samples.add(t6 - t5, mpi_comm);
+            compute_samples.add(timing::round_timer().finish(7) - t7, mpi_comm);
+          }
+        }
+      }
+      enqueue_time[run]       = enqueue_samples.median();
+      exchange_time[run]      = exchange_samples.median();
+      bulk_enqueue_time[run]  = bulk_enqueue_samples.median();
+      bulk_exchange_time[run] = bulk_exchange_samples.median();
+      compute_time[run]       = compute_samples.median();
+      overlap[run]            = Overlap(exchange_time[run], compute_time[run],
+                                        overlapped_samples.median());
+
+      results::emit(res, "enqueue_time", enqueue_samples);
+      results::emit(res, "exchange_time", exchange_samples);
+      sprintf(op_name, "%d-byte items %s bulk", item_size, dist.c_str());
+      res.op      = op_name;
+      results::emit(res, "enqueue_time", bulk_enqueue_samples);
+      results::emit(res, "exchange_time", bulk_exchange_samples);
+      stats::record(label, "enqueue_time", enqueue_samples);
+      stats::record(label, "exchange_time", exchange_samples);
+      stats::record(label, "bulk_enqueue", bulk_enqueue_samples);
+      stats::record(label, "bulk_exchange", bulk_exchange_samples);
+      if (compute_mflops > 0.0)
+      {
+        sprintf(op_name, "%d-byte items %s", item_size, dist.c_str());
+        res.op      = op_name;
+        results::emit(res, "compute_time", compute_samples);
+        results::emit(res, "overlapped_time", overlapped_samples);
+        results::emit(mpi_comm, res, "overlap", overlap[run]);
+        stats::record(label, "compute_time", compute_samples);
+        stats::record(label, "overlapped", overlapped_samples);
+      }
+      timing::print_rounds(label, mpi_comm);
 
       num_items *= item_factor;
       run++;
@@ -202,6 +494,8 @@ int main(int argc, char **argv)
 
     // cleanup
     groupsize *= proc_factor;
+    if (graph_comm != MPI_COMM_NULL)
+      MPI_Comm_free(&graph_comm);
     MPI_Comm_free(&mpi_comm);
 
   } // proc iteration
@@ -210,8 +504,17 @@ int main(int argc, char **argv)
   MPI_Barrier(MPI_COMM_WORLD);
   fflush(stderr);
   if (rank == 0)
-    PrintResults(enqueue_time, exchange_time, min_procs, max_procs, min_items,
-                 max_items, item_size, num_item_iters, proc_factor, item_factor);
+  {
+    if (ghost)
+      PrintHaloResults(pack_time, halo_time, halo_mbs, halo_updates, min_procs, max_procs,
+                       min_items, max_items, num_item_iters, proc_factor, item_factor);
+    else
+      PrintResults(enqueue_time, exchange_time, bulk_enqueue_time, bulk_exchange_time,
+                   isend_time, nbr_time, compute_time, overlap, isend_overlap,
+                   bytes_imbalance, min_procs, max_procs, min_items, max_items, item_size,
+                   num_item_iters, proc_factor, item_factor);
+    stats::print(warmup, trials);
+  }
 
   MPI_Finalize();
 
@@ -222,29 +525,362 @@ int main(int argc, char **argv)
 //
 void enqueue(void* b_, const diy::Master::ProxyWithLink& cp, void*)
 {
+  double t0 = timing::round_timer().begin(0);
   vector <int> vals(num_ints, 0);
-  for (int i = 0; i < num_items; i++)
+  for (int j = 0; j < cp.link()->size(); j++)
   {
-    for (int j = 0; j < cp.link()->size(); j++)
+    int n = LinkItems(cp.gid(), cp.link()->target(j).gid);
+    for (int i = 0; i < n; i++)
       cp.enqueue(cp.link()->target(j), vals);
   }
+  timing::round_timer().end(0, t0);
 }
 
 void parse(void* b_, const diy::Master::ProxyWithLink& cp, void*)
 {
   block_t* b = (block_t*)b_;
+  double t0 = timing::round_timer().begin(1);
+  std::vector<int> in; // gids of sources
+  cp.incoming(in);
+
+  size_t tot_items = 0;
+  for (int i = 0; i < (int)in.size(); i++)
+    tot_items += LinkItems(in[i], cp.gid());
+  b->items.resize(tot_items);
+
+  // copy received items
+  size_t k = 0; // items received so far
+  for (int i = 0; i < (int)in.size(); i++)
+  {
+    int n = LinkItems(in[i], cp.gid());
+    for(int j = 0; j < n; j++)
+      cp.dequeue(in[i], b->items[k++]);
+  }
+  timing::round_timer().end(1, t0);
+}
+
+// releases the received items of both modes
+void release_items(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  block_t* b = (block_t*)b_;
+  vector< vector <int> >().swap(b->items);
+  vector<int>().swap(b->flat);
+  vector<int>().swap(b->offsets);
+}
+
+// enqueues the items for each neighbor as one contiguous span, without a size header per item
+void bulk_enqueue(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  double t0 = timing::round_timer().begin(0);
+  vector <int> vals;
+  for (int j = 0; j < cp.link()->size(); j++)
+  {
+    vals.resize(LinkItems(cp.gid(), cp.link()->target(j).gid) * num_ints);
+    if (!vals.empty())
+      cp.enqueue(cp.link()->target(j), &vals[0], vals.size());
+  }
+  timing::round_timer().end(0, t0);
+}
+
+// receives the items of all neighbors into one flat buffer, with the offset of each item
+void bulk_parse(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  block_t* b = (block_t*)b_;
+  double t0 = timing::round_timer().begin(1);
   std::vector<int> in; // gids of sources
   cp.incoming(in);
 
-  b->items.resize(in.size() * num_items);
+  // the spans carry no header; their sizes are those of the incoming buffers
+  size_t tot_ints = 0;
+  for (int i = 0; i < (int)in.size(); i++)
+    tot_ints += cp.incoming(in[i]).size() / sizeof(int);
+  b->flat.resize(tot_ints);
+  b->offsets.resize(tot_ints / num_ints + 1);
 
   // copy received items
+  size_t n = 0; // ints received so far
   for (int i = 0; i < (int)in.size(); i++)
   {
-    for(int j = 0; j < num_items; j++)
-      cp.dequeue(in[i], b->items[i * num_items + j]);
+    size_t span = cp.incoming(in[i]).size() / sizeof(int);
+    if (span)
+      cp.dequeue(in[i], &b->flat[n], span);
+    n += span;
+  }
+  for (size_t k = 0; k < b->offsets.size(); k++)
+    b->offsets[k] = k * num_ints;
+  timing::round_timer().end(1, t0);
+}
+
+// halo mode: the block is a cube of num_items cells per side surrounded by ghost layers;
+// the neighbor in direction d (-1, 0, 1 per axis) is sent the interior cells next to that
+// face, edge, or corner, and the cells received from it fill the ghost cells beyond it
+
+// offset (-1, 0, 1) along each axis of a link direction
+void Offsets(int dir, int* d)
+{
+  static const int lower[3] = { DIY_X0, DIY_Y0, DIY_Z0 };
+  static const int upper[3] = { DIY_X1, DIY_Y1, DIY_Z1 };
+  for (int i = 0; i < 3; i++)
+    d[i] = (dir & lower[i]) ? -1 : ((dir & upper[i]) ? 1 : 0);
+}
+
+// cells [lo, hi) along one axis: the interior cells sent toward offset d (ghost = false), or
+// the ghost cells filled from offset d (ghost = true)
+void Range(int d, bool ghost_cells, int& lo, int& hi)
+{
+  if (d < 0)
+    lo = ghost_cells ? 0 : ghost;
+  else if (d > 0)
+    lo = ghost_cells ? ghost + num_items : num_items;
+  else
+    lo = ghost;
+  hi = lo + (d ? ghost : num_items);
+}
+
+// copies the cells of a region of the field to buf (pack = true) or back (pack = false)
+// returns the number of cells
+size_t CopyRegion(vector<float>& field, const int* d, bool ghost_cells, bool pack, float* buf)
+{
+  int side = num_items + 2 * ghost;
+  int lo[3], hi[3];
+  for (int i = 0; i < 3; i++)
+    Range(d[i], ghost_cells, lo[i], hi[i]);
+  size_t n = 0;
+  for (int z = lo[2]; z < hi[2]; z++)
+    for (int y = lo[1]; y < hi[1]; y++)
+    {
+      float* row = &field[((size_t)z * side + y) * side + lo[0]];
+      int len = hi[0] - lo[0];
+      if (pack)
+        std::copy(row, row + len, buf + n);
+      else
+        std::copy(buf + n, buf + n + len, row);
+      n += len;
+    }
+  return n;
+}
+
+// number of cells of a face, edge, or corner region
+size_t RegionSize(const int* d)
+{
+  size_t n = 1;
+  for (int i = 0; i < 3; i++)
+    n *= d[i] ? ghost : num_items;
+  return n;
+}
+
+// allocates the field and sets its interior to the gid of the block
+void init_field(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  block_t* b = (block_t*)b_;
+  size_t side = num_items + 2 * ghost;
+  b->field.assign(side * side * side, -1.0f);
+  int d[3] = { 0, 0, 0 };
+  vector<float> interior(RegionSize(d), cp.gid());
+  CopyRegion(b->field, d, false, false, &interior[0]);
+  b->halo_cells = 0;
+}
+
+// packs and enqueues the region toward each neighbor, preceded by its direction, so that the
+// receiver can tell apart several links to the same block (periodic boundaries)
+void halo_enqueue(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  block_t* b = (block_t*)b_;
+  double t0 = timing::round_timer().begin(0);
+  RCLink* l = static_cast<RCLink*>(cp.link());
+  vector<float> buf;
+  for (int j = 0; j < l->size(); j++)
+  {
+    int dir = l->direction(j);
+    int d[3];
+    Offsets(dir, d);
+    buf.resize(RegionSize(d));
+    CopyRegion(b->field, d, false, true, &buf[0]);
+    cp.enqueue(l->target(j), dir);
+    cp.enqueue(l->target(j), &buf[0], buf.size());
+  }
+  timing::round_timer().end(0, t0);
+}
+
+// unpacks the region received from each neighbor into the ghost cells on its side
+void halo_parse(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  block_t* b = (block_t*)b_;
+  double t0 = timing::round_timer().begin(1);
+  RCLink* l = static_cast<RCLink*>(cp.link());
+  vector<float> buf;
+  b->halo_cells = 0;
+  for (int j = 0; j < l->size(); j++)
+  {
+    // one message per link to the sender; its direction is seen from the sender
+    int dir;
+    cp.dequeue(l->target(j).gid, dir);
+    int d[3];
+    Offsets(dir, d);
+    for (int i = 0; i < 3; i++)
+      d[i] = -d[i];
+    buf.resize(RegionSize(d));
+    cp.dequeue(l->target(j).gid, &buf[0], buf.size());
+    b->halo_cells += CopyRegion(b->field, d, true, false, &buf[0]);
+  }
+  timing::round_timer().end(1, t0);
+}
+
+// overlap mode: runs the compute kernel of the block
+void compute(void* b_, const diy::Master::ProxyWithLink& cp, void*)
+{
+  block_t* b = (block_t*)b_;
+  double t0 = timing::round_timer().begin(0);
+  b->sink = kernel::run(compute_mflops);
+  timing::round_timer().end(0, t0);
+}
+
+//
+// fraction of the communication hidden behind the computation, 1 - exposed / total
+// communication, where the exposed communication is the time of the overlapped communication
+// and computation beyond the computation alone
+//
+double Overlap(double comm_time, double comp_time, double overlapped_time)
+{
+  if (comm_time <= 0.0)
+    return 0.0;
+  double exposed = std::max(overlapped_time - comp_time, 0.0);
+  return std::max(0.0, 1.0 - exposed / comm_time);
+}
+//----------------------------------------------------------------------------
+//
+// number of items sent over the link from block gid from to block gid to: num_items for the
+// even distribution, otherwise drawn from the distribution with a seed given by the two gids,
+// so that the receiver can draw the same number
+//
+//   uniform: uniform in [0, 2 num_items]
+//   powerlaw: Pareto with exponent 2 and mean num_items, capped at 64 num_items
+//   hotspot: 16 num_items to the one block in 16 that is hot, num_items / 2 to the others
+//
+int LinkItems(int from, int to)
+{
+  if (dist == "even")
+    return num_items;
+
+  // hash of the gids, as a number in (0, 1)
+  double u = kernel::hash01((unsigned)from, (unsigned)to);
+
+  if (dist == "uniform")
+    return (int)(u * (2 * num_items + 1));
+  if (dist == "powerlaw")
+    return (int)std::min(0.5 * num_items / sqrt(u), 64.0 * num_items);
+
+  // hotspot: whether the target is hot depends on its gid only
+  unsigned g = (unsigned)to * 0x9e3779b1u;
+  g ^= g >> 15;
+  return g % 16 == 0 ? 16 * num_items : num_items / 2;
+}
+//----------------------------------------------------------------------------
+//
+// MPI baselines
+//
+// ranks and gids of the neighbors of the only local block, in the order of its link
+//
+// master: diy master with one block
+// neighbors: ranks of the neighbors (output)
+// gids: gids of the neighbors (output)
+//
+void MpiNeighbors(const diy::Master& master, vector<int>& neighbors, vector<int>& gids)
+{
+  neighbors.clear();
+  gids.clear();
+  if (!master.size())
+    return;
+  const diy::Link* link = master.link(0);
+  for (int j = 0; j < link->size(); j++)
+  {
+    neighbors.push_back(link->target(j).proc);
+    gids.push_back(link->target(j).gid);
   }
 }
+
+//
+// nonblocking point-to-point exchange with every neighbor
+//
+// neighbors: ranks of the neighbors
+// send_counts, recv_counts: number of ints sent to and received from each neighbor
+// comm: current communicator
+// mflops: compute kernel run between posting and completing the messages (overlap mode), or 0
+//
+// returns the time of this process
+//
+double MpiIsendIrecv(const vector<int>& neighbors, const vector<int>& send_counts,
+                     const vector<int>& recv_counts, MPI_Comm comm, double mflops)
+{
+  int n = neighbors.size();
+  vector<int> recv_displs(n + 1, 0);
+  for (int j = 0; j < n; j++)
+    recv_displs[j + 1] = recv_displs[j] + recv_counts[j];
+  int max_count = n ? *std::max_element(send_counts.begin(), send_counts.end()) : 0;
+  vector<int> send(std::max(max_count, 1), 0); // the same zeros are sent to every neighbor
+  vector<int> recv(std::max(recv_displs[n], 1));
+  vector<MPI_Request> reqs(2 * n);
+
+  MPI_Barrier(comm);
+  double t0 = MPI_Wtime();
+  for (int j = 0; j < n; j++)
+    MPI_Irecv(&recv[recv_displs[j]], recv_counts[j], MPI_INT, neighbors[j], 0, comm,
+              &reqs[j]);
+  for (int j = 0; j < n; j++)
+    MPI_Isend(&send[0], send_counts[j], MPI_INT, neighbors[j], 0, comm, &reqs[n + j]);
+  if (mflops > 0.0)
+    compute_sink = kernel::run(mflops, kernel::TestRequests(n ? &reqs[0] : NULL, 2 * n));
+  if (n)
+    MPI_Waitall(2 * n, &reqs[0], MPI_STATUSES_IGNORE);
+  return MPI_Wtime() - t0;
+}
+
+//
+// the compute kernel alone, as run by MpiIsendIrecv in overlap mode
+//
+// mflops: amount of computation, in Mflop
+// comm: current communicator
+//
+// returns the time of this process
+//
+double MpiCompute(double mflops, MPI_Comm comm)
+{
+  MPI_Barrier(comm);
+  double t0 = MPI_Wtime();
+  compute_sink = kernel::run(mflops);
+  return MPI_Wtime() - t0;
+}
+
+//
+// the same exchange as one MPI_Neighbor_alltoallv on a distributed graph communicator
+//
+// graph_comm: communicator with the neighbors of the link as sources and destinations
+// send_counts, recv_counts: number of ints sent to and received from each neighbor
+//
+// returns the time of this process
+//
+double MpiNeighborAlltoallv(MPI_Comm graph_comm, const vector<int>& send_counts,
+                            const vector<int>& recv_counts)
+{
+#if MPI_VERSION >= 3
+  int n = send_counts.size();
+  vector<int> send_displs(n, 0), recv_displs(n + 1, 0);
+  for (int j = 0; j < n; j++)
+    recv_displs[j + 1] = recv_displs[j] + recv_counts[j];
+  int max_count = n ? *std::max_element(send_counts.begin(), send_counts.end()) : 0;
+  vector<int> send(std::max(max_count, 1), 0); // the same zeros are sent to every neighbor
+  vector<int> recv(std::max(recv_displs[n], 1));
+
+  MPI_Barrier(graph_comm);
+  double t0 = MPI_Wtime();
+  MPI_Neighbor_alltoallv(&send[0], n ? &send_counts[0] : NULL, n ? &send_displs[0] : NULL,
+                         MPI_INT, n ? &recv[0] : NULL, n ? &recv_counts[0] : NULL,
+                         n ? &recv_displs[0] : NULL, MPI_INT, graph_comm);
+  return MPI_Wtime() - t0;
+#else
+  return 0.0;
+#endif
+}
 //----------------------------------------------------------------------------
 //
 // diy::Master callback functions
@@ -261,6 +897,8 @@ void destroy_block(void* b_)
   for (int i = 0; i < b->items.size(); i++)
     b->items[i].clear();
   b->items.clear();
+  b->flat.clear();
+  b->offsets.clear();
   delete b;
 }
 
@@ -270,13 +908,73 @@ void save_block(const void* b, diy::BinaryBuffer& bb)
 
 void load_block(void* b, diy::BinaryBuffer& bb)
 {
+}
+//----------------------------------------------------------------------------
+//
+// print results of the halo mode
+//
+// pack_time: pack and enqueue time per run, median over the trials
+// halo_time: exchange and unpack time per run, median over the trials
+// halo_mbs: ghost cells received over all blocks, in MB, per second of pack and exchange time
+// halo_updates: ghost cells updated over all blocks per second of pack and exchange time
+// min_procs, max_procs: process range
+// min_side, max_side: range of the number of cells per block side
+// num_item_iters: number of side iterations per process
+// proc_factor: factor change for process iteration
+// item_factor: factor change for side iteration
+//
+void PrintHaloResults(double *pack_time, double *halo_time, double *halo_mbs,
+                      double *halo_updates, int min_procs, int max_procs, int min_side,
+                      int max_side, int num_item_iters, int proc_factor, int item_factor) {
+
+  int item_iter = 0; // side iteration number
+  int proc_iter = 0; // process iteration number
+
+  fprintf(stderr, "----- Timing Results -----\n");
+
+  // iterate over block sizes
+  int side = min_side;
+  while (side <= max_side) {
+
+    fprintf(stderr, "\n# %d^3 cells * 4 bytes / cell, ghost width %d\n", side, ghost);
+    fprintf(stderr, "# procs \t time (s) \t pack_time (s) \t exchange_time (s) \t MB/s \t\t "
+            "halo_updates/s\n");
+
+    // iterate over processes
+    int groupsize = min_procs;
+    proc_iter = 0;
+    while (groupsize <= max_procs) {
+
+      int i = proc_iter * num_item_iters + item_iter; // index into times
+      fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf \t\t %.3lf \t\t\t %.1lf \t\t %.3le\n",
+	      groupsize, pack_time[i] + halo_time[i], pack_time[i], halo_time[i],
+              halo_mbs[i], halo_updates[i]);
+
+      groupsize *= proc_factor;
+      proc_iter++;
+
+    } // proc iteration
+
+    side *= item_factor;
+    item_iter++;
+
+  } // side iteration
+
+  fprintf(stderr, "\n--------------------------\n\n");
+
 }
 //----------------------------------------------------------------------------
 //
 // print results
 //
-// enqueue_time: enqueue time per run
-// exchange_time: exchange time per run
+// enqueue_time: enqueue time per run, median over the trials
+// exchange_time: exchange time per run, median over the trials
+// bulk_enqueue_time, bulk_exchange_time: same, with one span per neighbor instead of per item
+// isend_time, nbr_time: MPI Isend/Irecv and MPI_Neighbor_alltoallv times per run, median over
+// the trials (0 if not measured)
+// compute_time, overlap, isend_overlap: compute kernel time, and fraction of the DIY and the
+// Isend/Irecv exchanges hidden behind it, per run (overlap mode only)
+// bytes_imbalance: max over mean bytes sent per process, per run
 // min_procs, max_procs: process range
 // min_items, max_items: data range
 // item_size: in bytes
@@ -284,9 +982,12 @@ void load_block(void* b, diy::BinaryBuffer& bb)
 // proc_factor: factor change for process iteration
 // item_factor: factor change for item iteration
 //
-void PrintResults(double *enqueue_time, double *exchange_time, int min_procs, int max_procs,
-		  int min_items, int max_items, int item_size, int num_item_iters,
-                  int proc_factor, int item_factor) {
+void PrintResults(double *enqueue_time, double *exchange_time, double *bulk_enqueue_time,
+                  double *bulk_exchange_time, double *isend_time, double *nbr_time,
+                  double *compute_time, double *overlap, double *isend_overlap,
+                  double *bytes_imbalance, int min_procs, int max_procs, int min_items,
+                  int max_items, int item_size, int num_item_iters, int proc_factor,
+                  int item_factor) {
 
   int item_iter = 0; // item iteration number
   int proc_iter = 0; // process iteration number
@@ -297,9 +998,16 @@ void PrintResults(double *enqueue_time, double *exchange_time, int min_procs, in
   int num_items = min_items;
   while (num_items <= max_items) {
 
-    fprintf(stderr, "\n# %d items * %d bytes / item = %d KB\n",
-	    num_items, item_size, num_items * item_size / 1024);
-    fprintf(stderr, "# procs \t time (s) \t enqueue_time (s) \t exchange_time (s)\n");
+    fprintf(stderr, "\n# %d items * %d bytes / item = %d KB (per link, %s distribution)\n",
+	    num_items, item_size, num_items * item_size / 1024, dist.c_str());
+    fprintf(stderr, "# procs \t time (s) \t enqueue_time (s) \t exchange_time (s) \t "
+            "bulk_time (s) \t bulk_enqueue (s) \t bulk_exchange (s) \t isend_time (s) \t "
+            "nbr_alltoallv (s)");
+    if (compute_mflops > 0.0)
+      fprintf(stderr, " \t compute_time (s) \t overlap \t isend_overlap");
+    if (dist != "even")
+      fprintf(stderr, " \t max/mean bytes");
+    fprintf(stderr, "\n");
 
     // iterate over processes
     int groupsize = min_procs;
@@ -307,9 +1015,18 @@ void PrintResults(double *enqueue_time, double *exchange_time, int min_procs, in
     while (groupsize <= max_procs) {
 
       int i = proc_iter * num_item_iters + item_iter; // index into times
-      fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf \t\t\t %.3lf\n",
+      fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf \t\t\t %.3lf \t\t\t %.3lf \t\t %.3lf "
+              "\t\t %.3lf \t\t %.3lf \t\t %.3lf",
 	      groupsize, enqueue_time[i] + exchange_time[i],
-              enqueue_time[i], exchange_time[i]);
+              enqueue_time[i], exchange_time[i],
+              bulk_enqueue_time[i] + bulk_exchange_time[i],
+              bulk_enqueue_time[i], bulk_exchange_time[i], isend_time[i], nbr_time[i]);
+      if (compute_mflops > 0.0)
+        fprintf(stderr, " \t\t %.3lf \t\t %.2lf \t\t %.2lf", compute_time[i], overlap[i],
+                isend_overlap[i]);
+      if (dist != "even")
+        fprintf(stderr, " \t\t %.2lf", bytes_imbalance[i]);
+      fprintf(stderr, "\n");
 
       groupsize *= proc_factor;
       proc_iter++;
@@ -334,9 +1051,15 @@ void PrintResults(double *enqueue_time, double *exchange_time, int min_procs, in
 // max_items: maximum number of items to exchange (output)
 // num_ints: number of ints per item (output)
 // nb: number of local blocks
+// num_threads: number of threads (output)
+// out_file: file for the machine-readable results (results.h), empty = none (output)
+// warmup: number of untimed trials before the timed ones of each run (output)
+// trials: number of timed trials of each run, summarized by their median (output)
+// wrap: periodic boundaries (output)
 //
 void GetArgs(int argc, char **argv, int &min_procs,
-	     int &min_items, int &max_items, int &num_ints, int &nb) {
+	     int &min_items, int &max_items, int &num_ints, int &nb, int &num_threads,
+             std::string &out_file, int &warmup, int &trials, bool &wrap) {
 
   using namespace opts;
   Options ops(argc, argv);
@@ -345,6 +1068,15 @@ void GetArgs(int argc, char **argv, int &min_procs,
   MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
+  num_threads = 1;
+  ops >> Option('t', "threads", num_threads, "number of threads");
+  args::run_options(ops, out_file, warmup, trials);
+  ops >> Option('g', "ghost", ghost, "halo exchange with this ghost width instead of items");
+  wrap = ops >> Present('p', "wrap", "periodic boundaries");
+  ops >> Option('c', "compute", compute_mflops,
+                "overlap mode with a compute kernel of this many Mflop per block");
+  ops >> Option('d', "dist", dist, "items per link: even, uniform, powerlaw, or hotspot");
+
   if (ops >> Present('h', "help", "show help") ||
       !(ops >> PosOption(min_procs)
         >> PosOption(min_items)
@@ -353,14 +1085,49 @@ void GetArgs(int argc, char **argv, int &min_procs,
         >> PosOption(nb)))
   {
     if (rank == 0)
-      fprintf(stderr, "Usage: %s min_procs min_items max_items num_ints nb\n", argv[0]);
+      fprintf(stderr, "Usage: %s [-t threads] [-o results] [-w warmup] [-n trials] "
+              "[-g ghost [-p]] [-c mflops] [-d dist] "
+              "min_procs min_items max_items num_ints nb\n", argv[0]);
+    exit(1);
+  }
+
+  args::check_threads(num_threads, rank);
+
+  args::check_trials(warmup, trials);
+
+  // in halo mode, the items are the cells per block side (num_ints is unused)
+  if (ghost < 0)
+    ghost = 0;
+  if (ghost > min_items)
+  {
+    if (rank == 0)
+      fprintf(stderr, "Error: the ghost width cannot exceed the block side %d\n", min_items);
+    exit(1);
+  }
+  if (ghost)
+    item_factor = 2;
+
+  // periodic links can repeat a neighbor gid, which the item exchange dequeues only once
+  if (wrap && !ghost)
+  {
+    if (rank == 0)
+      fprintf(stderr, "Error: periodic boundaries (-p) require the halo mode (-g)\n");
+    exit(1);
+  }
+
+  if (dist != "even" && dist != "uniform" && dist != "powerlaw" && dist != "hotspot")
+  {
+    if (rank == 0)
+      fprintf(stderr, "Error: unknown distribution %s\n", dist.c_str());
     exit(1);
   }
 
   if (rank == 0) {
     fprintf(stderr, "min_procs = %d max_procs = %d "
-	    "min_items = %d max_items = %d num_num_ints = %d nb = %d\n",
-	    min_procs, max_procs, min_items, max_items, num_ints, nb);
+	    "min_items = %d max_items = %d num_num_ints = %d nb = %d threads = %d "
+            "warmup = %d trials = %d ghost = %d wrap = %d compute = %.1lf Mflop dist = %s\n",
+            min_procs, max_procs, min_items, max_items, num_ints, nb, num_threads, warmup,
+            trials, ghost, wrap, compute_mflops, dist.c_str());
   }
 
 }
@@ -16,8 +16,9 @@
 #include <vector>
 #include <algorithm>
 #include <limits>
+#include <string>
+#include <random>
 #include <assert.h>
-#include <limits>
 
 #include <diy/master.hpp>
 #include <diy/reduce.hpp>
@@ -26,6 +27,12 @@
 #include <diy/assigner.hpp>
 
 #include "../../include/opts.h"
+#include "../../include/args.h"
+#include "../../include/timing.h"
+#include "../../include/spill.h"
+#include "../../include/autotune.h"
+#include "../../include/results.h"
+#include "../../include/stats.h"
 
 using namespace std;
 
@@ -33,9 +40,135 @@ typedef  diy::ContinuousBounds       Bounds;
 typedef  diy::RegularContinuousLink  RCLink;
 typedef  std::vector<size_t>         Histogram;
 
+// input key distributions, as fractions u in [0, 1] of the range of the generated keys
+// (KeyTraits::scale)
+enum Distribution
+{
+    UNIFORM,                                 // uniform
+    ZIPF,                                    // P(u) ~ 1/u over 2^30 values, many repeated small keys
+    GAUSSIAN,                                // mean 1/2, std. dev. 1/64
+    SORTED,                                  // uniform, already sorted across blocks
+    EQUAL                                    // all keys equal
+};
+
+const char* dist_names[] = { "uniform", "zipf", "gaussian", "sorted", "equal" };
+
+// random number engine of a block, seeded with its gid, so that its keys do not depend on the
+// threads that generate the blocks
+typedef std::mt19937_64 Rng;
+
+// uniform double in [0, 1)
+inline double uniform(Rng& rng)
+{
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// key types
+enum KeyType
+{
+    INT32,
+    INT64,
+    FLOAT,
+    DOUBLE
+};
+
+const char* key_names[] = { "int32", "int64", "float", "double" };
+
+//
+// key traits
+//
+// bits() maps the keys to unsigned integers in the same order, for the radix sort and the bins
+// of the refined histogram, and key() maps them back; random() and scale() generate the keys,
+// which lie in [min(), max()]
+//
+template<class Key>
+struct KeyTraits;
+
+// integer keys: the sign bit is flipped so that negative keys come first
+template<>
+struct KeyTraits<int>
+{
+    typedef unsigned    Bits;
+
+    static Bits         bits(int x)                             { return (Bits)x ^ 0x80000000u; }
+    static int          key(Bits u)                             { return (int)(u ^ 0x80000000u); }
+    static int          random(Rng& rng)                        { return rng() >> 33; }
+    static int          scale(double u)                         { return (int)(u * RAND_MAX); }
+    static int          min()                                   { return std::numeric_limits<int>::min(); }
+    static int          max()                                   { return std::numeric_limits<int>::max(); }
+};
+
+template<>
+struct KeyTraits<long long>
+{
+    typedef unsigned long long  Bits;
+
+    static Bits         bits(long long x)                       { return (Bits)x ^ 0x8000000000000000ULL; }
+    static long long    key(Bits u)                             { return (long long)(u ^ 0x8000000000000000ULL); }
+    static long long    random(Rng& rng)                        { return rng() >> 1; }
+    static long long    scale(double u)
+        { return u >= 1.0 ? max() : (long long)(u * 9223372036854775808.0); }
+    static long long    min()                                   { return std::numeric_limits<long long>::min(); }
+    static long long    max()                                   { return std::numeric_limits<long long>::max(); }
+};
+
+// floating-point keys: all the bits of negative keys are flipped, only the sign bit of the others
+template<>
+struct KeyTraits<float>
+{
+    typedef unsigned    Bits;
+
+    static Bits         bits(float x)
+        {
+            Bits u;
+            memcpy(&u, &x, sizeof(u));
+            return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+        }
+    static float        key(Bits u)
+        {
+            u = (u & 0x80000000u) ? (u & 0x7fffffffu) : ~u;
+            float x;
+            memcpy(&x, &u, sizeof(x));
+            return x;
+        }
+    static float        random(Rng& rng)                        // 24 random bits
+        { return (rng() >> 40) / 16777216.0f; }
+    static float        scale(double u)                         { return u; }
+    static float        min()                                   { return 0.0f; }
+    static float        max()                                   { return 1.0f; }
+};
+
+template<>
+struct KeyTraits<double>
+{
+    typedef unsigned long long  Bits;
+
+    static Bits         bits(double x)
+        {
+            Bits u;
+            memcpy(&u, &x, sizeof(u));
+            return (u & 0x8000000000000000ULL) ? ~u : (u | 0x8000000000000000ULL);
+        }
+    static double       key(Bits u)
+        {
+            u = (u & 0x8000000000000000ULL) ? (u & 0x7fffffffffffffffULL) : ~u;
+            double x;
+            memcpy(&x, &u, sizeof(x));
+            return x;
+        }
+    static double       random(Rng& rng)                        { return uniform(rng); }
+    static double       scale(double u)                         { return u; }
+    static double       min()                                   { return 0.0; }
+    static double       max()                                   { return 1.0; }
+};
+
 // block
+// the payload of values[i] is payload[i * psize, (i + 1) * psize) and moves with it
+template<class Key>
 struct Block
 {
+    typedef KeyTraits<Key>      Traits;
+
     Block()                                                     {}
     static void*    create()                                    { return new Block; }
     static void     destroy(void* b)                            { delete static_cast<Block*>(b); }
@@ -43,24 +176,98 @@ struct Block
         { diy::save(bb, *static_cast<const Block*>(b)); }
     static void     load(void* b, diy::BinaryBuffer& bb)
         { diy::load(bb, *static_cast<Block*>(b)); }
-    void generate_data(size_t n)
+    void generate_data(size_t n, int dist, int tot_blocks)
         {
-            std::numeric_limits<int> lims;
-            min = lims.min();
-            max = lims.max();
+            min = Traits::min();
+            max = Traits::max();
             values.resize(n);
-            srand(gid);
+            Rng rng(gid);
+            for (size_t i = 0; i < n; ++i)
+            {
+                switch (dist)
+                {
+                case ZIPF:
+                    values[i] = Traits::scale((pow(1073741824.0, uniform(rng)) - 1.0) /
+                                              1073741824.0);
+                    break;
+                case GAUSSIAN:
+                {
+                    // Box-Muller
+                    double u1 = 1.0 - uniform(rng);
+                    double u2 = uniform(rng);
+                    double x  = 0.5 + sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2) / 64.0;
+                    values[i] = Traits::scale(x < 0.0 ? 0.0 : (x > 1.0 ? 1.0 : x));
+                    break;
+                }
+                case SORTED:
+                    values[i] = Traits::scale(((double)gid * n + i) / ((double)tot_blocks * n));
+                    break;
+                case EQUAL:
+                    values[i] = Traits::scale(0.5);
+                    break;
+                default:
+                    values[i] = Traits::random(rng);
+                }
+            }
+
+            // the payload repeats the bytes of its key, so that VerifyBlock can match them
+            payload.resize(n * psize);
             for (size_t i = 0; i < n; ++i)
-                values[i] = rand();
+                for (int j = 0; j < psize; ++j)
+                    payload[i * psize + j] = ((const char*)&values[i])[j % sizeof(Key)];
         }
 
-    int                   min, max;   // min, max of values
-    std::vector<int>      values;     // data values
+    Key                   min, max;   // min, max of values
+    std::vector<Key>      values;     // data values
+    std::vector<char>     payload;    // psize bytes per value
+    int                   psize;      // payload size per value in bytes
     int                   gid;        // block gid
     int                   bins;       // number of bins in the histogram
+    int                   samples;    // number of samples per block in the sample sort
+    std::vector<Key>      lows;       // lower bounds of the bins of the refined histogram
+    Histogram             hist;       // last histogram reduced over the group (refinement)
+    std::vector<Key>      scratch;    // temporary storage reused by the local sort and the
+    std::vector<char>     pscratch;   // bucketing, for the values and the payload (not serialized)
 };
 
+// serialize a block (used when blocks are moved out of core)
+namespace diy
+{
+    template<class Key>
+        struct Serialization< Block<Key> >
+    {
+        static void save(BinaryBuffer& bb, const Block<Key>& b)
+        {
+            diy::save(bb, b.min);
+            diy::save(bb, b.max);
+            diy::save(bb, b.values);
+            diy::save(bb, b.payload);
+            diy::save(bb, b.psize);
+            diy::save(bb, b.gid);
+            diy::save(bb, b.bins);
+            diy::save(bb, b.samples);
+            diy::save(bb, b.lows);
+            diy::save(bb, b.hist);
+        }
+
+        static void load(BinaryBuffer& bb, Block<Key>& b)
+        {
+            diy::load(bb, b.min);
+            diy::load(bb, b.max);
+            diy::load(bb, b.values);
+            diy::load(bb, b.payload);
+            diy::load(bb, b.psize);
+            diy::load(bb, b.gid);
+            diy::load(bb, b.bins);
+            diy::load(bb, b.samples);
+            diy::load(bb, b.lows);
+            diy::load(bb, b.hist);
+        }
+    };
+}
+
 // add blocks to a master
+template<class Key>
 struct AddBlock
 {
     AddBlock(diy::Master& master_): master(master_)               {}
@@ -68,7 +275,7 @@ struct AddBlock
     void operator()(int gid, const Bounds& core, const Bounds& bounds, const Bounds& domain,
                     const RCLink& link) const
         {
-            Block*        b = new Block();
+            Block<Key>*   b = new Block<Key>();
             RCLink*       l = new RCLink(link);
             diy::Master&  m = const_cast<diy::Master&>(master);
             m.add(gid, b, l);
@@ -82,24 +289,33 @@ struct AddBlock
 // reset the size and data values in a block
 // args[0]: num_elems
 // args[1]: bins
+// args[2]: samples
+// args[3]: distribution
+// args[4]: tot_blocks
+// args[5]: payload bytes per value
 //
+template<class Key>
 void ResetBlock(void* b_,
                 const diy::Master::ProxyWithLink& cp,
                 void* args)
 {
-    Block* b      = static_cast<Block*>(b_);
+    Block<Key>* b = static_cast<Block<Key>*>(b_);
     int *a        = (int*)args;
     int num_elems = a[0];
     b->bins       = a[1];
-    b->generate_data(num_elems);
+    b->samples    = a[2];
+    b->psize      = a[5];
+    b->generate_data(num_elems, a[3], a[4]);
 }
 
+template<class Key>
 void VerifyBlock(void* b_,
                  const diy::Master::ProxyWithLink& cp,
                  void*)
 {
-    Block* b   = static_cast<Block*>(b_);
-    int act_min, act_max; // actual min and max of the values
+    Block<Key>* b = static_cast<Block<Key>*>(b_);
+    Key act_min, act_max; // actual min and max of the values
+    bool payload_ok = true;
     for (size_t i = 0; i < b->values.size(); ++i)
     {
         if (i == 0 || b->values[i] < act_min)
@@ -107,43 +323,64 @@ void VerifyBlock(void* b_,
         if (i == 0 || b->values[i] > act_max)
             act_max = b->values[i];
         if (b->values[i] < b->min || b->values[i] > b->max)
-            fprintf(stderr, "Warning: in gid %d %d outside of %d, %d\n",
-                    b->gid, b->values[i], b->min, b->max);
+            fprintf(stderr, "Warning: in gid %d %.17g outside of %.17g, %.17g\n",
+                    b->gid, (double)b->values[i], (double)b->min, (double)b->max);
         if (i > 0 && b->values[i] < b->values[i - 1])
             fprintf(stderr, "Warning: gid %d is not sorted\n", b->gid);
+        for (int j = 0; j < b->psize; ++j)
+            if (b->payload[i * b->psize + j] != ((const char*)&b->values[i])[j % sizeof(Key)])
+                payload_ok = false;
         //     fprintf(stderr, "diy2: gid %d sorted data[%lu] = %d\n", b->gid, i, b->values[i]);
     }
-    fprintf(stderr, "diy2 sort: gid %d num_elems %lu (min, max) = (%d %d)\n",
-            b->gid, b->values.size(), act_min, act_max);
+    if (!payload_ok)
+        fprintf(stderr, "Warning: gid %d payload does not match its keys\n", b->gid);
+    fprintf(stderr, "diy2 sort: gid %d num_elems %lu (min, max) = (%.17g %.17g)\n",
+            b->gid, b->values.size(), (double)act_min, (double)act_max);
 }
 
 // 1D sort partners:
 //   these allow for k-ary reductions (as opposed to kd-trees,
 //   which are fixed at k=2)
+//   the histogram rounds of each exchange level can be repeated (passes > 1) to refine the
+//   histogram before the exchange
+//   the k of each level is given by a schedule (autotune.h)
 struct SortPartners
 {
-    // bool = are we in an exchange (vs histogram) round
-    // int  = round within that partner
-    typedef       std::pair<bool, int>            RoundType;
-
-    SortPartners(int nblocks, int k):
-        histogram(1, nblocks, k),
-        exchange(1, nblocks, k, false)
+    struct RoundType
+    {
+        RoundType(bool exchange_, int sub_round_, int level_, int pass_):
+            exchange(exchange_), sub_round(sub_round_), level(level_), pass(pass_)     {}
+
+        bool      exchange;                  // are we in an exchange (vs histogram) round
+        int       sub_round;                 // round within that partner
+        int       level;                     // exchange round that this round leads up to
+        int       pass;                      // histogram pass within the level
+    };
+
+    SortPartners(int nblocks, const autotune::Schedule& schedule, int passes = 1):
+        histogram(autotune::partners<diy::RegularSwapPartners>(nblocks, schedule)),
+        exchange(autotune::partners<diy::RegularSwapPartners>(nblocks, schedule, false)),
+        passes_(passes)
         {
             for (unsigned i = 0; i < exchange.rounds(); ++i)
             {
-                // fill histogram rounds
-                for (unsigned j = 0; j < histogram.rounds() - i; ++j)
-                    rounds_.push_back(std::make_pair(false, j));
+                // fill histogram rounds, once per pass
+                for (int p = 0; p < passes; ++p)
+                    for (unsigned j = 0; j < histogram.rounds() - i; ++j)
+                        rounds_.push_back(RoundType(false, j, i, p));
 
                 // fill exchange round
-                rounds_.push_back(std::make_pair(true, i));
+                rounds_.push_back(RoundType(true, i, i, 0));
             }
         }
 
     size_t        rounds() const                              { return rounds_.size(); }
-    bool          exchange_round(int round) const             { return rounds_[round].first; }
-    int           sub_round(int round) const                  { return rounds_[round].second; }
+    bool          exchange_round(int round) const             { return rounds_[round].exchange; }
+    int           sub_round(int round) const                  { return rounds_[round].sub_round; }
+    int           pass(int round) const                       { return rounds_[round].pass; }
+    int           passes() const                              { return passes_; }
+    // k of the exchange that a round leads up to
+    int           exchange_k(int round) const                 { return exchange.size(rounds_[round].level); }
 
     inline bool   active(int round, int gid, const diy::Master& master) const { return true; }
 
@@ -156,8 +393,10 @@ struct SortPartners
                 histogram.incoming(sub_round(round-1) + 1, gid, partners, master);
             else        // histogram round
             {
-                if (round > 0 && sub_round(round) == 0)
+                if (round > 0 && sub_round(round) == 0 && pass(round) == 0)
                     exchange.incoming(sub_round(round - 1) + 1, gid, partners, master);
+                else if (round > 0 && sub_round(round) == 0)    // next pass of the histogram
+                    histogram.incoming(sub_round(round - 1) + 1, gid, partners, master);
                 else
                     histogram.incoming(sub_round(round), gid, partners, master);
             }
@@ -174,23 +413,168 @@ struct SortPartners
 
     diy::RegularSwapPartners          histogram;
     diy::RegularSwapPartners          exchange;
+    int                               passes_;
     std::vector<RoundType>            rounds_;
 };
 
 
+// local sort stage: sorts the values of a block in place together with their payload, may use
+// the scratch buffers as temporary storage
+enum LocalSort
+{
+    RADIX_SORT,
+    STD_SORT
+};
+
+LocalSort local_sort_type = RADIX_SORT;      // selected with -s
+
+// orders the indices of values by value
+template<class Key>
+struct IndexLess
+{
+    IndexLess(const std::vector<Key>& values_): values(values_)  {}
+    bool operator()(size_t i, size_t j) const                   { return values[i] < values[j]; }
+
+    const std::vector<Key>& values;
+};
+
+// std::sort of the values, or of their indices followed by a gather when there is a payload
+template<class Key>
+void std_sort(Block<Key>* b)
+{
+    size_t n  = b->values.size();
+    size_t ps = b->psize;
+    if (!ps)
+    {
+        std::sort(b->values.begin(), b->values.end());
+        return;
+    }
+    if (n < 2)
+        return;
+
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), IndexLess<Key>(b->values));
+
+    b->scratch.resize(n);
+    b->pscratch.resize(n * ps);
+    for (size_t i = 0; i < n; ++i)
+    {
+        b->scratch[i] = b->values[order[i]];
+        memcpy(&b->pscratch[i * ps], &b->payload[order[i] * ps], ps);
+    }
+    b->values.swap(b->scratch);
+    b->payload.swap(b->pscratch);
+}
+
+// LSD radix sort of the keys mapped by KeyTraits::bits, 8 bits per pass
+// passes in which all the keys have the same digit are skipped; the payload moves with its key
+// in every pass
+template<class Key>
+void radix_sort(Block<Key>* b)
+{
+    typedef KeyTraits<Key>                  Traits;
+    typedef typename Traits::Bits           Bits;
+    const int digits = sizeof(Bits);
+
+    size_t n  = b->values.size();
+    size_t ps = b->psize;
+    if (n < 2)
+        return;
+    b->scratch.resize(n);
+    b->pscratch.resize(n * ps);
+
+    // histograms of all the digits in one pass
+    size_t counts[digits][256];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; ++i)
+    {
+        Bits u = Traits::bits(b->values[i]);
+        for (int d = 0; d < digits; ++d)
+            ++counts[d][(u >> (8 * d)) & 0xff];
+    }
+
+    Key*  src  = &b->values[0];
+    Key*  dst  = &b->scratch[0];
+    char* psrc = ps ? &b->payload[0]  : NULL;
+    char* pdst = ps ? &b->pscratch[0] : NULL;
+    for (int d = 0; d < digits; ++d)
+    {
+        int shift = 8 * d;
+        if (counts[d][(Traits::bits(src[0]) >> shift) & 0xff] == n)
+            continue;
+
+        size_t offsets[256];
+        size_t sum = 0;
+        for (int j = 0; j < 256; ++j)
+        {
+            offsets[j] = sum;
+            sum += counts[d][j];
+        }
+        if (ps)
+            for (size_t i = 0; i < n; ++i)
+            {
+                size_t j = offsets[(Traits::bits(src[i]) >> shift) & 0xff]++;
+                dst[j] = src[i];
+                memcpy(pdst + j * ps, psrc + i * ps, ps);
+            }
+        else
+            for (size_t i = 0; i < n; ++i)
+                dst[offsets[(Traits::bits(src[i]) >> shift) & 0xff]++] = src[i];
+        std::swap(src, dst);
+        std::swap(psrc, pdst);
+    }
+    if (src != &b->values[0])
+    {
+        b->values.swap(b->scratch);
+        b->payload.swap(b->pscratch);
+    }
+}
+
+template<class Key>
+void local_sort(Block<Key>* b)
+{
+    if (local_sort_type == STD_SORT)
+        std_sort(b);
+    else
+        radix_sort(b);
+}
+
+// sends values[from, from + n) as a count followed by the values and then their payload, so that
+// the receiver can place them directly at the end of its own
+template<class Key>
+void enqueue_values(const diy::ReduceProxy& srp,
+                    const diy::BlockID& to,
+                    const std::vector<Key>& values,
+                    const std::vector<char>& payload,
+                    size_t psize,
+                    size_t from,
+                    size_t n)
+{
+    srp.enqueue(to, n);
+    if (n)
+    {
+        srp.enqueue(to, &values[from], n);
+        if (psize)
+            srp.enqueue(to, &payload[from * psize], n * psize);
+    }
+}
+
 // helper functions for the sort operator
+template<class Key>
 void compute_local_histogram(void* b_,
                              const diy::ReduceProxy& srp)
 {
-    Block* b = static_cast<Block*>(b_);
+    Block<Key>* b = static_cast<Block<Key>*>(b_);
 
     // compute and enqueue local histogram
     Histogram histogram(b->bins);
-    float width = ((float)b->max - (float)b->min) / b->bins;
+    double width = ((double)b->max - (double)b->min) / b->bins;
     for (size_t i = 0; i < b->values.size(); ++i)
     {
-        int x = b->values[i];
-        int loc = ((float)x - b->min) / width;
+        Key x = b->values[i];
+        int loc = width > 0 ? ((double)x - b->min) / width : 0;
         if (loc >= b->bins)
             loc = b->bins - 1;
         ++(histogram[loc]);
@@ -204,8 +588,6 @@ void receive_histogram(void* b_,
                        const diy::ReduceProxy& srp,
                        Histogram& histogram)
 {
-    Block* b = static_cast<Block*>(b_);
-
     // dequeue and add up the histograms
     for (unsigned i = 0; i < srp.in_link().size(); ++i)
     {
@@ -223,8 +605,6 @@ void receive_histogram(void* b_,
 void add_histogram(void* b_,
                    const diy::ReduceProxy& srp)
 {
-    Block* b = static_cast<Block*>(b_);
-
     Histogram histogram;
     receive_histogram(b_, srp, histogram);
 
@@ -232,11 +612,73 @@ void add_histogram(void* b_,
         srp.enqueue(srp.out_link().target(i), histogram);
 }
 
+// sends bucket i of the values, [splits[i], splits[i + 1]), to the i-th partner and keeps the
+// own bucket; splits[0] is the block min
+template<class Key>
+void exchange_values(Block<Key>* b,
+                     const diy::ReduceProxy& srp,
+                     std::vector<Key>& splits)
+{
+    int k = srp.out_link().size();
+
+    // subset and enqueue
+    if (k == 0)                            // final round; nothing needs to be sent
+        return;
+
+    // too few split points (e.g., many equal keys): the remaining buckets are empty
+    while (splits.size() < (size_t)k)
+        splits.push_back(b->max);
+
+    // count the values in each bucket, then scatter them and their payload into one buffer
+    // ordered by bucket
+    size_t n  = b->values.size();
+    size_t ps = b->psize;
+    std::vector<size_t> offsets(k + 1, 0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        int loc = std::upper_bound(splits.begin(), splits.end(), b->values[i]) - splits.begin() - 1;
+        ++offsets[loc + 1];
+    }
+    for (int i = 0; i < k; ++i)
+        offsets[i + 1] += offsets[i];
+    std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+    b->scratch.resize(n);
+    b->pscratch.resize(n * ps);
+    for (size_t i = 0; i < n; ++i)
+    {
+        int loc = std::upper_bound(splits.begin(), splits.end(), b->values[i]) - splits.begin() - 1;
+        size_t j = next[loc]++;
+        b->scratch[j] = b->values[i];
+        if (ps)
+            memcpy(&b->pscratch[j * ps], &b->payload[i * ps], ps);
+    }
+
+    int pos = -1;
+    for (int i = 0; i < k; ++i)
+    {
+        if (srp.out_link().target(i).gid == srp.gid())
+            pos = i;
+        else
+            enqueue_values(srp, srp.out_link().target(i), b->scratch, b->pscratch, ps,
+                           offsets[i], offsets[i + 1] - offsets[i]);
+    }
+    // capacities of values and payload are at least n and n * ps, so this does not reallocate
+    b->values.assign(b->scratch.begin() + offsets[pos], b->scratch.begin() + offsets[pos + 1]);
+    b->payload.assign(b->pscratch.begin() + offsets[pos] * ps,
+                      b->pscratch.begin() + offsets[pos + 1] * ps);
+    splits.push_back(b->max);
+    Key new_min = splits[pos];
+    Key new_max = splits[pos+1];
+    b->min = new_min;
+    b->max = new_max;
+}
+
+template<class Key>
 void enqueue_exchange(void* b_,
                       const diy::ReduceProxy& srp,
                       const Histogram& histogram)
 {
-    Block*   b        = static_cast<Block*>(b_);
+    Block<Key>* b     = static_cast<Block<Key>*>(b_);
 
     int k = srp.out_link().size();
 
@@ -245,53 +687,30 @@ void enqueue_exchange(void* b_,
     for (size_t i = 0; i < histogram.size(); ++i)
         total += histogram[i];
 
-    std::vector<int>  splits;
+    std::vector<Key>  splits;
     splits.push_back(b->min);
     size_t cur = 0;
-    float width = ((float)b->max - (float)b->min) / b->bins;
+    double width = ((double)b->max - (double)b->min) / b->bins;
     for (size_t i = 0; i < histogram.size(); ++i)
     {
         if (cur + histogram[i] > total/k*splits.size())
-            splits.push_back(b->min + width*i + width/2);   // mid-point of the bin
+            splits.push_back((Key)(b->min + width*i + width/2));   // mid-point of the bin
 
         cur += histogram[i];
 
-        if (splits.size() == k)
+        if (splits.size() == (size_t)k)
             break;
     }
 
-    // subset and enqueue
-    if (srp.out_link().size() == 0)        // final round; nothing needs to be sent
-        return;
-
-    std::vector< std::vector<int> > out_values(srp.out_link().size());
-    for (size_t i = 0; i < b->values.size(); ++i)
-    {
-        int loc = std::upper_bound(splits.begin(), splits.end(), b->values[i]) - splits.begin() - 1;
-        out_values[loc].push_back(b->values[i]);
-    }
-    int pos = -1;
-    for (int i = 0; i < k; ++i)
-    {
-        if (srp.out_link().target(i).gid == srp.gid())
-        {
-            b->values.swap(out_values[i]);
-            pos = i;
-        }
-        else
-            srp.enqueue(srp.out_link().target(i), out_values[i]);
-    }
-    splits.push_back(b->max);
-    int new_min = splits[pos];
-    int new_max = splits[pos+1];
-    b->min = new_min;
-    b->max = new_max;
+    exchange_values(b, srp, splits);
 }
 
+template<class Key>
 void dequeue_exchange(void* b_,
                       const diy::ReduceProxy& srp)
 {
-    Block* b = static_cast<Block*>(b_);
+    Block<Key>* b = static_cast<Block<Key>*>(b_);
+    size_t ps     = b->psize;
 
     for (unsigned i = 0; i < srp.in_link().size(); ++i)
     {
@@ -299,98 +718,664 @@ void dequeue_exchange(void* b_,
         if (nbr_gid == srp.gid())
             continue;
 
-        std::vector<int>    in_values;
-        srp.dequeue(nbr_gid, in_values);
-        for (size_t j = 0; j < in_values.size(); ++j)
+        // dequeue directly at the end of the values
+        size_t n;
+        srp.dequeue(nbr_gid, n);
+        size_t old_size = b->values.size();
+        b->values.resize(old_size + n);
+        b->payload.resize((old_size + n) * ps);
+        if (n)
         {
-            if (in_values[j] < b->min)
+            srp.dequeue(nbr_gid, &b->values[old_size], n);
+            if (ps)
+                srp.dequeue(nbr_gid, &b->payload[old_size * ps], n * ps);
+        }
+
+        // a key outside of the bucket means a wrong split or a corrupted message; one pass over
+        // the keys just copied, cheap next to the local sort that follows
+        for (size_t j = old_size; j < b->values.size(); ++j)
+            if (b->values[j] < b->min || b->values[j] > b->max)
             {
-                std::cerr << "Warning: " << in_values[j] << " < min = " << b->min << std::endl;
+                fprintf(stderr, "Error: gid %d got %.17g from gid %d outside of %.17g, %.17g\n",
+                        srp.gid(), (double)b->values[j], nbr_gid, (double)b->min,
+                        (double)b->max);
                 std::abort();
             }
-            b->values.push_back(in_values[j]);
+    }
+}
+
+// helper functions for the histogram refinement
+//
+// with more than one histogram pass, the bins are given by their lower bounds (b->lows) and the
+// split points are bin edges, so that the bucket sizes are known exactly from the histogram;
+// each pass subdivides the bins that contain an ideal split point, until the largest bucket is
+// within the tolerance of the average
+// bins are subdivided in the integers given by KeyTraits::bits, which go down to single keys
+// for floating-point keys as well
+
+float tolerance = 1.05;                      // allowed largest / average bucket size (-i)
+
+// counts the local values in the bins given by b->lows
+template<class Key>
+void count_local_histogram(Block<Key>* b,
+                           Histogram& histogram)
+{
+    histogram.assign(b->lows.size(), 0);
+    for (size_t i = 0; i < b->values.size(); ++i)
+        ++histogram[std::upper_bound(b->lows.begin(), b->lows.end(), b->values[i]) -
+                    b->lows.begin() - 1];
+}
+
+// last key of bin j
+template<class Key>
+Key bin_last(const Block<Key>* b,
+             size_t j)
+{
+    typedef KeyTraits<Key> Traits;
+    return (j + 1 < b->lows.size()) ? Traits::key(Traits::bits(b->lows[j + 1]) - 1) : b->max;
+}
+
+// first pass: b->bins equal-width bins over [min, max]
+template<class Key>
+void compute_binned_histogram(void* b_,
+                              const diy::ReduceProxy& srp)
+{
+    Block<Key>* b = static_cast<Block<Key>*>(b_);
+
+    double width = ((double)b->max - (double)b->min) / b->bins;
+    b->lows.clear();
+    b->lows.push_back(b->min);
+    for (int i = 1; i < b->bins; ++i)
+    {
+        Key x = (Key)(b->min + width * i);
+        if (x > b->lows.back() && x <= b->max)
+            b->lows.push_back(x);
+    }
+
+    Histogram histogram;
+    count_local_histogram(b, histogram);
+    for (int i = 0; i < srp.out_link().size(); ++i)
+        srp.enqueue(srp.out_link().target(i), histogram);
+}
+
+// picks the k - 1 bin edges whose cumulative counts are closest to the ideal split points;
+// returns the largest bucket size over the average
+template<class Key>
+float pick_edge_splits(const Block<Key>* b,
+                       int k,
+                       std::vector<Key>& splits)
+{
+    const Histogram& hist = b->hist;
+    size_t m = hist.size();
+    std::vector<size_t> cum(m + 1, 0);
+    for (size_t j = 0; j < m; ++j)
+        cum[j + 1] = cum[j] + hist[j];
+    size_t total = cum[m];
+
+    splits.clear();
+    splits.push_back(b->min);
+    size_t prev = 0;                         // edge of the previous split
+    size_t largest = 0;                      // largest bucket
+    for (int i = 1; i <= k; ++i)
+    {
+        size_t j = m;                        // edge after the last bin for the last bucket
+        if (i < k)
+        {
+            double target = (double)total * i / k;
+            j = std::lower_bound(cum.begin() + prev, cum.begin() + m, (size_t)ceil(target)) -
+                cum.begin();
+            if (j > prev && target - cum[j - 1] < cum[j] - target)
+                j--;
+            if (j == m)                      // no edge above the last bin
+                j = m - 1;
+            splits.push_back(b->lows[j]);
+        }
+        largest = std::max(largest, cum[j] - cum[prev]);
+        prev = j;
+    }
+    return total ? (float)largest * k / total : 1.0f;
+}
+
+// subdivides the bins that contain an ideal split point and span more than one key, into about
+// b->bins new bins in total; returns false if there is no such bin
+template<class Key>
+bool refine_bins(Block<Key>* b,
+                 int k)
+{
+    typedef KeyTraits<Key>                  Traits;
+    typedef typename Traits::Bits           Bits;
+
+    const Histogram& hist = b->hist;
+    size_t m = hist.size();
+    size_t total = 0;
+    for (size_t j = 0; j < m; ++j)
+        total += hist[j];
+
+    // mark the bins to refine
+    std::vector<bool> refine(m, false);
+    int nrefine = 0;
+    size_t cur = 0;                          // count before bin j
+    int i = 1;                               // next ideal split point
+    for (size_t j = 0; j < m; ++j)
+    {
+        while (i < k && (double)total * i / k <= cur)
+            ++i;
+        if (i < k && (double)total * i / k < cur + hist[j] && b->lows[j] < bin_last(b, j))
+        {
+            refine[j] = true;
+            nrefine++;
         }
+        cur += hist[j];
     }
+    if (!nrefine)
+        return false;
+
+    // the last key of a bin is inclusive, so that the width does not overflow for the full range
+    int sub_bins = std::max(2, b->bins / nrefine);
+    std::vector<Key> lows;
+    for (size_t j = 0; j < m; ++j)
+    {
+        lows.push_back(b->lows[j]);
+        if (!refine[j])
+            continue;
+        Bits lo    = Traits::bits(b->lows[j]);
+        Bits last  = Traits::bits(bin_last(b, j));
+        Bits width = (last - lo) / sub_bins + 1;
+        while (last - lo >= width)
+        {
+            lo += width;
+            lows.push_back(Traits::key(lo));
+        }
+    }
+    b->lows.swap(lows);
+    return true;
+}
+
+// later passes: refines the bins with the histogram reduced in the previous pass and recounts;
+// when the buckets are already balanced (same decision in all the blocks of the group, which
+// hold the same histogram), an empty histogram is sent and b->hist is kept
+template<class Key>
+void refine_histogram(void* b_,
+                      const diy::ReduceProxy& srp,
+                      int k)
+{
+    Block<Key>* b = static_cast<Block<Key>*>(b_);
+
+    Histogram histogram;
+    receive_histogram(b_, srp, histogram);
+    if (!histogram.empty())
+        b->hist.swap(histogram);
+
+    std::vector<Key> splits;
+    Histogram out;
+    if (pick_edge_splits(b, k, splits) > tolerance && refine_bins(b, k))
+        count_local_histogram(b, out);
+    for (int i = 0; i < srp.out_link().size(); ++i)
+        srp.enqueue(srp.out_link().target(i), out);
 }
 
+template<class Key>
+void enqueue_refined_exchange(void* b_,
+                              const diy::ReduceProxy& srp,
+                              Histogram& histogram)
+{
+    Block<Key>* b = static_cast<Block<Key>*>(b_);
+
+    if (!histogram.empty())
+        b->hist.swap(histogram);
+
+    std::vector<Key> splits;
+    pick_edge_splits(b, srp.out_link().size(), splits);
+    exchange_values(b, srp, splits);
+}
+
+template<class Key>
 void sort_local(void* b_,
                 const diy::ReduceProxy&)
 {
-    Block* b = static_cast<Block*>(b_);
-    std::sort(b->values.begin(), b->values.end());
+    local_sort(static_cast<Block<Key>*>(b_));
 }
 
+template<class Key>
 void sort_all(void* b_,
               const diy::ReduceProxy& srp,
               const SortPartners& partners)
 {
     if (srp.round() == partners.rounds())
     {
-        dequeue_exchange(b_, srp);
-        sort_local(b_, srp);
+        dequeue_exchange<Key>(b_, srp);
+        sort_local<Key>(b_, srp);
     }
     else if (partners.exchange_round(srp.round()))
     {
         Histogram histogram;
         receive_histogram(b_, srp, histogram);
-        enqueue_exchange(b_, srp, histogram);
-    } else if (partners.sub_round(srp.round()) == 0)
+        if (partners.passes() > 1)
+            enqueue_refined_exchange<Key>(b_, srp, histogram);
+        else
+            enqueue_exchange<Key>(b_, srp, histogram);
+    } else if (partners.sub_round(srp.round()) == 0 && partners.pass(srp.round()) > 0)
+        refine_histogram<Key>(b_, srp, partners.exchange_k(srp.round()));
+    else if (partners.sub_round(srp.round()) == 0)
     {
         if (srp.round() > 0)
-            dequeue_exchange(b_, srp);
+            dequeue_exchange<Key>(b_, srp);
 
-        compute_local_histogram(b_, srp);
+        if (partners.passes() > 1)
+            compute_binned_histogram<Key>(b_, srp);
+        else
+            compute_local_histogram<Key>(b_, srp);
     } else
         add_histogram(b_, srp);
 }
 
+// helper functions for the sample sort operator
+
+// sorts the local values and enqueues ns regularly spaced samples of them
+template<class Key>
+void compute_local_samples(void* b_,
+                           const diy::ReduceProxy& srp)
+{
+    Block<Key>* b = static_cast<Block<Key>*>(b_);
+
+    local_sort(b);
+
+    std::vector<Key> samples;
+    size_t n = b->values.size();
+    if (n)
+    {
+        samples.reserve(b->samples);
+        for (int i = 0; i < b->samples; ++i)
+            samples.push_back(b->values[(2 * i + 1) * n / (2 * b->samples)]);
+    }
+    for (int i = 0; i < srp.out_link().size(); ++i)
+        srp.enqueue(srp.out_link().target(i), samples);
+}
+
+template<class Key>
+void receive_samples(void* b_,
+                     const diy::ReduceProxy& srp,
+                     std::vector<Key>& samples)
+{
+    // dequeue and concatenate the samples
+    for (int i = 0; i < srp.in_link().size(); ++i)
+    {
+        int nbr_gid = srp.in_link().target(i).gid;
+
+        std::vector<Key> in_samples;
+        srp.dequeue(nbr_gid, in_samples);
+        samples.insert(samples.end(), in_samples.begin(), in_samples.end());
+    }
+}
+
+template<class Key>
+void add_samples(void* b_,
+                 const diy::ReduceProxy& srp)
+{
+    std::vector<Key> samples;
+    receive_samples(b_, srp, samples);
+
+    for (int i = 0; i < srp.out_link().size(); ++i)
+        srp.enqueue(srp.out_link().target(i), samples);
+}
+
+// picks k - 1 splitters from the samples of the whole group and sends each partner its bucket
+// of the (already sorted) local values; bucket i holds the values in (splits[i], splits[i + 1]]
+template<class Key>
+void enqueue_sample_exchange(void* b_,
+                             const diy::ReduceProxy& srp,
+                             std::vector<Key>& samples)
+{
+    Block<Key>* b     = static_cast<Block<Key>*>(b_);
+    size_t ps         = b->psize;
+
+    int k = srp.out_link().size();
+    if (k == 0)                             // final round; nothing needs to be sent
+        return;
+
+    // pick split points
+    std::sort(samples.begin(), samples.end());
+    std::vector<Key>  splits(k + 1);
+    splits[0] = b->min;
+    splits[k] = b->max;
+    for (int i = 1; i < k; ++i)
+        splits[i] = samples.empty() ? b->max : samples[i * samples.size() / k];
+
+    // subset and enqueue
+    size_t lo = 0, keep_lo = 0, keep_hi = 0;
+    int pos = -1;
+    for (int i = 0; i < k; ++i)
+    {
+        size_t hi = (i == k - 1) ? b->values.size() :
+            std::upper_bound(b->values.begin() + lo, b->values.end(), splits[i + 1]) -
+            b->values.begin();
+        if (srp.out_link().target(i).gid == srp.gid())
+        {
+            keep_lo = lo;
+            keep_hi = hi;
+            pos = i;
+        }
+        else
+            enqueue_values(srp, srp.out_link().target(i), b->values, b->payload, ps, lo, hi - lo);
+        lo = hi;
+    }
+    b->values.erase(b->values.begin() + keep_hi, b->values.end());
+    b->values.erase(b->values.begin(), b->values.begin() + keep_lo);
+    b->payload.erase(b->payload.begin() + keep_hi * ps, b->payload.end());
+    b->payload.erase(b->payload.begin(), b->payload.begin() + keep_lo * ps);
+    b->min = splits[pos];
+    b->max = splits[pos + 1];
+}
+
+template<class Key>
+void sample_all(void* b_,
+                const diy::ReduceProxy& srp,
+                const SortPartners& partners)
+{
+    if (srp.round() == partners.rounds())
+    {
+        dequeue_exchange<Key>(b_, srp);
+        sort_local<Key>(b_, srp);
+    }
+    else if (partners.exchange_round(srp.round()))
+    {
+        std::vector<Key> samples;
+        receive_samples(b_, srp, samples);
+        enqueue_sample_exchange(b_, srp, samples);
+    } else if (partners.sub_round(srp.round()) == 0)
+    {
+        if (srp.round() > 0)
+            dequeue_exchange<Key>(b_, srp);
+
+        compute_local_samples<Key>(b_, srp);
+    } else
+        add_samples<Key>(b_, srp);
+}
+
 //
 // histogram sort
 //
+template<class Key>
 void HistogramSort(double *time,             // time (output)
                    int run,                  // run number
-                   int k,                    // desired k value
+                   const autotune::Schedule& schedule, // k value of each level
+                   int refine,               // max number of refinement passes (0 = off)
                    MPI_Comm comm,            // MPI communicator
                    int totblocks,            // total number of blocks
                    diy::Master& master,      // diy usual
                    diy::ContiguousAssigner& assigner)
 {
+    timing::round_timer().reset();
+
+    // callbacks may run in several threads: the end of the sort is the end of the last callback
     MPI_Barrier(comm);
     double t0 = MPI_Wtime();
 
-    SortPartners partners(totblocks, k);
-    diy::reduce(master, assigner, partners, &sort_all);
+    SortPartners partners(totblocks, schedule, refine + 1);
+    diy::reduce(master, assigner, partners, &timing::timed<SortPartners, &sort_all<Key> >);
 
-    MPI_Barrier(comm);
-    time[run] = MPI_Wtime() - t0;
+    time[run] = timing::elapsed(t0, comm);
 }
 
 //
 // sample sort
 //
+// same k-ary rounds as the histogram sort, but the histogram rounds all-reduce regular samples
+// of the sorted local values, from which the splitters are picked
+//
+template<class Key>
 void SampleSort(double *time,                // time (output)
                    int run,                  // run number
-                   int k,                    // desired k value
+                   const autotune::Schedule& schedule, // k value of each level
                    MPI_Comm comm,            // MPI communicator
                    int totblocks,            // total number of blocks
                    diy::Master& master,      // diy usual
                    diy::ContiguousAssigner& assigner)
 {
+    timing::round_timer().reset();
+
+    // callbacks may run in several threads: the end of the sort is the end of the last callback
     MPI_Barrier(comm);
     double t0 = MPI_Wtime();
 
-//     diy::sort(master, assigner, &ValueBlock::values, &ValueBlock::samples, num_samples,
-//               std::less<Value>(), k);
+    SortPartners partners(totblocks, schedule);
+    diy::reduce(master, assigner, partners, &timing::timed<SortPartners, &sample_all<Key> >);
 
-    MPI_Barrier(comm);
-    time[run] = MPI_Wtime() - t0;
+    time[run] = timing::elapsed(t0, comm);
+}
+
+//
+// block sizes accumulated by BlockSize
+//
+struct Imbalance
+{
+    Imbalance(): largest(0), total(0)                           {}
+
+    size_t          largest;                 // largest block
+    size_t          total;                   // sum over the blocks
+    timing::Mutex   mutex;
+};
+
+// adds the number of values in a block to args, an Imbalance
+template<class Key>
+void BlockSize(void* b_,
+               const diy::Master::ProxyWithLink& cp,
+               void* args)
+{
+    Block<Key>* b  = static_cast<Block<Key>*>(b_);
+    Imbalance* imb = static_cast<Imbalance*>(args);
+    timing::Lock l(imb->mutex);
+    imb->largest = std::max(imb->largest, b->values.size());
+    imb->total  += b->values.size();
+}
+
+//
+// largest number of values in a block over the average (1 = perfect balance)
+//
+template<class Key>
+double BlockImbalance(MPI_Comm comm,
+                      int totblocks,
+                      diy::Master& master)
+{
+    Imbalance imb;
+    master.foreach(&BlockSize<Key>, &imb);
+
+    unsigned long long local[2] = { imb.largest, imb.total };
+    unsigned long long largest, total;
+    MPI_Allreduce(&local[0], &largest, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm);
+    MPI_Allreduce(&local[1], &total,   1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+    return total ? (double)largest * totblocks / total : 1.0;
+}
+
+//
+// autotune: runs one of the sorts with every schedule and returns the fastest
+//
+template<class Key>
+autotune::Entry TuneSort(bool sample,                 // sample sort (vs histogram sort)
+                         int refine,                  // max number of histogram refinement passes
+                         MPI_Comm comm,               // MPI communicator
+                         int totblocks,               // total number of blocks
+                         int *args,                   // ResetBlock args
+                         diy::Master& master,         // diy usual
+                         diy::ContiguousAssigner& assigner)
+{
+    int rank, groupsize;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &groupsize);
+
+    std::vector<autotune::Schedule> candidates;
+    autotune::schedules(totblocks, candidates);
+    autotune::Entry best;
+    for (size_t s = 0; s < candidates.size(); ++s)
+    {
+        master.foreach(&ResetBlock<Key>, args);
+        double t;
+        if (sample)
+            SampleSort<Key>(&t, 0, candidates[s], comm, totblocks, master, assigner);
+        else
+            HistogramSort<Key>(&t, 0, candidates[s], refine, comm, totblocks, master, assigner);
+        if (rank == 0)
+            fprintf(stderr, "autotune %s procs %d elems %d schedule %s time %.3lf\n",
+                    sample ? "sample sort" : "histogram sort", groupsize, args[0],
+                    autotune::name(candidates[s]).c_str(), t);
+        if (s == 0 || t < best.time)
+        {
+            best.schedule = candidates[s];
+            best.k        = autotune::max_k(candidates[s]);
+            best.time     = t;
+        }
+    }
+    return best;
+}
+
+//
+// runs both sorts for all the numbers of elements, with the processes of one communicator and
+// one key type
+//
+template<class Key>
+void SortRuns(int& run,                      // run number (input and output)
+              MPI_Comm comm,                 // communicator of this number of processes
+              int tot_blocks,                // total number of blocks
+              int min_elems,                 // minimum number of elements
+              int max_elems,                 // maximum number of elements
+              int elem_x,                    // factor change for elements
+              int *args,                     // ResetBlock args, args[0] is set here
+              int target_k,                  // target k-value
+              int refine,                    // max number of histogram refinement passes
+              int num_threads,               // number of threads diy uses to run the blocks
+              int mem_blocks,                // number of blocks to keep in memory (-1 = all)
+              bool verify,                   // check the sorted blocks
+              int warmup,                    // number of untimed trials per run
+              int trials,                    // number of timed trials per run
+              bool tune,                     // autotune the schedules into table
+              autotune::Table& table,        // schedules of the runs
+              std::string *hsort_schedules,  // histogram sort schedules (output)
+              std::string *ssort_schedules,  // sample sort schedules (output)
+              results::Run res,              // results record of the runs, without elems and k
+              double *hsort_time,            // histogram sort times, median of the trials (output)
+              double *ssort_time,            // sample sort times, median of the trials (output)
+              double *hsort_imbalance,       // histogram sort block imbalance (output)
+              double *ssort_imbalance,       // sample sort block imbalance (output)
+              spill::Totals *hsort_spill,    // histogram sort out-of-core totals (output)
+              spill::Totals *ssort_spill)    // sample sort out-of-core totals (output)
+{
+    int groupsize;
+    MPI_Comm_size(comm, &groupsize);
+
+    // initialize DIY
+    int dim = 1;
+    diy::mpi::communicator    world(comm);
+    spill::Storage            storage("./DIY.XXXXXX");
+    diy::Master               master(world,
+                                     num_threads,
+                                     spill::mem_blocks(mem_blocks, num_threads),
+                                     &Block<Key>::create,
+                                     &Block<Key>::destroy,
+                                     &storage,
+                                     &Block<Key>::save,
+                                     &Block<Key>::load);
+    diy::ContiguousAssigner   assigner(world.size(), tot_blocks);
+    AddBlock<Key>             create(master);
+    Bounds domain;
+    diy::decompose(dim, world.rank(), domain, assigner, create);
+
+    // iterate over number of elements
+    int num_elems = min_elems;
+    while (num_elems <= max_elems)
+    {
+        args[0] = num_elems;
+
+        // schedules of the sorts
+        autotune::Schedule hsort_schedule, ssort_schedule;
+        if (tune)
+        {
+            autotune::Entry best;
+            best = TuneSort<Key>(false, refine, comm, tot_blocks, args, master, assigner);
+            table.set("hsort", groupsize, tot_blocks, num_elems, best);
+            hsort_schedule = best.schedule;
+            best = TuneSort<Key>(true, refine, comm, tot_blocks, args, master, assigner);
+            table.set("ssort", groupsize, tot_blocks, num_elems, best);
+            ssort_schedule = best.schedule;
+        }
+        else
+        {
+            hsort_schedule = autotune::lookup(table, "hsort", groupsize, tot_blocks, num_elems,
+                                              target_k);
+            ssort_schedule = autotune::lookup(table, "ssort", groupsize, tot_blocks, num_elems,
+                                              target_k);
+        }
+        hsort_schedules[run] = autotune::name(hsort_schedule);
+        ssort_schedules[run] = autotune::name(ssort_schedule);
+
+        // the other quantities are those of the last trial
+        char point[256];
+        sprintf(point, "procs %d elems %d", groupsize, num_elems);
+        stats::Samples samples;
+        for (int t = -warmup; t < trials; t++)
+        {
+            master.foreach(&ResetBlock<Key>, args);
+            spill::stats().reset();
+            HistogramSort<Key>(hsort_time, run, hsort_schedule, refine, comm, tot_blocks, master,
+                               assigner);
+            if (t >= 0)
+                samples.add(timing::round_timer().local, comm);
+        }
+        hsort_time[run] = samples.median();
+        res.elems = num_elems;
+        res.k     = hsort_schedules[run];
+        results::emit(res, "hsort_time", samples);
+        stats::record(point, "hsort_time", samples);
+        hsort_spill[run] = spill::stats().reduce(comm, timing::round_timer().local);
+        hsort_imbalance[run] = BlockImbalance<Key>(comm, tot_blocks, master);
+        char label[256];
+        sprintf(label, "histogram sort procs %d elems %d schedule %s", groupsize, num_elems,
+                hsort_schedules[run].c_str());
+        timing::print_rounds(label, comm);
+        timing::print_profile(label, comm);
+        if (verify)
+            master.foreach(&VerifyBlock<Key>);
+
+        samples.clear();
+        for (int t = -warmup; t < trials; t++)
+        {
+            master.foreach(&ResetBlock<Key>, args);
+            spill::stats().reset();
+            SampleSort<Key>(ssort_time, run, ssort_schedule, comm, tot_blocks, master, assigner);
+            if (t >= 0)
+                samples.add(timing::round_timer().local, comm);
+        }
+        ssort_time[run] = samples.median();
+        res.k     = ssort_schedules[run];
+        results::emit(res, "ssort_time", samples);
+        stats::record(point, "ssort_time", samples);
+        ssort_spill[run] = spill::stats().reduce(comm, timing::round_timer().local);
+        ssort_imbalance[run] = BlockImbalance<Key>(comm, tot_blocks, master);
+        sprintf(label, "sample sort procs %d elems %d schedule %s", groupsize, num_elems,
+                ssort_schedules[run].c_str());
+        timing::print_rounds(label, comm);
+        timing::print_profile(label, comm);
+        if (verify)
+            master.foreach(&VerifyBlock<Key>);
+
+        num_elems *= elem_x;
+        run++;
+    } // elem iteration
 }
 
 //
 // print results
 //
-void PrintResults(double *hsort_time,        // histogram sort times
-                  double *ssort_time,        // sample sort times
+void PrintResults(double *hsort_time,        // histogram sort times, median of the trials
+                  double *ssort_time,        // sample sort times, median of the trials
+                  double *hsort_imbalance,   // largest / average block after histogram sort
+                  double *ssort_imbalance,   // largest / average block after sample sort
+                  spill::Totals *hsort_spill, // blocks moved out of core during histogram sort
+                  spill::Totals *ssort_spill, // blocks moved out of core during sample sort
+                  bool out_of_core,          // whether to print the spill columns
+                  std::string *hsort_schedules, // histogram sort schedules, NULL if not tuned
+                  std::string *ssort_schedules, // sample sort schedules, NULL if not tuned
+                  int key_type,              // key type
+                  int psize,                 // payload bytes per element
                   int min_procs,             // minimum number of procs
 		  int max_procs,             // maximum number of procs
                   int proc_x,                // factor change for procs
@@ -401,6 +1386,7 @@ void PrintResults(double *hsort_time,        // histogram sort times
     int elem_iter = 0;                       // element iteration number
     int num_elem_iters = 0;                  // number of element iterations
     int proc_iter;                           // process iteration number
+    int key_size = (key_type == INT32 || key_type == FLOAT) ? 4 : 8;
 
     for (int i = min_elems; i <= max_elems; i *= elem_x)
         num_elem_iters++;
@@ -411,8 +1397,17 @@ void PrintResults(double *hsort_time,        // histogram sort times
     int num_elems = min_elems;
     while (num_elems <= max_elems)
     {
-        fprintf(stderr, "\n# num_elements = %d\n", num_elems);
-        fprintf(stderr, "# procs \t histogram sort time \t sample sort time\n");
+        fprintf(stderr, "\n# num_elements = %d   %s key + %d bytes payload = %d bytes / element\n",
+                num_elems, key_names[key_type], psize, key_size + psize);
+        fprintf(stderr, "# procs \t histogram sort time \t sample sort time"
+                " \t hsort imbalance \t ssort imbalance");
+        if (out_of_core)
+            fprintf(stderr, " \t hsort comm_time \t hsort spill_MB/reload_MB"
+                    " \t hsort spill/reload_time \t ssort comm_time \t ssort spill_MB/reload_MB"
+                    " \t ssort spill/reload_time");
+        if (hsort_schedules)
+            fprintf(stderr, " \t hsort schedule \t ssort schedule");
+        fprintf(stderr, "\n");
 
         // iterate over processes
         int groupsize = min_procs;
@@ -420,8 +1415,19 @@ void PrintResults(double *hsort_time,        // histogram sort times
         while (groupsize <= max_procs)
         {
             int i = proc_iter * num_elem_iters + elem_iter; // index into times
-            fprintf(stderr, "%d \t\t %.3lf \t\t\t %.3lf\n",
-                    groupsize, hsort_time[i], ssort_time[i]);
+            fprintf(stderr, "%d \t\t %.3lf \t\t\t %.3lf \t\t\t %.3lf \t\t\t %.3lf",
+                    groupsize, hsort_time[i], ssort_time[i], hsort_imbalance[i], ssort_imbalance[i]);
+            if (out_of_core)
+                fprintf(stderr, " \t\t\t %.3lf \t\t %.1lf/%.1lf \t\t %.3lf/%.3lf"
+                        " \t\t %.3lf \t\t %.1lf/%.1lf \t\t %.3lf/%.3lf", hsort_spill[i].rest,
+                        hsort_spill[i].bytes_out / 1048576.0, hsort_spill[i].bytes_in / 1048576.0,
+                        hsort_spill[i].time_out, hsort_spill[i].time_in, ssort_spill[i].rest,
+                        ssort_spill[i].bytes_out / 1048576.0, ssort_spill[i].bytes_in / 1048576.0,
+                        ssort_spill[i].time_out, ssort_spill[i].time_in);
+            if (hsort_schedules)
+                fprintf(stderr, " \t\t %s \t\t\t %s", hsort_schedules[i].c_str(),
+                        ssort_schedules[i].c_str());
+            fprintf(stderr, "\n");
 
             groupsize *= proc_x;
             proc_iter++;
@@ -445,7 +1451,20 @@ void GetArgs(int argc,
              int &nb,
              int &target_k,
              int &ns,
-             int &hbins)
+             int &hbins,
+             int &num_threads,
+             int &mem_blocks,
+             bool &verify,
+             std::string &sorter,
+             int &refine,
+             int &dist,
+             int &key_type,
+             int &psize,
+             std::string &tune_file,
+             std::string &lookup_file,
+             std::string &out_file,
+             int &warmup,
+             int &trials)
 {
     using namespace opts;
     Options ops(argc, argv);
@@ -454,6 +1473,28 @@ void GetArgs(int argc,
     MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
+    num_threads = 1;
+    mem_blocks  = -1;
+    ops >> Option('t', "threads",    num_threads, "number of threads")
+        >> Option('m', "mem-blocks", mem_blocks,  "number of blocks to keep in memory");
+    sorter      = "radix";
+    ops >> Option('s', "local-sort", sorter, "local sort: radix or std");
+    verify = ops >> Present('v', "verify", "check the sorted blocks after each sort");
+    refine      = 0;
+    std::string dist_name = "uniform";
+    ops >> Option('r', "refine",    refine,    "max histogram refinement passes")
+        >> Option('i', "imbalance", tolerance, "refine until largest / average bucket <= this")
+        >> Option('d', "dist",      dist_name, "keys: uniform, zipf, gaussian, sorted, equal");
+    std::string key_name = "int32";
+    psize       = 0;
+    ops >> Option('k', "key",     key_name, "key type: int32, int64, float, double")
+        >> Option('p', "payload", psize,    "payload bytes per key (0 to 256)");
+    ops >> Option('a', "autotune", tune_file,   "run all schedules, write the fastest to file")
+        >> Option('l', "lookup",   lookup_file, "read the schedules from file");
+    args::run_options(ops, out_file, warmup, trials);
+    std::string trace_prefix;
+    args::profile_options(ops, trace_prefix);
+
     if (ops >> Present('h', "help", "show help") ||
         !(ops >> PosOption(min_procs)
           >> PosOption(min_elems)
@@ -464,14 +1505,67 @@ void GetArgs(int argc,
           >> PosOption(hbins)))
     {
         if (rank == 0)
-            fprintf(stderr, "Usage: %s min_procs min_elems max_elems nb target_k ns hbins\n",
+            fprintf(stderr, "Usage: %s [-t threads] [-m mem_blocks] [-s radix|std] [-v] "
+                    "[-r passes] [-i tolerance] [-d dist] [-k key] [-p payload] "
+                    "[-a table | -l table] [-o results] [-w warmup] [-n trials] [-f] [-e trace] "
+                    "min_procs min_elems max_elems nb target_k ns hbins\n",
                     argv[0]);
         exit(1);
     }
 
+    args::check_threads(num_threads, rank);
+
+    if (sorter == "std")
+        local_sort_type = STD_SORT;
+    else if (sorter == "radix")
+        local_sort_type = RADIX_SORT;
+    else
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: unknown local sort %s (radix or std)\n", sorter.c_str());
+        exit(1);
+    }
+
+    dist = -1;
+    for (int i = 0; i <= EQUAL; ++i)
+        if (dist_name == dist_names[i])
+            dist = i;
+    if (dist < 0)
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: unknown distribution %s\n", dist_name.c_str());
+        exit(1);
+    }
+
+    key_type = -1;
+    for (int i = 0; i <= DOUBLE; ++i)
+        if (key_name == key_names[i])
+            key_type = i;
+    if (key_type < 0)
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: unknown key type %s\n", key_name.c_str());
+        exit(1);
+    }
+
+    if (psize < 0 || psize > 256)
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: payload must be between 0 and 256 bytes\n");
+        exit(1);
+    }
+
+    args::check_trials(warmup, trials);
+
+    args::open_trace(trace_prefix, rank);
+
     if (rank == 0)
-        fprintf(stderr, "min_procs = %d min_elems = %d max_elems = %d nb = %d target_k = %d ns = %d hbins = %d\n",
-                min_procs, min_elems, max_elems, nb, target_k, ns, hbins);
+        fprintf(stderr, "min_procs = %d min_elems = %d max_elems = %d nb = %d target_k = %d ns = %d hbins = %d "
+                "threads = %d mem_blocks = %d local_sort = %s refine = %d imbalance = %.3f dist = %s "
+                "key = %s payload = %d warmup = %d trials = %d\n",
+                min_procs, min_elems, max_elems, nb, target_k, ns, hbins, num_threads, mem_blocks,
+                sorter.c_str(), refine, tolerance, dist_names[dist], key_names[key_type], psize,
+                warmup, trials);
 }
 
 int main(int argc, char **argv)
@@ -480,13 +1574,25 @@ int main(int argc, char **argv)
     int tot_blocks;           // total number of blocks
     int target_k;             // target k-value
     int min_elems, max_elems; // min, max number of elements per block
-    int num_elems;            // current number of data elements per block
     int rank, groupsize;      // MPI usual
     int min_procs;            // minimum number of processes
     int max_procs;            // maximum number of processes (groupsize of MPI_COMM_WORLD)
     int nsamples;             // number of samples
     int hbins;                // number of histogram bins
     int proc_x, elem_x;       // factors for procs and elems
+    int num_threads;          // number of threads diy uses to run the blocks
+    int mem_blocks;           // number of blocks to keep in memory (-1 = all)
+    bool verify;              // check the sorted blocks
+    std::string sorter;       // local sort (radix or std)
+    int refine;               // max number of histogram refinement passes
+    int dist;                 // key distribution
+    int key_type;             // key type
+    int psize;                // payload bytes per key
+    std::string tune_file;    // autotune: table to write the fastest schedules to
+    std::string lookup_file;  // table to read the schedules from
+    autotune::Table table;    // schedules of the runs
+    std::string out_file;     // machine-readable results
+    int warmup, trials;       // number of untimed and timed trials per run
 
     proc_x = 4;
     elem_x = 4;
@@ -494,7 +1600,24 @@ int main(int argc, char **argv)
     MPI_Init(&argc, &argv);
     MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
 
-   GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, target_k, nsamples, hbins);
+    GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, target_k, nsamples, hbins,
+            num_threads, mem_blocks, verify, sorter, refine, dist, key_type, psize, tune_file,
+            lookup_file, out_file, warmup, trials);
+    if (!results::open(out_file))
+    {
+        fprintf(stderr, "Error: cannot write results to %s\n", out_file.c_str());
+        exit(1);
+    }
+
+    // tuning adds to the entries of other apps and runs already in the table
+    bool tune = !tune_file.empty();
+    if (tune)
+        table.load(tune_file);
+    else if (!lookup_file.empty() && !table.load(lookup_file))
+    {
+        fprintf(stderr, "Error: cannot read schedules from %s\n", lookup_file.c_str());
+        exit(1);
+    }
 
     // timing
     int num_runs = 0;
@@ -506,6 +1629,12 @@ int main(int argc, char **argv)
 
     double *hsort_time = new double[num_runs]; // histogram sort time
     double *ssort_time = new double[num_runs]; // sample sort time
+    double *hsort_imbalance = new double[num_runs]; // histogram sort block imbalance
+    double *ssort_imbalance = new double[num_runs]; // sample sort block imbalance
+    spill::Totals *hsort_spill = new spill::Totals[num_runs]; // histogram sort out-of-core totals
+    spill::Totals *ssort_spill = new spill::Totals[num_runs]; // sample sort out-of-core totals
+    std::string *hsort_schedules = new std::string[num_runs]; // histogram sort schedules
+    std::string *ssort_schedules = new std::string[num_runs]; // sample sort schedules
 
     // iterate over processes
     int run = 0; // run number
@@ -523,44 +1652,59 @@ int main(int argc, char **argv)
             continue;
         }
 
-        // initialize DIY
         tot_blocks = nblocks * groupsize;
-        int dim = 1;
-        int mem_blocks = -1;      // everything in core for now
-        int num_threads = 1;      // needed in order to do timing
-        diy::mpi::communicator    world(comm);
-        diy::FileStorage          storage("./DIY.XXXXXX");
-        diy::Master               master(world,
-                                         num_threads,
-                                         mem_blocks,
-                                         &Block::create,
-                                         &Block::destroy,
-                                         &storage,
-                                         &Block::save,
-                                         &Block::load);
-        diy::ContiguousAssigner   assigner(world.size(), tot_blocks);
-        AddBlock                  create(master);
-        Bounds domain;
-        diy::decompose(dim, world.rank(), domain, assigner, create);
-
-        // iterate over number of elements
-        num_elems = min_elems;
-        while (num_elems <= max_elems)
+        int args[6];
+        args[1] = target_k * hbins * groupsize;
+        args[2] = nsamples;
+        args[3] = dist;
+        args[4] = tot_blocks;
+        args[5] = psize;
+
+        // results record: the op is the key type and the payload size
+        results::Run res("sort");
+        char op_name[64];
+        sprintf(op_name, "%s+%d", key_names[key_type], psize);
+        res.procs   = groupsize;
+        res.blocks  = tot_blocks;
+        res.op      = op_name;
+        res.threads = num_threads;
+
+        // the key type is a template parameter of the block and the sorts; the payload size is
+        // not, so that it can take any value without an instantiation per size
+        switch (key_type)
         {
-            int args[2];
-            args[0] = num_elems;
-            args[1] = target_k * hbins * groupsize;
-            master.foreach(&ResetBlock, args);
-            HistogramSort(hsort_time, run, target_k, comm, tot_blocks, master, assigner);
-            master.foreach(&ResetBlock, args);
-            SampleSort(ssort_time, run, target_k, comm, tot_blocks, master, assigner);
-
-            // debug
-            //master.foreach(VerifyBlock);
-
-            num_elems *= elem_x;
-            run++;
-        } // elem iteration
+        case INT64:
+            SortRuns<long long>(run, comm, tot_blocks, min_elems, max_elems, elem_x, args,
+                                target_k, refine, num_threads, mem_blocks, verify,
+                                warmup, trials,
+                                tune, table, hsort_schedules, ssort_schedules, res,
+                                hsort_time, ssort_time, hsort_imbalance, ssort_imbalance,
+                                hsort_spill, ssort_spill);
+            break;
+        case FLOAT:
+            SortRuns<float>(run, comm, tot_blocks, min_elems, max_elems, elem_x, args,
+                            target_k, refine, num_threads, mem_blocks, verify,
+                            warmup, trials,
+                            tune, table, hsort_schedules, ssort_schedules, res,
+                            hsort_time, ssort_time, hsort_imbalance, ssort_imbalance,
+                            hsort_spill, ssort_spill);
+            break;
+        case DOUBLE:
+            SortRuns<double>(run, comm, tot_blocks, min_elems, max_elems, elem_x, args,
+                             target_k, refine, num_threads, mem_blocks, verify,
+                             warmup, trials,
+                             tune, table, hsort_schedules, ssort_schedules, res,
+                             hsort_time, ssort_time, hsort_imbalance, ssort_imbalance,
+                             hsort_spill, ssort_spill);
+            break;
+        default:
+            SortRuns<int>(run, comm, tot_blocks, min_elems, max_elems, elem_x, args,
+                          target_k, refine, num_threads, mem_blocks, verify,
+                          warmup, trials,
+                          tune, table, hsort_schedules, ssort_schedules, res,
+                          hsort_time, ssort_time, hsort_imbalance, ssort_imbalance,
+                          hsort_spill, ssort_spill);
+        }
 
         groupsize *= proc_x;
         MPI_Comm_free(&comm);
@@ -573,16 +1717,36 @@ int main(int argc, char **argv)
     if (rank == 0)
         PrintResults(hsort_time,
                      ssort_time,
+                     hsort_imbalance,
+                     ssort_imbalance,
+                     hsort_spill,
+                     ssort_spill,
+                     mem_blocks >= 0,
+                     tune || !lookup_file.empty() ? hsort_schedules : NULL,
+                     tune || !lookup_file.empty() ? ssort_schedules : NULL,
+                     key_type,
+                     psize,
                      min_procs,
                      max_procs,
                      proc_x,
                      min_elems,
                      max_elems,
                      elem_x);
+    if (rank == 0)
+        stats::print(warmup, trials);
+    if (rank == 0 && tune && !table.save(tune_file))
+        fprintf(stderr, "Error: cannot write schedules to %s\n", tune_file.c_str());
 
     // cleanup
     delete[] hsort_time;
     delete[] ssort_time;
+    delete[] hsort_imbalance;
+    delete[] ssort_imbalance;
+    delete[] hsort_spill;
+    delete[] ssort_spill;
+    delete[] hsort_schedules;
+    delete[] ssort_schedules;
+    timing::close_trace();
     MPI_Finalize();
     return 0;
 }
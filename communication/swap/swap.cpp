@@ -14,6 +14,7 @@
 #include "mpi.h"
 #include <math.h>
 #include <vector>
+#include <map>
 #include <algorithm>
 #include <assert.h>
 
@@ -24,27 +25,65 @@
 #include <diy/assigner.hpp>
 
 #include "../../include/opts.h"
+#include "../../include/args.h"
+#include "../../include/composite.h"
+#include "../../include/timing.h"
+#include "../../include/spill.h"
+#include "../../include/autotune.h"
+#include "../../include/results.h"
+#include "../../include/stats.h"
 
 using namespace std;
 
 typedef  diy::ContinuousBounds       Bounds;
 typedef  diy::RegularContinuousLink  RCLink;
 
+// compositing kernel counters, accumulated by ComputeSwap during one run
+double kernel_time;       // time spent in the compositing kernel
+size_t kernel_pixels;     // number of pixels composited
+timing::Mutex kernel_mutex;
+
+// copies of block values into and out of the diy message buffers, accumulated by the swap
+// callbacks during one run
+size_t bytes_copied;      // number of bytes copied
+double copy_time;         // time spent enqueueing and dequeueing them
+timing::Mutex copy_mutex;
+
+// zero-copy mode: the last round composites into an incoming buffer that the block keeps, and
+// the final exchange hands that buffer over as the message instead of copying the values
+bool zero_copy;
+
+// chunked mode: the chunks are sent with nonblocking MPI on a duplicate of the communicator of
+// the swap, from the blocks in place in zero-copy mode if all the blocks stay in memory
+MPI_Comm chunk_comm;
+bool blocks_in_core;
+timing::Mutex chunk_mutex; // the MPI calls of the callbacks and the chunks in flight
+
 // function prototypes
 void GetArgs(int argc, char **argv, int &min_procs, int &min_elems,
-	     int &max_elems, int &nb, int &target_k, bool &op);
+	     int &max_elems, int &nb, int &target_k, bool &op, int &num_threads,
+             int &mem_blocks, bool &zero_copy, int &max_chunks, std::string &tune_file,
+             std::string &lookup_file, std::string &out_file, int &warmup, int &trials);
 void MpiReduceScatter(float* reduce_scatter_data, double *reduce_scatter_time, int run,
                       float *in_data, MPI_Comm comm,
                       int num_elems, bool op);
-void DiySwap(double *swap_time, int run, int k, MPI_Comm comm, int dim, int totblocks,
-             bool contiguous, diy::Master& master, diy::ContiguousAssigner& assigner, bool op);
-void PrintResults(double *reduce_scatter_time, double *swap_time, int min_procs,
-		  int max_procs, int min_elems, int max_elems);
+void DiySwap(double *swap_time, double *kernel_rate, double *copied, double *copy_max_time,
+             int run, const autotune::Schedule& schedule, MPI_Comm comm, int totblocks,
+             bool contiguous, diy::Master& master, diy::ContiguousAssigner& assigner, bool op,
+             int chunks);
+void PrintResults(double *reduce_scatter_time, double *swap_time, double *kernel_rate,
+                  double *copied, double *copy_max_time,
+                  spill::Totals *spill_totals, bool out_of_core, int max_chunks,
+                  const std::string *schedules,
+                  int min_procs, int max_procs, int min_elems, int max_elems);
+struct ChunkedSwapPartners;
 void ComputeSwap(void* b_, const diy::ReduceProxy& rp, const diy::RegularSwapPartners&);
+void ChunkedSwap(void* b_, const diy::ReduceProxy& rp, const ChunkedSwapPartners& partners);
 void NoopSwap(void* b_, const diy::ReduceProxy& rp, const diy::RegularSwapPartners&);
 void Over(void *in, void *inout, int *len, MPI_Datatype*);
 void Noop(void*, void*, int*, MPI_Datatype*) {}
 void ResetBlock(void* b_, const diy::Master::ProxyWithLink& cp, void*);
+void AddCopies(size_t bytes, double time);
 
 // block
 struct Block
@@ -56,6 +95,9 @@ struct Block
         { diy::save(bb, *static_cast<const Block*>(b)); }
     static void     load(void* b, diy::BinaryBuffer& bb)
         { diy::load(bb, *static_cast<Block*>(b)); }
+    // values of the subset that this block owns
+    float* sub_data()
+        { return result.empty() ? &data[sub_start] : (float*) &result[0]; }
     void generate_data(int n_, int tot_b_)
         {
             n = n_;
@@ -81,12 +123,44 @@ struct Block
 
     //std::vector<char> contents;
     std::vector<float> data;
+    std::vector<char>  result;  // zero-copy mode: message buffer holding the owned subset,
+                                // followed by its sub_start and sub_size (empty otherwise)
     int gid;
     int sub_start; // starting index of subset of the total data that this block owns
     int sub_size;  // number of elements in the subset of the total data that this block owns
     size_t n;
     int    tot_b;
 };
+
+// serialize a block (used when blocks are moved out of core)
+namespace diy
+{
+    template<>
+        struct Serialization<Block>
+    {
+        static void save(BinaryBuffer& bb, const Block& b)
+        {
+            diy::save(bb, b.data);
+            diy::save(bb, b.result);
+            diy::save(bb, b.gid);
+            diy::save(bb, b.sub_start);
+            diy::save(bb, b.sub_size);
+            diy::save(bb, b.n);
+            diy::save(bb, b.tot_b);
+        }
+
+        static void load(BinaryBuffer& bb, Block& b)
+        {
+            diy::load(bb, b.data);
+            diy::load(bb, b.result);
+            diy::load(bb, b.gid);
+            diy::load(bb, b.sub_start);
+            diy::load(bb, b.sub_size);
+            diy::load(bb, b.n);
+            diy::load(bb, b.tot_b);
+        }
+    };
+}
 //
 // add blocks to a master
 //
@@ -118,6 +192,7 @@ void ResetBlock(void* b_, const diy::Master::ProxyWithLink& cp, void* args)
     int num_elems = *(int*)args;
     int tot_blocks = *((int*)args + 1);
     b->generate_data(num_elems, tot_blocks);
+    b->result.clear();
     b->sub_start = 0;
     b->sub_size = num_elems;
 }
@@ -127,13 +202,14 @@ void ResetBlock(void* b_, const diy::Master::ProxyWithLink& cp, void* args)
 void PrintBlock(void* b_, const diy::Master::ProxyWithLink& cp, void*)
 {
     Block* b   = static_cast<Block*>(b_);
+    float* data = b->sub_data();
     fprintf(stderr, "sub_start = %d sub_size = %d\n", b->sub_start, b->sub_size);
     for (int i = 0; i < b->sub_size / 4; i++)
         fprintf(stderr, "diy2 gid %d reduced data[4 * %d] = (%.1f, %.1f, %.1f %.1f)\n", b->gid, i,
-                b->data[b->sub_start + 4 * i    ],
-                b->data[b->sub_start + 4 * i + 1],
-                b->data[b->sub_start + 4 * i + 2],
-                b->data[b->sub_start + 4 * i + 3]);
+                data[4 * i    ],
+                data[4 * i + 1],
+                data[4 * i + 2],
+                data[4 * i + 3]);
 }
 //
 // checks diy2 block data against mpi reduce-scatter data
@@ -142,6 +218,7 @@ void CheckBlock(void* b_, const diy::Master::ProxyWithLink& cp, void* rs_)
 {
     Block* b   = static_cast<Block*>(b_);
     float* rs = static_cast<float*>(rs_);
+    float* data = b->sub_data();
 
     float max = 0;
 
@@ -150,19 +227,19 @@ void CheckBlock(void* b_, const diy::Master::ProxyWithLink& cp, void* rs_)
 
     for (int i = 0; i < b->sub_size / 4; i++)
     {
-        if (b->data[b->sub_start + 4 * i    ] != rs[4 * i    ] ||
-            b->data[b->sub_start + 4 * i + 1] != rs[4 * i + 1] ||
-            b->data[b->sub_start + 4 * i + 2] != rs[4 * i + 2] ||
-            b->data[b->sub_start + 4 * i + 3] != rs[4 * i + 3])
+        if (data[4 * i    ] != rs[4 * i    ] ||
+            data[4 * i + 1] != rs[4 * i + 1] ||
+            data[4 * i + 2] != rs[4 * i + 2] ||
+            data[4 * i + 3] != rs[4 * i + 3])
 #if 1
             fprintf(stderr, "i = %d gid = %d sub_start = %d sub_size = %d elem = %lu blocks = %d: "
                     "diy2 does not match mpi reduced data: "
                     "(%.1f, %.1f, %.1f %.1f) != (%.1f, %.1f, %.1f %.1f)\n",
                     i, b->gid, b->sub_start, b->sub_size, b->n, b->tot_b,
-                    b->data[b->sub_start + 4 * i    ],
-                    b->data[b->sub_start + 4 * i + 1],
-                    b->data[b->sub_start + 4 * i + 2],
-                    b->data[b->sub_start + 4 * i + 3],
+                    data[4 * i    ],
+                    data[4 * i + 1],
+                    data[4 * i + 2],
+                    data[4 * i + 3],
                     rs[4 * i    ],
                     rs[4 * i + 1],
                     rs[4 * i + 2],
@@ -170,13 +247,13 @@ void CheckBlock(void* b_, const diy::Master::ProxyWithLink& cp, void* rs_)
 #else
         {
             float diff;
-            diff = fabs(b->data[b->sub_start + 4 * i    ] - rs[4 * i    ]);
+            diff = fabs(data[4 * i    ] - rs[4 * i    ]);
             if (diff > max) max = diff;
-            diff = fabs(b->data[b->sub_start + 4 * i + 1] - rs[4 * i + 1]);
+            diff = fabs(data[4 * i + 1] - rs[4 * i + 1]);
             if (diff > max) max = diff;
-            diff = fabs(b->data[b->sub_start + 4 * i + 2] - rs[4 * i + 2]);
+            diff = fabs(data[4 * i + 2] - rs[4 * i + 2]);
             if (diff > max) max = diff;
-            diff = fabs(b->data[b->sub_start + 4 * i + 3] - rs[4 * i + 3]);
+            diff = fabs(data[4 * i + 3] - rs[4 * i + 3]);
             if (diff > max) max = diff;
         }
 #endif
@@ -204,11 +281,47 @@ int main(int argc, char **argv)
     int min_procs;            // minimum number of processes
     int max_procs;            // maximum number of processes (groupsize of MPI_COMM_WORLD)
     bool op;                  // actual operator or no-op
-
-    MPI_Init(&argc, &argv);
+    int num_threads;          // number of threads diy uses to run the blocks
+    int mem_blocks;           // number of blocks to keep in memory (-1 = all)
+    int max_chunks;           // maximum number of chunks per swap round message
+    std::string tune_file;    // autotune: table to write the fastest schedules to
+    std::string lookup_file;  // table to read the schedules from
+    autotune::Table table;    // schedules of the runs
+    std::string out_file;     // machine-readable results
+    int warmup, trials;       // number of untimed and timed trials per run
+
+    int thread_level;         // MPI thread support
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &thread_level);
     MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
 
-    GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, target_k, op);
+    GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, target_k, op, num_threads,
+            mem_blocks, zero_copy, max_chunks, tune_file, lookup_file, out_file, warmup, trials);
+    blocks_in_core = spill::mem_blocks(mem_blocks, num_threads) < 0 ||
+        spill::mem_blocks(mem_blocks, num_threads) >= nblocks;
+
+    // the chunked swap calls MPI from the callbacks, one thread at a time
+    if (max_chunks > 1 && num_threads > 1 && thread_level < MPI_THREAD_SERIALIZED)
+    {
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        if (rank == 0)
+            fprintf(stderr, "Warning: MPI does not support calls from several threads, "
+                    "running without chunks\n");
+        max_chunks = 1;
+    }
+    if (!results::open(out_file))
+    {
+        fprintf(stderr, "Error: cannot write results to %s\n", out_file.c_str());
+        exit(1);
+    }
+
+    // tuning adds to the entries of other apps and runs already in the table
+    if (!tune_file.empty())
+        table.load(tune_file);
+    else if (!lookup_file.empty() && !table.load(lookup_file))
+    {
+        fprintf(stderr, "Error: cannot read schedules from %s\n", lookup_file.c_str());
+        exit(1);
+    }
 
     // data extents, unused
     Bounds domain;
@@ -220,10 +333,17 @@ int main(int argc, char **argv)
 
     int num_runs = (int)((log2(max_procs / min_procs) + 1) *
                          (log2(max_elems / min_elems) + 1));
+    int num_chunk_iters = (int)(log2(max_chunks) + 1);
 
     // timing
+    // the swap results of run i with 2^j chunks are at index i * num_chunk_iters + j
     double reduce_scatter_time[num_runs];
-    double swap_time[num_runs];
+    double swap_time[num_runs * num_chunk_iters];
+    double kernel_rate[num_runs * num_chunk_iters];
+    double copied[num_runs * num_chunk_iters];
+    double copy_max_time[num_runs * num_chunk_iters];
+    spill::Totals spill_totals[num_runs * num_chunk_iters];
+    std::vector<std::string> schedules(num_runs);  // schedule of each run
 
     // data for MPI reduce, only for one local block
     float *in_data = new float[max_elems];
@@ -247,13 +367,11 @@ int main(int argc, char **argv)
 
         // initialize DIY
         tot_blocks = nblocks * groupsize;
-        int mem_blocks = -1; // everything in core for now
-        int num_threads = 1; // needed in order to do timing
         diy::mpi::communicator    world(comm);
-        diy::FileStorage          storage("./DIY.XXXXXX");
+        spill::Storage            storage("./DIY.XXXXXX");
         diy::Master               master(world,
                                          num_threads,
-                                         mem_blocks,
+                                         spill::mem_blocks(mem_blocks, num_threads),
                                          &Block::create,
                                          &Block::destroy,
                                          &storage,
@@ -267,24 +385,109 @@ int main(int argc, char **argv)
         num_elems = min_elems;
         while (num_elems <= max_elems)
         {
+            results::Run res("swap");
+            res.procs   = groupsize;
+            res.blocks  = tot_blocks;
+            res.elems   = num_elems;
+            res.op      = op ? "over" : "noop";
+            res.threads = num_threads;
+            char point[256];
+            sprintf(point, "procs %d elems %d", groupsize, num_elems);
+
             // MPI reduce-scatter, only for one block per process
             if (tot_blocks == groupsize)
-                MpiReduceScatter(reduce_scatter_data, reduce_scatter_time, run, in_data, comm,
-                                 num_elems, op);
+            {
+                stats::Samples samples;
+                for (int t = -warmup; t < trials; t++)
+                {
+                    MpiReduceScatter(reduce_scatter_data, reduce_scatter_time, run, in_data, comm,
+                                     num_elems, op);
+                    if (t >= 0)
+                        samples.add(reduce_scatter_time[run], comm);
+                }
+                reduce_scatter_time[run] = samples.median();
+                results::emit(res, "red_scat_time", samples);
+                stats::record(point, "red_scat_time", samples);
+            }
 
-            // DIY swap
             // initialize input data
             int args[2];
             args[0] = num_elems;
             args[1] = tot_blocks;
 
-            master.foreach(&ResetBlock, args);
-
-            DiySwap(swap_time, run, target_k, comm, dim, tot_blocks, true, master, assigner, op);
+            // schedule of the swap rounds
+            autotune::Schedule schedule;
+            if (!tune_file.empty())
+            {
+                // autotune: the fastest of all the schedules, without chunks
+                std::vector<autotune::Schedule> candidates;
+                autotune::schedules(tot_blocks, candidates);
+                autotune::Entry best;
+                for (size_t s = 0; s < candidates.size(); s++)
+                {
+                    master.foreach(&ResetBlock, args);
+                    double t, rate, bytes, copy_t;
+                    DiySwap(&t, &rate, &bytes, &copy_t, 0, candidates[s], comm, tot_blocks, true,
+                            master, assigner, op, 1);
+                    if (rank == 0)
+                        fprintf(stderr, "autotune procs %d elems %d schedule %s time %.3lf\n",
+                                groupsize, num_elems, autotune::name(candidates[s]).c_str(), t);
+                    if (s == 0 || t < best.time)
+                    {
+                        best.schedule = candidates[s];
+                        best.k        = autotune::max_k(candidates[s]);
+                        best.time     = t;
+                    }
+                }
+                table.set("swap", groupsize, tot_blocks, num_elems, best);
+                schedule = best.schedule;
+            }
+            else
+                schedule = autotune::lookup(table, "swap", groupsize, tot_blocks, num_elems,
+                                            target_k);
+            schedules[run] = autotune::name(schedule);
+            res.k = schedules[run];
+
+            // DIY swap, for each number of chunks
+            // the other quantities are those of the last trial
+            for (int chunks = 1, j = 0; chunks <= max_chunks; chunks *= 2, j++)
+            {
+                int i = run * num_chunk_iters + j;
+                stats::Samples samples;
+                for (int t = -warmup; t < trials; t++)
+                {
+                    master.foreach(&ResetBlock, args);
+                    spill::stats().reset();
+                    DiySwap(swap_time, kernel_rate, copied, copy_max_time, i, schedule, comm,
+                            tot_blocks, true, master, assigner, op, chunks);
+                    if (t >= 0)
+                        samples.add(timing::round_timer().local, comm);
+                    if (t < trials - 1)
+                        master.foreach(&CheckBlock, reduce_scatter_data);
+                }
+                swap_time[i] = samples.median();
+                char metric[64];
+                sprintf(metric, chunks > 1 ? "swap_time_c%d" : "swap_time", chunks);
+                results::emit(res, metric, samples);
+                stats::record(point, metric, samples);
+                if (chunks == 1)
+                {
+                    results::emit(comm, res, "kernel_Mpix/s",
+                                  kernel_time > 0.0 ? kernel_pixels / kernel_time / 1e6 : 0.0);
+                    results::emit(comm, res, "copied_MB", bytes_copied / 1048576.0);
+                    results::emit(comm, res, "copy_time", copy_time);
+                }
+                spill_totals[i] = spill::stats().reduce(comm, timing::round_timer().local);
+                char label[256];
+                sprintf(label, "procs %d elems %d chunks %d schedule %s", groupsize, num_elems,
+                        chunks, schedules[run].c_str());
+                timing::print_rounds(label, comm);
+                timing::print_profile(label, comm);
 
-            // debug
-            //       master.foreach(PrintBlock);
-            master.foreach(&CheckBlock, reduce_scatter_data);
+                // debug
+                //       master.foreach(PrintBlock);
+                master.foreach(&CheckBlock, reduce_scatter_data);
+            }
 
             num_elems *= 2; // double the number of elements every time
             run++;
@@ -300,11 +503,20 @@ int main(int argc, char **argv)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     fflush(stderr);
     if (rank == 0)
-        PrintResults(reduce_scatter_time, swap_time, min_procs, max_procs, min_elems, max_elems);
+    {
+        PrintResults(reduce_scatter_time, swap_time, kernel_rate, copied, copy_max_time, spill_totals,
+                     mem_blocks >= 0, max_chunks,
+                     (tune_file.empty() && lookup_file.empty()) ? NULL : &schedules[0],
+                     min_procs, max_procs, min_elems, max_elems);
+        stats::print(warmup, trials);
+        if (!tune_file.empty() && !table.save(tune_file))
+            fprintf(stderr, "Error: cannot write schedules to %s\n", tune_file.c_str());
+    }
 
     // cleanup
     delete[] in_data;
     delete[] reduce_scatter_data;
+    timing::close_trace();
     MPI_Finalize();
 
     return 0;
@@ -428,6 +640,45 @@ in_partner(int gid) const
     return res;
 }
 
+// chunked swap: the same rounds as the swap partners, but the messages of a round are split
+// into chunks and sent with nonblocking MPI by the round's callback, and the next round's
+// callback composites them in order, each chunk as soon as it has arrived, while the later
+// ones are still in flight; the DIY exchanges between the rounds carry no messages
+struct ChunkedSwapPartners: public diy::RegularSwapPartners
+{
+    ChunkedSwapPartners(const diy::RegularSwapPartners& swap_partners, int chunks_, bool op_):
+        diy::RegularSwapPartners(swap_partners), chunks(chunks_), op(op_)
+        {}
+
+    int     chunks;                          // chunks per message
+    bool    op;                              // composite the chunks, or only exchange them
+};
+
+// chunks of a swap round in flight, from the callback that sends them to the one of the next
+// round that composites them; kept by gid outside of the blocks, which may be moved out of
+// core in between
+struct ChunkedRound
+{
+    int                                 mypos;      // position of the block in its group
+    std::vector<int>                    starts;     // chunks of its subset, start and size
+    std::vector<int>                    sizes;
+    int                                 sub_start;  // its subset after the round
+    int                                 sub_size;
+    std::vector< std::vector<float> >   in;         // its subset from the others, by position
+    std::vector< std::vector<float> >   out;        // copies of the subsets sent, by position
+    std::vector<MPI_Request>            recvs;      // by chunk, then position
+    std::vector<MPI_Request>            sends;
+};
+
+std::map<int, ChunkedRound> chunked_rounds;
+
+//
+// final exchange
+//
+// in zero-copy mode, the message is the subset followed by its sub_start and sub_size; the
+// buffer kept by the last round of the swap already has this layout and is handed over as is,
+// and the receiver keeps the incoming buffer in the same way
+//
 void FinalSwapExchange(void* b_, const diy::ReduceProxy& proxy, const FinalSwapPartners& partners)
 {
     Block* b = static_cast<Block*>(b_);
@@ -436,69 +687,165 @@ void FinalSwapExchange(void* b_, const diy::ReduceProxy& proxy, const FinalSwapP
     {
         const diy::BlockID dest = proxy.out_link().target(0);
         //printf("Sending: %d -> %d\n", b->gid, dest.gid);
-        proxy.enqueue(dest, b->sub_start);
-        proxy.enqueue(dest, b->sub_size);
-        proxy.enqueue(dest, &b->data[b->sub_start], b->sub_size);
+        if (zero_copy && !b->result.empty())
+        {
+            proxy.outgoing(dest).buffer.swap(b->result);
+            b->result.clear();
+            return;
+        }
+        double t0 = MPI_Wtime();
+        if (zero_copy)
+        {
+            proxy.enqueue(dest, &b->data[b->sub_start], b->sub_size);
+            proxy.enqueue(dest, b->sub_start);
+            proxy.enqueue(dest, b->sub_size);
+        } else
+        {
+            proxy.enqueue(dest, b->sub_start);
+            proxy.enqueue(dest, b->sub_size);
+            proxy.enqueue(dest, &b->data[b->sub_start], b->sub_size);
+        }
+        AddCopies(b->sub_size * sizeof(float), MPI_Wtime() - t0);
     } else
     {
         int from = proxy.in_link().target(0).gid;
         //printf("Receiving: %d -> %d\n", from, b->gid);
+        if (zero_copy)
+        {
+            b->result.swap(proxy.incoming(from).buffer);
+            size_t tail = b->result.size() - 2 * sizeof(int);
+            memcpy(&b->sub_start, &b->result[tail], sizeof(int));
+            memcpy(&b->sub_size,  &b->result[tail + sizeof(int)], sizeof(int));
+            return;
+        }
+        double t0 = MPI_Wtime();
         proxy.dequeue(from, b->sub_start);
         proxy.dequeue(from, b->sub_size);
         proxy.dequeue(from, &b->data[b->sub_start], b->sub_size);
+        AddCopies(b->sub_size * sizeof(float), MPI_Wtime() - t0);
     }
 }
+//
+// accumulates copies made by the swap callbacks
+//
+void AddCopies(size_t bytes, double time)
+{
+    timing::Lock l(copy_mutex);
+    bytes_copied += bytes;
+    copy_time    += time;
+}
 
 //
 // DIY swap
 //
 // swap_time: time (output)
+// kernel_rate: compositing kernel pixels per second per process (output)
+// copied: bytes of block values copied into and out of message buffers, all processes (output)
+// copy_max_time: time spent copying them, maximum over processes (output)
 // run: run number
-// k: desired k value
+// schedule: k value of each round
 // comm: MPI communicator
-// dim: dimensionality of decompostion
 // totblocks: total number of blocks
 // contiguous: use contiguous partners
 // master, assigner: diy usual
 // op: run actual op or noop
+// chunks: number of chunks per message
 //
-void DiySwap(double *swap_time, int run, int k, MPI_Comm comm, int dim, int totblocks,
-             bool contiguous, diy::Master& master, diy::ContiguousAssigner& assigner, bool op)
+void DiySwap(double *swap_time, double *kernel_rate, double *copied, double *copy_max_time,
+             int run, const autotune::Schedule& schedule, MPI_Comm comm, int totblocks,
+             bool contiguous, diy::Master& master, diy::ContiguousAssigner& assigner, bool op,
+             int chunks)
 {
+    kernel_time   = 0.0;
+    kernel_pixels = 0;
+    bytes_copied  = 0;
+    copy_time     = 0.0;
+    timing::round_timer().reset();
+
+    // the tags of the chunks must be valid MPI tags
+    if (chunks > 1)
+    {
+        int* tag_ub;
+        int flag;
+        MPI_Comm_get_attr(comm, MPI_TAG_UB, &tag_ub, &flag);
+        if (flag && (double)totblocks * autotune::max_k(schedule) * chunks > *tag_ub)
+        {
+            fprintf(stderr, "Error: %d blocks in %d chunks exceed the MPI tags\n", totblocks,
+                    chunks);
+            MPI_Abort(comm, 1);
+        }
+        MPI_Comm_dup(comm, &chunk_comm);
+    }
+
+    // callbacks may run in several threads: the end of the swap is the end of the last callback
     MPI_Barrier(comm);
     double t0 = MPI_Wtime();
 
     //printf("---- %d ----\n", totblocks);
-    diy::RegularSwapPartners  partners(dim, totblocks, k, contiguous);
-    if (op)
-        diy::reduce(master, assigner, partners, &ComputeSwap);
+    diy::RegularSwapPartners  partners =
+        autotune::partners<diy::RegularSwapPartners>(totblocks, schedule, contiguous);
+    int                       rounds = partners.rounds();
+    if (chunks > 1)
+    {
+        ChunkedSwapPartners chunked_partners(partners, chunks, op);
+        diy::reduce(master, assigner, chunked_partners,
+                    &timing::timed<ChunkedSwapPartners, &ChunkedSwap>);
+    }
+    else if (op)
+        diy::reduce(master, assigner, partners,
+                    &timing::timed<diy::RegularSwapPartners, &ComputeSwap>);
     else
-        diy::reduce(master, assigner, partners, &NoopSwap);
+        diy::reduce(master, assigner, partners,
+                    &timing::timed<diy::RegularSwapPartners, &NoopSwap>);
 
     if (contiguous)
     {
         FinalSwapPartners final_swap_partners(totblocks, partners);
+        timing::round_timer().offset = rounds + 1;
         if (final_swap_partners.rounds() > 0)
-            diy::reduce(master, assigner, final_swap_partners, &FinalSwapExchange);
+            diy::reduce(master, assigner, final_swap_partners,
+                        &timing::timed<FinalSwapPartners, &FinalSwapExchange>);
     }
 
     //printf("------------\n");
-    MPI_Barrier(comm);
-    swap_time[run] = MPI_Wtime() - t0;
+    swap_time[run] = timing::elapsed(t0, comm);
+    if (chunks > 1)
+        MPI_Comm_free(&chunk_comm);
+
+    // kernel rate over all processes: total pixels / total time in the kernel
+    double local[2] = { (double)kernel_pixels, kernel_time };
+    double global[2];
+    MPI_Reduce(local, global, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+    kernel_rate[run] = global[1] > 0.0 ? global[0] / global[1] : 0.0;
+
+    double bytes = bytes_copied;
+    MPI_Reduce(&bytes, &copied[run], 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(&copy_time, &copy_max_time[run], 1, MPI_DOUBLE, MPI_MAX, 0, comm);
 }
 //
 // print results
 //
-// reduce_scatter_time, swap_time: times
+// reduce_scatter_time, swap_time: times, median over the trials
+// kernel_rate: compositing kernel pixels per second per process
+// copied, copy_max_time: bytes copied into and out of message buffers and time to copy them
+// spill_totals: blocks moved out of core and back during the swap
+// out_of_core: whether to print the spill columns
+// max_chunks: maximum number of chunks per message (swap times with 2, 4, ... chunks are
+// printed after the other columns, which are for unchunked messages)
+// schedules: schedule of each run, NULL if they were not tuned or looked up
 // min_procs, max_procs: process range
 // min_elems, max_elems: data range
 //
-void PrintResults(double *reduce_scatter_time, double *swap_time, int min_procs,
-		  int max_procs, int min_elems, int max_elems)
+void PrintResults(double *reduce_scatter_time, double *swap_time, double *kernel_rate,
+                  double *copied, double *copy_max_time,
+                  spill::Totals *spill_totals, bool out_of_core, int max_chunks,
+                  const std::string *schedules,
+                  int min_procs, int max_procs, int min_elems, int max_elems)
 {
     int elem_iter = 0;                                            // element iteration number
     int num_elem_iters = (int)(log2(max_elems / min_elems) + 1);  // number of element iterations
     int proc_iter = 0;                                            // process iteration number
+    int num_chunk_iters = (int)(log2(max_chunks) + 1);            // number of chunk iterations
 
     fprintf(stderr, "----- Timing Results -----\n");
 
@@ -508,16 +855,39 @@ void PrintResults(double *reduce_scatter_time, double *swap_time, int min_procs,
     {
         fprintf(stderr, "\n# num_elemnts = %d   size @ 4 bytes / element = %d KB\n",
                 num_elems, num_elems * 4 / 1024);
-        fprintf(stderr, "# procs \t red_scat_time \t swap_time\n");
+        fprintf(stderr, "# procs \t red_scat_time \t swap_time \t kernel_Mpix/s"
+                " \t copied_MB \t copy_time");
+        if (out_of_core)
+            fprintf(stderr, " \t comm_time \t spill_MB \t spill_time \t reload_MB \t reload_time");
+        for (int c = 2; c <= max_chunks; c *= 2)
+            fprintf(stderr, " \t swap_time_c%d", c);
+        if (schedules)
+            fprintf(stderr, " \t schedule");
+        fprintf(stderr, "\n");
 
         // iterate over processes
         int groupsize = min_procs;
         proc_iter = 0;
         while (groupsize <= max_procs)
         {
-            int i = proc_iter * num_elem_iters + elem_iter; // index into times
-            fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf\n",
-                    groupsize, reduce_scatter_time[i], swap_time[i]);
+            int r = proc_iter * num_elem_iters + elem_iter; // index into times
+            int i = r * num_chunk_iters;                    // index into swap results
+            fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf \t\t %.1lf \t\t %.1lf \t\t %.3lf",
+                    groupsize, reduce_scatter_time[r], swap_time[i], kernel_rate[i] / 1e6,
+                    copied[i] / 1048576.0, copy_max_time[i]);
+            if (out_of_core)
+            {
+                const spill::Totals& st = spill_totals[i];
+                fprintf(stderr, " \t\t %.3lf \t\t %.1lf \t\t %.3lf \t\t %.1lf \t\t %.3lf",
+                        st.rest,
+                        st.bytes_out / 1048576.0, st.time_out,
+                        st.bytes_in  / 1048576.0, st.time_in);
+            }
+            for (int j = 1; j < num_chunk_iters; j++)
+                fprintf(stderr, " \t\t %.3lf", swap_time[i + j]);
+            if (schedules)
+                fprintf(stderr, " \t\t %s", schedules[r].c_str());
+            fprintf(stderr, "\n");
 
             groupsize *= 2; // double the number of processes every time
             proc_iter++;
@@ -563,90 +933,59 @@ void ComputeSwap(void* b_, const diy::ReduceProxy& rp, const diy::RegularSwapPar
         // NB: assumes that all items are same size, b->sub_size
         // TODO: figure out what to do when they are not, eg, when last item has extra values
         int s = b->sub_start;
-        for (int i = mypos-1; i >= 0; --i)
+        double t0 = MPI_Wtime();
+        if (zero_copy && k > 1 && !rp.out_link().size())
         {
-
-            float* in = (float*) &rp.incoming(rp.in_link().target(i).gid).buffer[0];
-
-            for (int j = 0; j < b->sub_size / 4; j++)
+            // last round: accumulate into the incoming buffer of a neighbor in the link and keep
+            // it, so that the final exchange can hand it over without copying; the first over
+            // is the same as below (the neighbor with my values), so the result is identical
+            int a = (mypos > 0) ? mypos - 1 : mypos + 1;
+            b->result.swap(rp.incoming(rp.in_link().target(a).gid).buffer);
+            float* acc = (float*) &b->result[0];
+            if (a < mypos)
+                composite::over_front_to_back(acc, &b->data[s], b->sub_size / 4);
+            else
+                composite::over_back_to_front(&b->data[s], acc, b->sub_size / 4);
+
+            for (int i = std::min(a, mypos) - 1; i >= 0; --i)
             {
-                float& xa = in[j * 4    ];
-                float& ya = in[j * 4 + 1];
-                float& za = in[j * 4 + 2];
-                float& aa = in[j * 4 + 3];
-
-                float& xb = b->data[s + j * 4    ];
-                float& yb = b->data[s + j * 4 + 1];
-                float& zb = b->data[s + j * 4 + 2];
-                float& ab = b->data[s + j * 4 + 3];
-
-                float& xo = xb;
-                float& yo = yb;
-                float& zo = zb;
-                float& ao = ab;
-
-#if 0
-                xo = xa * aa + xb * ab * (1 - aa);
-                yo = ya * aa + yb * ab * (1 - aa);
-                zo = za * aa + zb * ab * (1 - aa);
-                ao =      aa +      ab * (1 - aa);
-
-                xo /= ao;
-                yo /= ao;
-                zo /= ao;
-#else
-                xo = xa + xb * (1 - aa);
-                yo = ya + yb * (1 - aa);
-                zo = za + zb * (1 - aa);
-                ao = aa + ab * (1 - aa);
-#endif
+                float* in = (float*) &rp.incoming(rp.in_link().target(i).gid).buffer[0];
+                composite::over_back_to_front(in, acc, b->sub_size / 4);
             }
-        }
 
-        for (int i = mypos+1; i < k; ++i)
+            for (int i = std::max(a, mypos) + 1; i < k; ++i)
+            {
+                float* in = (float*) &rp.incoming(rp.in_link().target(i).gid).buffer[0];
+                composite::over_front_to_back(acc, in, b->sub_size / 4);
+            }
+        } else
         {
-            float* in = (float*) &rp.incoming(rp.in_link().target(i).gid).buffer[0];
+            for (int i = mypos-1; i >= 0; --i)
+            {
+                float* in = (float*) &rp.incoming(rp.in_link().target(i).gid).buffer[0];
+                composite::over_back_to_front(in, &b->data[s], b->sub_size / 4);
+            }
 
-            for (int j = 0; j < b->sub_size / 4; j++)
+            for (int i = mypos+1; i < k; ++i)
             {
-                float& xa = b->data[s + j * 4    ];
-                float& ya = b->data[s + j * 4 + 1];
-                float& za = b->data[s + j * 4 + 2];
-                float& aa = b->data[s + j * 4 + 3];
-
-                float& xb = in[j * 4    ];
-                float& yb = in[j * 4 + 1];
-                float& zb = in[j * 4 + 2];
-                float& ab = in[j * 4 + 3];
-
-                float& xo = xa;
-                float& yo = ya;
-                float& zo = za;
-                float& ao = aa;
-
-#if 0
-                xo = xa * aa + xb * ab * (1 - aa);
-                yo = ya * aa + yb * ab * (1 - aa);
-                zo = za * aa + zb * ab * (1 - aa);
-                ao =      aa +      ab * (1 - aa);
-
-                xo /= ao;
-                yo /= ao;
-                zo /= ao;
-#else
-                xo = xa + xb * (1 - aa);
-                yo = ya + yb * (1 - aa);
-                zo = za + zb * (1 - aa);
-                ao = aa + ab * (1 - aa);
-#endif
+                float* in = (float*) &rp.incoming(rp.in_link().target(i).gid).buffer[0];
+                composite::over_front_to_back(&b->data[s], in, b->sub_size / 4);
             }
         }
+        timing::Lock l(kernel_mutex);
+        kernel_time   += MPI_Wtime() - t0;
+        kernel_pixels += (k - 1) * (b->sub_size / 4);
     }
 
     if (!rp.out_link().size())
         return;
 
     // enqueue
+    // each subset is copied once into the message buffer of its partner; in zero-copy mode it is
+    // followed by its sub_start and sub_size, which are also the receiver's, so that a buffer
+    // kept by the receiver in the last round is already a final exchange message
+    size_t copied = 0;
+    double t0 = MPI_Wtime();
     k = rp.out_link().size();
     for (unsigned i = 0; i < k; i++)
     {
@@ -662,9 +1001,181 @@ void ComputeSwap(void* b_, const diy::ReduceProxy& rp, const diy::RegularSwapPar
         else
             sub_size = b->sub_size / k;
         rp.enqueue(rp.out_link().target(i), &b->data[sub_start], sub_size);
+        if (zero_copy)
+        {
+            rp.enqueue(rp.out_link().target(i), sub_start);
+            rp.enqueue(rp.out_link().target(i), sub_size);
+        }
+        copied += sub_size * sizeof(float);
         //     fprintf(stderr, "[%d:%d] Sent %lu values starting at %d to [%d]\n",
         //             rp.gid(), rp.round(), send_buf.size(), sub_start, rp.out_link().target(i).gid);
     }
+    AddCopies(copied, MPI_Wtime() - t0);
+}
+//
+// range of chunk c out of chunks of subset i out of k of the current subset of a block:
+// start index and number of elements, in whole pixels
+//
+void ChunkRange(const Block* b, int i, int k, int c, int chunks, int& start, int& size)
+{
+    int sub_size = (i == k - 1) ? b->sub_size - (i * b->sub_size / k) : b->sub_size / k;
+    int npixels  = sub_size / 4;
+    start = b->sub_start + (i * b->sub_size / k) + 4 * (c * npixels / chunks);
+    size  = 4 * ((c + 1) * npixels / chunks - c * npixels / chunks);
+}
+//
+// tag of chunk c of the subset sent to block gid by the block at position pos of its group of k
+//
+int ChunkTag(int gid, int pos, int k, int c, int chunks)
+{
+    return (gid * k + pos) * chunks + c;
+}
+//
+// waits for n requests, polled under chunk_mutex so that the callbacks of several threads do
+// not call MPI at the same time
+//
+void WaitChunks(MPI_Request* reqs, int n)
+{
+    int done = 0;
+    while (!done)
+    {
+        timing::Lock l(chunk_mutex);
+        MPI_Testall(n, reqs, &done, MPI_STATUSES_IGNORE);
+    }
+}
+//
+// chunked swap operator for DIY swap
+// same over operator and ordering as ComputeSwap (or only the exchange, for noop): composites
+// the chunks sent in the previous round as they arrive, then posts the receives and sends of
+// the chunks of this round
+//
+void ChunkedSwap(void* b_, const diy::ReduceProxy& rp, const ChunkedSwapPartners& partners)
+{
+    Block* b = static_cast<Block*>(b_);
+    int chunks = partners.chunks;
+
+    ChunkedRound* cr = NULL;
+    {
+        timing::Lock l(chunk_mutex);
+        std::map<int, ChunkedRound>::iterator it = chunked_rounds.find(rp.gid());
+        if (it != chunked_rounds.end())
+            cr = &it->second;
+    }
+    if (cr)
+    {
+        // chunk c is composited while chunks c + 1, ... are still arriving
+        int k = cr->in.size();
+        size_t received = 0;
+        for (int c = 0; c < chunks; ++c)
+        {
+            WaitChunks(&cr->recvs[c * k], k);
+            int s    = cr->starts[c];
+            int size = cr->sizes[c];
+            int off  = s - cr->starts[0];
+            if (!partners.op || !size)
+                continue;
+
+            double t0 = MPI_Wtime();
+            for (int i = cr->mypos - 1; i >= 0; --i)
+                composite::over_back_to_front(&cr->in[i][off], &b->data[s], size / 4);
+            for (int i = cr->mypos + 1; i < k; ++i)
+                composite::over_front_to_back(&b->data[s], &cr->in[i][off], size / 4);
+            timing::Lock l(kernel_mutex);
+            kernel_time   += MPI_Wtime() - t0;
+            kernel_pixels += (k - 1) * (size / 4);
+        }
+        WaitChunks(&cr->sends[0], cr->sends.size());
+        for (int i = 0; i < k; ++i)
+            received += cr->in[i].size() * sizeof(float);
+        timing::round_timer().bytes(rp.round(), 0, received);
+
+        // my subset is the result of the swap round
+        b->sub_start = cr->sub_start;
+        b->sub_size  = cr->sub_size;
+
+        timing::Lock l(chunk_mutex);
+        chunked_rounds.erase(rp.gid());
+    }
+
+    if (!rp.out_link().size())
+        return;
+
+    int k = rp.out_link().size();
+    int mypos;
+    for (unsigned i = 0; i < k; ++i)
+        if (rp.out_link().target(i).gid == rp.gid())
+            mypos = i;
+    {
+        timing::Lock l(chunk_mutex);
+        cr = &chunked_rounds[rp.gid()];
+    }
+    cr->mypos = mypos;
+    cr->starts.resize(chunks);
+    cr->sizes.resize(chunks);
+    for (int c = 0; c < chunks; ++c)
+        ChunkRange(b, mypos, k, c, chunks, cr->starts[c], cr->sizes[c]);
+    cr->sub_start = b->sub_start + (mypos * b->sub_size / k);
+    if (mypos == k - 1) // last subset may be different size
+        cr->sub_size = b->sub_size - (mypos * b->sub_size / k);
+    else
+        cr->sub_size = b->sub_size / k;
+    cr->in.resize(k);
+    cr->out.resize(k);
+    cr->recvs.assign(chunks * k, MPI_REQUEST_NULL);
+    cr->sends.assign(chunks * k, MPI_REQUEST_NULL);
+
+    // receive the chunks of my subset from the others
+    for (unsigned i = 0; i < k; ++i)
+    {
+        if (i == mypos)
+            continue;
+        cr->in[i].resize(cr->sub_size);
+        for (int c = 0; c < chunks; ++c)
+        {
+            if (!cr->sizes[c])
+                continue;
+            timing::Lock l(chunk_mutex);
+            MPI_Irecv(&cr->in[i][cr->starts[c] - cr->starts[0]], cr->sizes[c], MPI_FLOAT,
+                      rp.out_link().target(i).proc, ChunkTag(rp.gid(), i, k, c, chunks),
+                      chunk_comm, &cr->recvs[c * k + i]);
+        }
+    }
+
+    // send the chunks of their subsets to the others, the first chunks of all first; they are
+    // copied out of the block, unless they can be sent from it in place
+    bool in_place = zero_copy && blocks_in_core;
+    size_t sent = 0, copied = 0;
+    double copy_t = 0.0;
+    for (int c = 0; c < chunks; ++c)
+        for (unsigned i = 0; i < k; ++i)
+        {
+            if (i == mypos)
+                continue;
+            int start, size;
+            ChunkRange(b, i, k, c, chunks, start, size);
+            if (!size)
+                continue;
+            float* chunk = &b->data[start];
+            if (!in_place)
+            {
+                double t0 = MPI_Wtime();
+                int first = b->sub_start + (i * b->sub_size / k);
+                if (cr->out[i].empty())
+                    cr->out[i].resize((i == k - 1) ? b->sub_size - (i * b->sub_size / k) :
+                                      b->sub_size / k);
+                chunk = &cr->out[i][start - first];
+                std::copy(&b->data[start], &b->data[start] + size, chunk);
+                copied += size * sizeof(float);
+                copy_t += MPI_Wtime() - t0;
+            }
+            timing::Lock l(chunk_mutex);
+            MPI_Isend(chunk, size, MPI_FLOAT, rp.out_link().target(i).proc,
+                      ChunkTag(rp.out_link().target(i).gid, mypos, k, c, chunks), chunk_comm,
+                      &cr->sends[c * k + i]);
+            sent += size * sizeof(float);
+        }
+    timing::round_timer().bytes(rp.round(), sent, 0);
+    AddCopies(copied, copy_t);
 }
 //
 // Noop for DIY swap
@@ -711,6 +1222,8 @@ void NoopSwap(void* b_, const diy::ReduceProxy& rp, const diy::RegularSwapPartne
         return;
 
     // enqueue
+    size_t copied = 0;
+    double t0 = MPI_Wtime();
     k = rp.out_link().size();
     for (unsigned i = 0; i < k; i++)
     {
@@ -723,7 +1236,9 @@ void NoopSwap(void* b_, const diy::ReduceProxy& rp, const diy::RegularSwapPartne
             sub_size = b->sub_size / k;
         //printf("[%d]: round %d enqueueing %d\n", rp.gid(), rp.round(), sub_size);
         rp.enqueue(rp.out_link().target(i), &b->data[sub_start], sub_size);
+        copied += sub_size * sizeof(float);
     }
+    AddCopies(copied, MPI_Wtime() - t0);
 
     // update sub_start and sub_size inside the block
     if (rp.in_link().size() == 0)
@@ -742,41 +1257,7 @@ void NoopSwap(void* b_, const diy::ReduceProxy& rp, const diy::RegularSwapPartne
 //
 void Over(void *in_, void *inout_, int *len, MPI_Datatype *type)
 {
-    float* in    = (float*) in_;
-    float* inout = (float*) inout_;
-    for (int i = 0; i < *len / 4; i++)
-    {
-        float& xa = in[i * 4    ];
-        float& ya = in[i * 4 + 1];
-        float& za = in[i * 4 + 2];
-        float& aa = in[i * 4 + 3];
-
-        float& xb = inout[i * 4    ];
-        float& yb = inout[i * 4 + 1];
-        float& zb = inout[i * 4 + 2];
-        float& ab = inout[i * 4 + 3];
-
-        float& xo = xb;
-        float& yo = yb;
-        float& zo = zb;
-        float& ao = ab;
-
-#if 0
-        xo = xa * aa + xb * ab * (1 - aa);
-        yo = ya * aa + yb * ab * (1 - aa);
-        zo = za * aa + zb * ab * (1 - aa);
-        ao =      aa +      ab * (1 - aa);
-
-        xo /= ao;
-        yo /= ao;
-        zo /= ao;
-#else
-        xo = xa + xb * (1 - aa);
-        yo = ya + yb * (1 - aa);
-        zo = za + zb * (1 - aa);
-        ao = aa + ab * (1 - aa);
-#endif
-    }
+    composite::over_back_to_front((float*) in_, (float*) inout_, *len / 4);
 }
 //
 // gets command line args
@@ -788,9 +1269,20 @@ void Over(void *in_, void *inout_, int *len, MPI_Datatype *type)
 // nb: number of blocks per process (output)
 // target_k: target k-value (output)
 // op: whether to run to operator or no op
+// num_threads: number of threads (output)
+// mem_blocks: number of blocks to keep in memory, -1 = all (output)
+// zero_copy: keep the last round's incoming buffers instead of copying (output)
+// max_chunks: maximum number of chunks per message, swept over powers of two (output)
+// tune_file: autotune: run all the schedules and write the fastest to this table (output)
+// lookup_file: take the schedules from this table instead of target_k (output)
+// out_file: file for the machine-readable results (results.h), empty = none (output)
+// warmup: number of untimed trials before the timed ones of each run (output)
+// trials: number of timed trials of each run, summarized by their median (output)
 //
 void GetArgs(int argc, char **argv, int &min_procs,
-	     int &min_elems, int &max_elems, int &nb, int &target_k, bool &op)
+	     int &min_elems, int &max_elems, int &nb, int &target_k, bool &op, int &num_threads,
+             int &mem_blocks, bool &zero_copy, int &max_chunks, std::string &tune_file,
+             std::string &lookup_file, std::string &out_file, int &warmup, int &trials)
 {
     using namespace opts;
     Options ops(argc, argv);
@@ -799,6 +1291,19 @@ void GetArgs(int argc, char **argv, int &min_procs,
     MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
+    num_threads = 1;
+    mem_blocks  = -1;
+    ops >> Option('t', "threads",    num_threads, "number of threads")
+        >> Option('m', "mem-blocks", mem_blocks,  "number of blocks to keep in memory");
+    zero_copy = ops >> Present('z', "zero-copy", "keep message buffers instead of copying them");
+    max_chunks  = 1;
+    ops >> Option('c', "chunks", max_chunks, "max chunks per message (1, 2, 4, ... are run)");
+    ops >> Option('a', "autotune", tune_file,   "run all schedules, write the fastest to file")
+        >> Option('l', "lookup",   lookup_file, "read the schedules from file");
+    args::run_options(ops, out_file, warmup, trials);
+    std::string trace_prefix;
+    args::profile_options(ops, trace_prefix);
+
     if (ops >> Present('h', "help", "show help") ||
         !(ops >> PosOption(min_procs)
           >> PosOption(min_elems)
@@ -808,18 +1313,32 @@ void GetArgs(int argc, char **argv, int &min_procs,
           >> PosOption(op)))
     {
         if (rank == 0)
-            fprintf(stderr, "Usage: %s min_procs min_elems max_elems nb target_k op\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-t threads] [-m mem_blocks] [-z] [-c chunks] "
+                    "[-a table | -l table] [-o results] [-w warmup] [-n trials] [-f] [-e trace] "
+                    "min_procs min_elems max_elems nb target_k op\n",
+                    argv[0]);
         exit(1);
     }
 
+    args::check_threads(num_threads, rank);
+
     //if (target_k != 2)
     //    fprintf(stderr, "Warning: the code assumes k=2, but k=%d requested\n", target_k);
 
     // check there is at least four elements (eg., one pixel) per block
     assert(min_elems >= 4 *nb * max_procs); // at least one element per block
 
+    if (max_chunks < 1)
+        max_chunks = 1;
+    args::check_trials(warmup, trials);
+
+    args::open_trace(trace_prefix, rank);
+
     if (rank == 0)
         fprintf(stderr, "min_procs = %d min_elems = %d max_elems = %d nb = %d "
-                "target_k = %d\n", min_procs, min_elems, max_elems, nb, target_k);
+                "target_k = %d threads = %d mem_blocks = %d zero_copy = %d max_chunks = %d "
+                "warmup = %d trials = %d compositing kernel = %s\n",
+                min_procs, min_elems, max_elems, nb, target_k, num_threads, mem_blocks, zero_copy,
+                max_chunks, warmup, trials, composite::isa_name(composite::isa()));
 }
 
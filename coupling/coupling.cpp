@@ -35,6 +35,8 @@
 #endif
 
 #include "include/mesh_gen.hpp"
+#include "../include/results.h"
+#include "../include/stats.h"
 
 // memory profiling
 #define MEMORY
@@ -79,6 +81,10 @@ enum
     MAX_TIMES,
 };
 
+// parameters of the current run, for the machine-readable results
+results::Run run_params("coupling");
+bool timed_trial = true;                     // false during warmup trials, which are not recorded
+
 //
 // starts / stops timing
 // (does a barrier)
@@ -179,12 +185,24 @@ void GetMem(int breakpoint,                  // breakpoint number
 #endif // MEMORY
 }
 
-// prints total and per iteration times
+// prints total and per iteration times and records them in the results (collective over comm)
 // resets point location, interpolation, and tag exchange times for reuse
 //
 void PrintTimes(double* times,               // all times
-                int num_iter)                // number of iterations
+                int num_iter,                // number of iterations
+                const char* field,           // vertex or element field
+                MPI_Comm comm)               // MPI communicator
 {
+    if (timed_trial)
+    {
+        results::Run res = run_params;
+        res.op = field;
+        results::emit(comm, res, "project_time", times[PROJECT_TIME]);
+        results::emit(comm, res, "pointloc_time", times[POINTLOC_TIME]);
+        results::emit(comm, res, "interp_time", times[INTERP_TIME]);
+        results::emit(comm, res, "exch_time", times[EXCH_TIME]);
+    }
+
     int rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     if (rank == 0)
@@ -971,7 +989,7 @@ void ProjectField(Interface* mbi,
     rval = Project(mbi, mbc_rev, method, interpTag, gNormTag, ssNormTag,
                    ssTagNames, ssTagValues, roots, pcs[0], times, toler, num_iter, 1); ERR;
     GetTiming(-1, PROJECT_TIME, times, pcs[0]->comm());
-    PrintTimes(times, num_iter);
+    PrintTimes(times, num_iter, type == VERTEX_FIELD ? "vertex" : "element", pcs[0]->comm());
     // TODO: why is reverse direction error 0 for element field
     SummarizeField(type, roots, factor, mbi, pcs);
 }
@@ -1068,6 +1086,60 @@ void PrintFinalTimes(double* times)
     }
 }
 
+//
+// records the final times of the last trial in the results (collective over comm)
+//
+void EmitFinalTimes(double* times,
+                    MPI_Comm comm)
+{
+    results::emit(comm, run_params, "meshgen_time", times[MESHGEN_TIME]);
+    results::emit(comm, run_params, "init_time", times[INSTANT_TIME]);
+    results::emit(comm, run_params, "tot_project_time", times[TOT_PROJECT_TIME]);
+}
+
+//
+// couples the meshes for the warmup and timed trials of one run, prints the final times of every
+// trial, and records the statistics of the coupling time over the timed trials
+//
+void CouplingTrials(MPI_Comm *comms,
+                    int src_size,
+                    int trgt_size,
+                    int src_type,
+                    int trgt_type,
+                    int num_iter,
+                    int slab,
+                    double* times,
+                    int warmup,              // number of untimed trials
+                    int trials)              // number of timed trials
+{
+    int rank;
+    MPI_Comm_rank(comms[0], &rank);
+
+    stats::Samples samples;
+    for (int t = -warmup; t < trials; t++)
+    {
+        if (rank == 0 && (warmup || trials > 1))
+            fprintf(stderr, "------------- %s trial %d ------------------------\n",
+                    t < 0 ? "warmup" : "timed", t < 0 ? t + warmup : t);
+        timed_trial = (t >= 0);
+        GetTiming(-1, -1, times, comms[0]);
+        GetTiming(COUPLE_TIME, -1, times, comms[0]);
+        Coupling(comms, src_size, trgt_size, src_type, trgt_type, num_iter, slab, times);
+        GetTiming(-1, COUPLE_TIME, times, comms[0]);
+        if (rank == 0)
+            PrintFinalTimes(times);
+        if (t >= 0)
+            samples.add(times[COUPLE_TIME], comms[0]);
+    }
+    timed_trial = true;
+
+    results::emit(run_params, "couple_time", samples);
+    EmitFinalTimes(times, comms[0]);
+    char point[256];
+    sprintf(point, "procs %d size %d", run_params.procs, src_size);
+    stats::record(point, "couple_time", samples);
+}
+
 //
 // print mesh types and sizes
 //
@@ -1089,6 +1161,25 @@ void PrintMeshSizes(int src_type,
     }
 }
 
+//
+// sets the parameters of the current run for the results: one block per process, the source
+// mesh size as the number of elements, and the mesh types as the op
+//
+void SetRunParams(int groupsize,
+                  int src_type,
+                  int src_size,
+                  int trgt_type,
+                  int trgt_size)
+{
+    char op[64];
+    sprintf(op, "%s%d->%s%d", src_type ? "tet" : "hex", src_size,
+            trgt_type ? "tet" : "hex", trgt_size);
+    run_params.procs  = groupsize;
+    run_params.blocks = groupsize;
+    run_params.elems  = (long long)src_size * src_size * src_size;
+    run_params.op     = op;
+}
+
 //
 // parse arguments
 //
@@ -1103,7 +1194,10 @@ void ParseArgs(int argc,
                int *min_trgt_size,           // min target mesh size per side (size x size x size)
                int *max_trgt_size,           // max target mesh size per side (size x size x size)
                int *num_iter,                // number of iterations (simulating convergence)
-               int *slab)                    // "slabbiness" of blocking (0-3; best to worst case)
+               int *slab,                    // "slabbiness" of blocking (0-3; best to worst case)
+               std::string *out_file,        // machine-readable results (optional 9th argument)
+               int *warmup,                  // untimed trials per run (optional 10th argument)
+               int *trials)                  // timed trials per run (optional 11th argument)
 {
     char src_str[256], trgt_str[256]; // string versions of src and trgt types
 
@@ -1143,6 +1237,11 @@ void ParseArgs(int argc,
     *num_iter = atoi(argv[7]);
     *slab = atoi(argv[8]);
     assert(*slab >= 0 && *slab <= 3);
+    // "-" skips the results file when warmup and trials follow
+    if (argc > 9 && strcmp(argv[9], "-"))
+        *out_file = argv[9];
+    *warmup = (argc > 10) ? std::max(atoi(argv[10]), 0) : 0;
+    *trials = (argc > 11) ? std::max(atoi(argv[11]), 1) : 1;
 
     if (rank == 0)
     {
@@ -1154,12 +1253,13 @@ void ParseArgs(int argc,
                 "target size = from [%d x %d x %d] to [%d x %d x %d] "
                 "regular grid points (not cells); "
                 "number of iterations = %d; "
-                "slab = %d\n",
+                "slab = %d; warmup = %d; trials = %d\n",
                 *min_procs, *max_procs,
                 src_str, *min_src_size, *min_src_size, *min_src_size,
                 *max_src_size, *max_src_size, *max_src_size,
                 trgt_str, *min_trgt_size, *min_trgt_size, *min_trgt_size,
-                *max_trgt_size, *max_trgt_size, *max_trgt_size, *num_iter, *slab);
+                *max_trgt_size, *max_trgt_size, *max_trgt_size, *num_iter, *slab, *warmup,
+                *trials);
 
         // check min_procs max_procs relationships
         double lp2 = log2(*max_procs / *min_procs);         // log base 2 of procs
@@ -1191,6 +1291,8 @@ int main(int argc,
     int min_procs, max_procs; // number of MPI processes
     int rank, groupsize; // MPI usual for current communicator
     int slab; // "slabbiness" of blocking (0-3; best to worst case)
+    std::string out_file; // machine-readable results
+    int warmup, trials; // number of untimed and timed trials per run
 
     // init
     MPI_Init(&argc, &argv);
@@ -1199,7 +1301,13 @@ int main(int argc,
 
     // parse arguments
     ParseArgs(argc, argv, &min_procs, &max_procs, &src_type, &min_src_size, &max_src_size,
-              &trgt_type, &min_trgt_size, &max_trgt_size, &num_iter, &slab);
+              &trgt_type, &min_trgt_size, &max_trgt_size, &num_iter, &slab, &out_file,
+              &warmup, &trials);
+    if (!results::open(out_file))
+    {
+        fprintf(stderr, "Error: cannot write results to %s\n", out_file.c_str());
+        exit(1);
+    }
 
     // iterate over process counts and mesh size; 4 modes are possible:
     // 0. process count and mesh size both constant   -> single condition test
@@ -1258,11 +1366,9 @@ int main(int argc,
                 PrintMeshSizes(src_type, src_size, trgt_type, trgt_size);
 
                 // couple the meshes
-                GetTiming(COUPLE_TIME, -1, times, comms[0]);
-                Coupling(comms, src_size, trgt_size, src_type, trgt_type, num_iter, slab, times);
-                GetTiming(-1, COUPLE_TIME, times, comms[0]);
-                if (rank == 0)
-                    PrintFinalTimes(times);
+                SetRunParams(groupsize, src_type, src_size, trgt_type, trgt_size);
+                CouplingTrials(comms, src_size, trgt_size, src_type, trgt_type, num_iter, slab,
+                               times, warmup, trials);
                 src_size *= 2;
                 trgt_size *= 2;
             } // mesh size
@@ -1274,11 +1380,9 @@ int main(int argc,
             PrintMeshSizes(src_type, src_size, trgt_type, trgt_size);
 
             // couple the meshes
-            GetTiming(COUPLE_TIME, -1, times, comms[0]);
-            Coupling(comms, src_size, trgt_size, src_type, trgt_type, num_iter, slab, times);
-            GetTiming(-1, COUPLE_TIME, times, comms[0]);
-            if (rank == 0)
-                PrintFinalTimes(times);
+            SetRunParams(groupsize, src_type, src_size, trgt_type, trgt_size);
+            CouplingTrials(comms, src_size, trgt_size, src_type, trgt_type, num_iter, slab, times,
+                           warmup, trials);
             if (src_size < max_src_size)
             {
                 src_size *= 2;
@@ -1290,6 +1394,11 @@ int main(int argc,
         MPI_Comm_free(&comm);
     } // number of procs
 
+    // statistics over the trials
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0)
+        stats::print(warmup, trials);
+
     // cleanup
     MPI_Finalize();
 }
@@ -0,0 +1,95 @@
+//--------------------------------------------------------------------------
+//
+// command-line options and checks shared by the apps
+//
+// every app takes a results file and the warmup and timed trials of each run (run_options),
+// the apps with DIY reductions also take the per-round profile and trace (profile_options),
+// and every app that runs DIY with threads clamps them when DIY is built without threading
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_ARGS_H
+#define CIAN_ARGS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "opts.h"
+#include "timing.h"
+
+namespace args
+{
+
+//
+// results file, warmup trials, and timed trials of each run, with their defaults
+//
+// out_file: file for the machine-readable results (results.h), empty = none (output)
+// warmup: number of untimed trials before the timed ones of each run (output)
+// trials: number of timed trials of each run, summarized by their median (output)
+//
+inline void run_options(opts::Options& ops, std::string& out_file, int& warmup, int& trials)
+{
+    using namespace opts;
+    warmup = 0;
+    trials = 1;
+    ops >> Option('o', "output", out_file, "results file (JSON lines, or CSV if *.csv)");
+    ops >> Option('w', "warmup", warmup, "number of untimed trials per run")
+        >> Option('n', "trials", trials, "number of timed trials per run");
+}
+
+//
+// per-round profile table and trace events of the reductions (timing.h)
+//
+// trace_prefix: prefix of the trace files, empty = none (output)
+//
+inline void profile_options(opts::Options& ops, std::string& trace_prefix)
+{
+    using namespace opts;
+    timing::profile().table =
+        ops >> Present('f', "profile", "print the per-round profile of every run");
+    ops >> Option('e', "trace", trace_prefix, "write trace events to prefix.<rank>.json");
+}
+
+//
+// clamps the trials to at least 0 warmup and 1 timed trial
+//
+inline void check_trials(int& warmup, int& trials)
+{
+    if (warmup < 0)
+        warmup = 0;
+    if (trials < 1)
+        trials = 1;
+}
+
+//
+// clamps the number of threads to 1 when DIY is built without threading
+//
+inline void check_threads(int& num_threads, int rank)
+{
+#ifdef DIY_NO_THREADS
+    if (num_threads > 1)
+    {
+        if (rank == 0)
+            fprintf(stderr, "Warning: diy threading is disabled (configure with -Ddiy_thread=on), "
+                    "using 1 thread\n");
+        num_threads = 1;
+    }
+#endif
+}
+
+//
+// opens the trace file of this process if a prefix is given, exits on failure
+//
+inline void open_trace(const std::string& trace_prefix, int rank)
+{
+    if (!trace_prefix.empty() && !timing::open_trace(trace_prefix))
+    {
+        fprintf(stderr, "Error: cannot write trace events to %s.%d.json\n", trace_prefix.c_str(),
+                rank);
+        exit(1);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,228 @@
+//--------------------------------------------------------------------------
+//
+// radix-k schedules and a lookup table of the fastest schedule per run
+//
+// a schedule is the group size (k) of every round of a 1-d k-ary reduction over all the
+// blocks, e.g. 4 2 for 8 blocks; the apps' autotune mode runs every ordered factorization of
+// the number of blocks and records the fastest in a table (one CSV line per app, number of
+// processes, number of blocks, and number of elements), which later runs load to pick the
+// schedule instead of factoring target_k
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_AUTOTUNE_H
+#define CIAN_AUTOTUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <diy/partners/swap.hpp>
+#include <diy/partners/merge.hpp>
+
+namespace autotune
+{
+
+typedef std::vector<int> Schedule;           // group size of each round
+
+namespace detail
+{
+    // appends to res all the ordered factorizations of n into factors >= 2, after prefix
+    inline void factorizations(int n, Schedule& prefix, std::vector<Schedule>& res)
+    {
+        if (n == 1)
+        {
+            res.push_back(prefix);
+            return;
+        }
+        for (int k = 2; k <= n; ++k)
+            if (n % k == 0)
+            {
+                prefix.push_back(k);
+                factorizations(n / k, prefix, res);
+                prefix.pop_back();
+            }
+    }
+}
+
+// all the schedules of a reduction over nblocks (one empty schedule for a single block)
+inline void schedules(int nblocks, std::vector<Schedule>& res)
+{
+    Schedule prefix;
+    res.clear();
+    detail::factorizations(nblocks, prefix, res);
+}
+
+// the schedule that diy picks for a target k
+inline Schedule factor(int nblocks, int k)
+{
+    diy::RegularSwapPartners partners(1, nblocks, k);
+    Schedule s;
+    for (size_t i = 0; i < partners.kvs().size(); ++i)
+        s.push_back(partners.kvs()[i].size);
+    return s;
+}
+
+// largest group size of a schedule
+inline int max_k(const Schedule& s)
+{
+    int k = 1;
+    for (size_t i = 0; i < s.size(); ++i)
+        k = s[i] > k ? s[i] : k;
+    return k;
+}
+
+// e.g. "4x2", "1" for the empty schedule
+inline std::string name(const Schedule& s)
+{
+    if (s.empty())
+        return "1";
+    std::string res;
+    char buf[16];
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        sprintf(buf, i ? "x%d" : "%d", s[i]);
+        res += buf;
+    }
+    return res;
+}
+
+// inverse of name()
+inline Schedule parse(const std::string& str)
+{
+    Schedule s;
+    const char* p = str.c_str();
+    while (*p)
+    {
+        char* end;
+        int k = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        if (k > 1)
+            s.push_back(k);
+        p = (*end == 'x') ? end + 1 : end;
+    }
+    return s;
+}
+
+// 1-d swap or merge partners over nblocks with the group sizes of a schedule
+template<class Partners>
+Partners partners(int nblocks, const Schedule& s, bool contiguous = true)
+{
+    typename Partners::DivisionVector divs(1, nblocks);
+    typename Partners::KVSVector      kvs;
+    for (size_t i = 0; i < s.size(); ++i)
+        kvs.push_back(typename Partners::DimK(0, s[i]));
+    return Partners(divs, kvs, contiguous);
+}
+
+// fastest schedule of one run
+struct Entry
+{
+    Entry(): k(0), time(0)                                      {}
+
+    int         k;                           // target k that reproduces the run (alltoall)
+    Schedule    schedule;                    // group size of each round
+    double      time;                        // time of the run with this schedule
+};
+
+struct Table
+{
+    struct Key
+    {
+        Key(const std::string& app_, int procs_, int blocks_, int elems_):
+            app(app_), procs(procs_), blocks(blocks_), elems(elems_)     {}
+
+        bool    operator<(const Key& o) const
+            {
+                if (app    != o.app)    return app    < o.app;
+                if (procs  != o.procs)  return procs  < o.procs;
+                if (blocks != o.blocks) return blocks < o.blocks;
+                return elems < o.elems;
+            }
+
+        std::string app;
+        int         procs, blocks, elems;
+    };
+    typedef std::map<Key, Entry> Entries;
+
+    // records the entry of a run, replacing an older one
+    void    set(const std::string& app, int procs, int blocks, int elems, const Entry& e)
+        { entries[Key(app, procs, blocks, elems)] = e; }
+
+    // entry of the same app, processes, and blocks with the closest number of elements
+    // (ratio-wise); false if there is none
+    bool    find(const std::string& app, int procs, int blocks, int elems, Entry& e) const
+        {
+            bool found = false;
+            double best = 0;
+            for (Entries::const_iterator it = entries.begin(); it != entries.end(); ++it)
+            {
+                const Key& key = it->first;
+                if (key.app != app || key.procs != procs || key.blocks != blocks)
+                    continue;
+                double d = key.elems > elems ? (double)key.elems / elems :
+                    (double)elems / key.elems;
+                if (!found || d < best)
+                {
+                    found = true;
+                    best  = d;
+                    e     = it->second;
+                }
+            }
+            return found;
+        }
+
+    // reads a table written by save(), adding to the entries; false if the file can't be read
+    bool    load(const std::string& filename)
+        {
+            FILE* fd = fopen(filename.c_str(), "r");
+            if (!fd)
+                return false;
+            char line[256], app[64], sched[64];
+            Entry e;
+            int procs, blocks, elems;
+            while (fgets(line, sizeof(line), fd))
+            {
+                if (sscanf(line, "%63[^,],%d,%d,%d,%d,%63[^,],%lf", app, &procs, &blocks, &elems,
+                           &e.k, sched, &e.time) != 7)
+                    continue;                // header or malformed line
+                e.schedule = parse(sched);
+                set(app, procs, blocks, elems, e);
+            }
+            fclose(fd);
+            return true;
+        }
+
+    bool    save(const std::string& filename) const
+        {
+            FILE* fd = fopen(filename.c_str(), "w");
+            if (!fd)
+                return false;
+            fprintf(fd, "app,procs,blocks,elems,k,schedule,time\n");
+            for (Entries::const_iterator it = entries.begin(); it != entries.end(); ++it)
+                fprintf(fd, "%s,%d,%d,%d,%d,%s,%.6lf\n", it->first.app.c_str(), it->first.procs,
+                        it->first.blocks, it->first.elems, it->second.k,
+                        name(it->second.schedule).c_str(), it->second.time);
+            fclose(fd);
+            return true;
+        }
+
+    Entries     entries;
+};
+
+// schedule of a run that is not tuned: the table's, or diy's factorization of target_k if the
+// table has no entry for the run
+inline Schedule lookup(const Table& table, const std::string& app, int procs, int blocks,
+                       int elems, int target_k)
+{
+    Entry e;
+    if (table.find(app, procs, blocks, elems, e))
+        return e.schedule;
+    return factor(blocks, target_k);
+}
+
+}
+
+#endif
@@ -0,0 +1,800 @@
+//--------------------------------------------------------------------------
+//
+// collective MPI-IO of the blocks of a diy::Master, with MPI_Info hints
+//
+// diy::io::write_blocks and read_blocks open their file with the default MPI-IO settings;
+// write_blocks and read_blocks below write and read the same serialized blocks through a file
+// opened with given hints (e.g., cb_nodes, cb_buffer_size, romio_cb_write, striping_factor,
+// striping_unit), so that collective buffering and striping can be tuned without recompiling
+//
+// file layout: the blocks of every process, one process after the other, written with one
+// collective write, followed by a footer with the gid, offset, and size of every block (3
+// long longs per block, in gid order), the extra data passed by the writer (as the extra
+// footer data of diy::io), its size (1 long long), and the number of blocks (1 long long); a
+// reader reads the footer and then the range of the file that holds its blocks with one
+// collective read
+//
+// the blocks can also be split among several files in the same layout (Files): one file per
+// process, written and read with POSIX I/O, or one file per group of processes (subfiling), so
+// that large process counts do not all contend for a single shared file, and they can be
+// written in the background (AsyncWrite), and read through a memory map without copying the
+// blocks (map_blocks)
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_BLOCKIO_H
+#define CIAN_BLOCKIO_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <climits>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include "mpi.h"
+
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+
+namespace blockio
+{
+
+// one set of MPI_Info hints
+struct Hints
+{
+    Hints(): name("default")                                    {}
+
+    // parses key=value pairs separated by commas or white space; "default" is the empty set
+    bool    parse(const std::string& s)
+        {
+            values.clear();
+            name = "default";
+            std::string token;
+            for (size_t i = 0; i <= s.size(); ++i)
+            {
+                if (i < s.size() && s[i] != ',' && s[i] != ' ' && s[i] != '\t')
+                {
+                    token += s[i];
+                    continue;
+                }
+                if (token.empty() || token == "default")
+                {
+                    token.clear();
+                    continue;
+                }
+                size_t eq = token.find('=');
+                if (eq == std::string::npos || eq == 0 || eq == token.size() - 1)
+                    return false;
+                values.push_back(std::make_pair(token.substr(0, eq), token.substr(eq + 1)));
+                token.clear();
+            }
+            if (!values.empty())
+            {
+                name = values[0].first + "=" + values[0].second;
+                for (size_t i = 1; i < values.size(); ++i)
+                    name += "," + values[i].first + "=" + values[i].second;
+            }
+            return true;
+        }
+
+    // new MPI_Info with the hints, to be freed by the caller, or MPI_INFO_NULL if there are none
+    MPI_Info info() const
+        {
+            if (values.empty())
+                return MPI_INFO_NULL;
+            MPI_Info res;
+            MPI_Info_create(&res);
+            for (size_t i = 0; i < values.size(); ++i)
+                MPI_Info_set(res, (char*) values[i].first.c_str(),
+                             (char*) values[i].second.c_str());
+            return res;
+        }
+
+    std::string                                         name;   // e.g. "cb_nodes=4"
+    std::vector< std::pair<std::string, std::string> >  values; // keys and values
+};
+
+// appends the hint sets of a file, one set per line; empty lines and lines starting with # are
+// skipped
+inline bool read_hints(const std::string& filename, std::vector<Hints>& sets)
+{
+    FILE* fd = fopen(filename.c_str(), "r");
+    if (!fd)
+        return false;
+    char line[1024];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fd))
+    {
+        std::string s(line);
+        s.erase(std::remove(s.begin(), s.end(), '\n'), s.end());
+        s.erase(std::remove(s.begin(), s.end(), '\r'), s.end());
+        size_t first = s.find_first_not_of(" \t");
+        if (first == std::string::npos || s[first] == '#')
+            continue;
+        Hints h;
+        ok = h.parse(s);
+        if (ok)
+            sets.push_back(h);
+    }
+    fclose(fd);
+    return ok;
+}
+
+// footer entry of one block
+struct Entry
+{
+    long long   gid;
+    long long   offset;                      // from the start of the file
+    long long   size;                        // bytes
+};
+
+inline bool operator<(const Entry& x, const Entry& y)                  { return x.gid < y.gid; }
+
+// the serialized local blocks of a process
+struct Blocks
+{
+    std::vector<Entry>          entries;     // offsets from the start of data
+    diy::MemoryBuffer           data;
+    diy::Master::SaveBlock      save;
+};
+
+// foreach callback appending a block to Blocks (args)
+inline void serialize_block(void* b, const diy::Master::ProxyWithLink& cp, void* args)
+{
+    Blocks* blocks = static_cast<Blocks*>(args);
+    Entry e;
+    e.gid    = cp.gid();
+    e.offset = blocks->data.size();
+    blocks->save(b, blocks->data);
+    e.size   = blocks->data.size() - e.offset;
+    blocks->entries.push_back(e);
+}
+
+// the files of a set of blocks and the processes that share each one: one shared file for all
+// the processes of comm (procs_per_file = 0), one file per process, written and read with POSIX
+// pwrite and pread (procs_per_file = 1), or one MPI-IO file per group of procs_per_file
+// consecutive ranks of comm (subfiling); file k of filename is named filename.k
+struct Files
+{
+    // collective over comm
+    Files(MPI_Comm comm_, int procs_per_file_):
+        comm(comm_), group(comm_), procs_per_file(std::max(procs_per_file_, 0)), file(0)
+        {
+            if (!procs_per_file)
+                return;
+            int rank;
+            MPI_Comm_rank(comm, &rank);
+            file = rank / procs_per_file;
+            MPI_Comm_split(comm, file, rank, &group);
+        }
+    ~Files()
+        {
+            if (procs_per_file)
+                MPI_Comm_free(&group);
+        }
+
+    bool        posix() const                                   { return procs_per_file == 1; }
+
+    // name of the file of this process
+    std::string name(const std::string& filename) const
+        {
+            if (!procs_per_file)
+                return filename;
+            char k[16];
+            sprintf(k, ".%d", file);
+            return filename + k;
+        }
+
+    // e.g. "shared", "file-per-process", "subfiles-8"
+    std::string layout() const
+        {
+            if (!procs_per_file)
+                return "shared";
+            if (posix())
+                return "file-per-process";
+            char s[32];
+            sprintf(s, "subfiles-%d", procs_per_file);
+            return s;
+        }
+
+    MPI_Comm    comm;                        // all the processes
+    MPI_Comm    group;                       // processes sharing the file of this process
+    int         procs_per_file;              // 0 = all
+    int         file;                        // file of this process
+
+private:
+                Files(const Files&);
+    Files&      operator=(const Files&);
+};
+
+// the file of a process, opened by its group with MPI-IO, or by the process alone with POSIX
+// I/O; offsets and sizes are in bytes, and MPI-IO transfers are limited to INT_MAX bytes
+struct File
+{
+    File(const Files& files_): files(files_), fd(-1), fh(MPI_FILE_NULL)   {}
+    ~File()                                                     { close(); }
+
+    // collective over the group
+    bool    open(const std::string& filename, bool write, MPI_Info info)
+        {
+            std::string name = files.name(filename);
+            if (files.posix())
+            {
+                fd = write ? ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) :
+                    ::open(name.c_str(), O_RDONLY);
+                return fd >= 0;
+            }
+            int mode = write ? MPI_MODE_WRONLY | MPI_MODE_CREATE : MPI_MODE_RDONLY;
+            if (MPI_File_open(files.group, (char*) name.c_str(), mode, info, &fh) != MPI_SUCCESS)
+            {
+                fh = MPI_FILE_NULL;
+                return false;
+            }
+            if (write)
+                MPI_File_set_size(fh, 0);
+            return true;
+        }
+
+    // collective over the group
+    void    close()
+        {
+            if (fd >= 0)
+                ::close(fd);
+            if (fh != MPI_FILE_NULL)
+                MPI_File_close(&fh);
+            fd = -1;
+            fh = MPI_FILE_NULL;
+        }
+
+    long long size()
+        {
+            if (files.posix())
+            {
+                struct stat st;
+                return fstat(fd, &st) ? -1 : (long long) st.st_size;
+            }
+            MPI_Offset size;
+            return MPI_File_get_size(fh, &size) == MPI_SUCCESS ? (long long) size : -1;
+        }
+
+    // collective over the group
+    bool    write_at_all(long long offset, const void* data, long long size)
+        {
+            if (files.posix())
+                return write_at(offset, data, size);
+            bool ok = size <= INT_MAX;
+            return MPI_File_write_at_all(fh, offset, ok && size ? (void*) data : NULL,
+                                         ok ? (int) size : 0, MPI_BYTE, MPI_STATUS_IGNORE) ==
+                MPI_SUCCESS && ok;
+        }
+
+    // collective over the group
+    bool    read_at_all(long long offset, void* data, long long size)
+        {
+            if (files.posix())
+                return read_at(offset, data, size);
+            bool ok = size <= INT_MAX;
+            return MPI_File_read_at_all(fh, offset, ok && size ? data : NULL,
+                                        ok ? (int) size : 0, MPI_BYTE, MPI_STATUS_IGNORE) ==
+                MPI_SUCCESS && ok;
+        }
+
+    bool    write_at(long long offset, const void* data, long long size)
+        {
+            if (!files.posix())
+                return size <= INT_MAX &&
+                    MPI_File_write_at(fh, offset, (void*) data, (int) size, MPI_BYTE,
+                                      MPI_STATUS_IGNORE) == MPI_SUCCESS;
+            const char* p = static_cast<const char*>(data);
+            while (size > 0)
+            {
+                ssize_t n = pwrite(fd, p, size, offset);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                p      += n;
+                offset += n;
+                size   -= n;
+            }
+            return true;
+        }
+
+    bool    read_at(long long offset, void* data, long long size)
+        {
+            if (!files.posix())
+                return size <= INT_MAX &&
+                    MPI_File_read_at(fh, offset, data, (int) size, MPI_BYTE,
+                                     MPI_STATUS_IGNORE) == MPI_SUCCESS;
+            char* p = static_cast<char*>(data);
+            while (size > 0)
+            {
+                ssize_t n = pread(fd, p, size, offset);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)                      // error or end of file
+                    return false;
+                p      += n;
+                offset += n;
+                size   -= n;
+            }
+            return true;
+        }
+
+    const Files&    files;
+    int             fd;                      // POSIX
+    MPI_File        fh;                      // MPI-IO
+
+private:
+                File(const File&);
+    File&       operator=(const File&);
+};
+
+// opens the file of this process in every group; false on all the processes if any file cannot
+// be opened (collective over files.comm)
+inline bool open_all(File& file, const std::string& filename, bool write, MPI_Info info)
+{
+    int ok = file.open(filename, write, info), all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, file.files.comm);
+    return all_ok;
+}
+
+// the serialized local blocks of a process, placed in the file of its group
+struct Staging
+{
+    Blocks              blocks;
+    long long           offset;              // of the local blocks in the file
+    long long           end;                 // of the blocks of all the processes of the file
+    std::vector<Entry>  table;               // all the blocks of the file (rank 0 of the group)
+};
+
+// serializes the blocks of master with save into staging and places them in the file of the
+// group (collective over files.group)
+inline void stage_blocks(const Files& files, diy::Master& master, diy::Master::SaveBlock save,
+                         Staging& staging)
+{
+    int rank, groupsize;
+    MPI_Comm_rank(files.group, &rank);
+    MPI_Comm_size(files.group, &groupsize);
+
+    Blocks& blocks = staging.blocks;
+    blocks.save = save;
+    master.foreach(&serialize_block, &blocks);
+
+    // offset of the blocks of this process in its file, and end of all the blocks of the file
+    long long local = blocks.data.size();
+    staging.offset = 0;
+    MPI_Exscan(&local, &staging.offset, 1, MPI_LONG_LONG, MPI_SUM, files.group);
+    if (rank == 0)
+        staging.offset = 0;
+    MPI_Allreduce(&local, &staging.end, 1, MPI_LONG_LONG, MPI_SUM, files.group);
+    for (size_t i = 0; i < blocks.entries.size(); ++i)
+        blocks.entries[i].offset += staging.offset;
+
+    // footer, gathered on rank 0 of the group
+    int n = blocks.entries.size() * 3;
+    std::vector<int> counts(groupsize), displs(groupsize + 1, 0);
+    MPI_Gather(&n, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, files.group);
+    for (int i = 0; i < groupsize; ++i)
+        displs[i + 1] = displs[i] + counts[i];
+    std::vector<Entry>& table = staging.table;
+    table.resize(displs[groupsize] / 3 + 1);
+    MPI_Gatherv(n ? &blocks.entries[0] : NULL, n, MPI_LONG_LONG, &table[0], &counts[0],
+                &displs[0], MPI_LONG_LONG, 0, files.group);
+    table.pop_back();
+    std::sort(table.begin(), table.end());
+}
+
+// writes the footer of a file after its blocks, on rank 0 of the group
+inline bool write_footer(File& file, const Staging& staging, const diy::MemoryBuffer& extra)
+{
+    int rank;
+    MPI_Comm_rank(file.files.group, &rank);
+    if (rank != 0)
+        return true;
+
+    long long nblocks = staging.table.size();
+    long long footer[2] = { (long long) extra.buffer.size(), nblocks };
+    long long pos = staging.end;
+    bool ok = !nblocks || file.write_at(pos, &staging.table[0], nblocks * sizeof(Entry));
+    pos += nblocks * sizeof(Entry);
+    ok = ok && (extra.buffer.empty() ||
+                file.write_at(pos, &extra.buffer[0], extra.buffer.size()));
+    pos += extra.buffer.size();
+    return ok && file.write_at(pos, footer, sizeof(footer));
+}
+
+// writes the blocks of master with save into files, and the extra data of rank 0 of each group
+// in the footer of its file (collective over files.comm)
+inline bool write_blocks(const std::string& filename, const Files& files, diy::Master& master,
+                         const diy::MemoryBuffer& extra, diy::Master::SaveBlock save,
+                         MPI_Info info)
+{
+    Staging staging;
+    stage_blocks(files, master, save, staging);
+
+    File file(files);
+    if (!open_all(file, filename, true, info))
+        return false;
+    const diy::MemoryBuffer& data = staging.blocks.data;
+    int ok = file.write_at_all(staging.offset, data.size() ? &data.buffer[0] : NULL,
+                               data.size());
+    ok = write_footer(file, staging, extra) && ok;
+    file.close();
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, files.comm);
+    return all_ok;
+}
+
+// a write of the blocks of a master in the background, e.g. a checkpoint that must not stall
+// the computation: start() snapshots the blocks into a staging buffer, starts writing it, and
+// returns; the caller computes meanwhile, calling test() now and then so that MPI can progress
+// the write, and then finish() waits for the data and writes the footer (same files as
+// write_blocks)
+//
+// MPI-IO files are written with MPI_File_iwrite_at_all (MPI 3.1, otherwise the independent
+// MPI_File_iwrite_at), and POSIX files by a dedicated I/O thread
+struct AsyncWrite
+{
+    AsyncWrite(const Files& files):
+        file(files), req(MPI_REQUEST_NULL), opened(false), started(false), done(0), ok(1)
+        { pthread_mutex_init(&mutex, NULL); }
+    ~AsyncWrite()
+        {
+            if (started)
+                pthread_join(thread, NULL);
+            if (req != MPI_REQUEST_NULL)
+                MPI_Wait(&req, MPI_STATUS_IGNORE);
+            pthread_mutex_destroy(&mutex);
+        }
+
+    // collective over files.comm
+    bool    start(const std::string& filename, diy::Master& master,
+                  const diy::MemoryBuffer& extra_, diy::Master::SaveBlock save, MPI_Info info)
+        {
+            stage_blocks(file.files, master, save, staging);
+            extra.buffer = extra_.buffer;
+            opened = open_all(file, filename, true, info);
+            if (!opened)
+                return false;
+
+            long long size = staging.blocks.data.size();
+            void* data = size ? &staging.blocks.data.buffer[0] : NULL;
+            if (file.files.posix())
+            {
+                started = pthread_create(&thread, NULL, &AsyncWrite::run, this) == 0;
+                if (!started)                // write in the foreground instead
+                {
+                    ok   = file.write_at(staging.offset, data, size);
+                    done = 1;
+                }
+                return true;
+            }
+            bool fits = size <= INT_MAX;
+#if MPI_VERSION > 3 || (MPI_VERSION == 3 && MPI_SUBVERSION >= 1)
+            ok = MPI_File_iwrite_at_all(file.fh, staging.offset, fits ? data : NULL,
+                                        fits ? (int) size : 0, MPI_BYTE, &req) ==
+                MPI_SUCCESS && fits;
+#else
+            ok = MPI_File_iwrite_at(file.fh, staging.offset, fits ? data : NULL,
+                                    fits ? (int) size : 0, MPI_BYTE, &req) == MPI_SUCCESS && fits;
+#endif
+            return true;
+        }
+
+    // whether the blocks of this process are written
+    bool    test()
+        {
+            if (file.files.posix())
+            {
+                pthread_mutex_lock(&mutex);
+                bool res = done;
+                pthread_mutex_unlock(&mutex);
+                return res;
+            }
+            if (req == MPI_REQUEST_NULL)
+                return true;
+            int flag;
+            MPI_Test(&req, &flag, MPI_STATUS_IGNORE);
+            return flag;
+        }
+
+    // collective over files.comm
+    bool    finish()
+        {
+            if (!opened)
+                return false;
+            if (started)
+                pthread_join(thread, NULL);
+            started = false;
+            if (req != MPI_REQUEST_NULL)
+                ok = MPI_Wait(&req, MPI_STATUS_IGNORE) == MPI_SUCCESS && ok;
+            ok = write_footer(file, staging, extra) && ok;
+            file.close();
+            opened = false;
+            int all_ok;
+            MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, file.files.comm);
+            return all_ok;
+        }
+
+    File                file;
+    Staging             staging;             // snapshot of the blocks
+    diy::MemoryBuffer   extra;
+    MPI_Request         req;                 // MPI-IO
+    pthread_t           thread;              // POSIX
+    pthread_mutex_t     mutex;               // protects done and ok while the thread runs
+    bool                opened;
+    bool                started;             // thread
+    int                 done;                // thread
+    int                 ok;
+
+private:
+    // I/O thread
+    static void*        run(void* self_)
+        {
+            AsyncWrite* self = static_cast<AsyncWrite*>(self_);
+            const diy::MemoryBuffer& data = self->staging.blocks.data;
+            bool res = self->file.write_at(self->staging.offset,
+                                           data.size() ? &data.buffer[0] : NULL, data.size());
+            pthread_mutex_lock(&self->mutex);
+            self->ok   = self->ok && res;
+            self->done = 1;
+            pthread_mutex_unlock(&self->mutex);
+            return NULL;
+        }
+
+                        AsyncWrite(const AsyncWrite&);
+    AsyncWrite&         operator=(const AsyncWrite&);
+};
+
+// reads the footer of a file (File or Mapping): the table of its blocks, resized to one more
+// than their number, and the extra data; returns the number of blocks, or -1 if the footer
+// cannot be read
+template<class F>
+long long read_footer(F& file, std::vector<Entry>& table, diy::MemoryBuffer& extra)
+{
+    long long footer[2] = { 0, -1 };         // size of the extra data, number of blocks
+    long long size = file.size(), pos = 0;
+    if (size >= (long long) sizeof(footer))
+    {
+        pos = size - sizeof(footer);
+        if (!file.read_at(pos, footer, sizeof(footer)))
+            return -1;
+    }
+    if (footer[0] < 0 || footer[1] < 0 ||
+        footer[0] + footer[1] * (long long) sizeof(Entry) > pos)
+        return -1;
+    pos -= footer[0];
+    extra.buffer.resize(footer[0]);
+    extra.reset();
+    if (footer[0] && !file.read_at(pos, &extra.buffer[0], footer[0]))
+        return -1;
+    pos -= footer[1] * sizeof(Entry);
+    table.resize(footer[1] + 1);
+    if (footer[1] > 0 && !file.read_at(pos, &table[0], footer[1] * sizeof(Entry)))
+        return -1;
+    return footer[1];
+}
+
+// sets the number of blocks of assigner to the total of the files, and finds the blocks that it
+// assigns to this process in the table of the nblocks blocks of its file; false if one is
+// missing (collective over files.comm)
+inline bool find_blocks(const Files& files, long long nblocks, const std::vector<Entry>& table,
+                        diy::ContiguousAssigner& assigner, std::vector<int>& gids,
+                        std::vector<Entry>& entries)
+{
+    int rank, comm_rank;
+    MPI_Comm_rank(files.group, &rank);
+    MPI_Comm_rank(files.comm, &comm_rank);
+    long long file_blocks = rank == 0 ? nblocks : 0, tot_blocks;
+    MPI_Allreduce(&file_blocks, &tot_blocks, 1, MPI_LONG_LONG, MPI_SUM, files.comm);
+
+    assigner.set_nblocks(tot_blocks);
+    gids.clear();
+    assigner.local_gids(comm_rank, gids);
+    entries.resize(gids.size());
+    for (size_t i = 0; i < gids.size(); ++i)
+    {
+        Entry key;
+        key.gid = gids[i];
+        std::vector<Entry>::const_iterator it = std::lower_bound(table.begin(),
+                                                                 table.begin() + nblocks, key);
+        if (it == table.begin() + nblocks || it->gid != gids[i])
+            return false;
+        entries[i] = *it;
+    }
+    return true;
+}
+
+// reads the blocks assigned to this process by assigner, whose number of blocks is set from the
+// files, into master with load, and the extra data of the footer of the file of this process
+// (collective over files.comm); the blocks of a process must be in its file, i.e., files must be
+// read with the layout and, unless they are shared, the number of processes they were written
+// with
+inline bool read_blocks(const std::string& filename, const Files& files,
+                        diy::ContiguousAssigner& assigner, diy::Master& master,
+                        diy::MemoryBuffer& extra, diy::Master::LoadBlock load, MPI_Info info)
+{
+    int rank;
+    MPI_Comm_rank(files.group, &rank);
+
+    File file(files);
+    if (!open_all(file, filename, false, info))
+        return false;
+
+    // footer, read by rank 0 of the group
+    long long footer[2] = { 0, -1 };         // size of the extra data, number of blocks
+    std::vector<Entry> table;
+    extra.buffer.clear();
+    extra.reset();
+    if (rank == 0)
+    {
+        footer[1] = read_footer(file, table, extra);
+        footer[0] = extra.buffer.size();
+    }
+    MPI_Bcast(footer, 2, MPI_LONG_LONG, 0, files.group);
+    long long nblocks = footer[1];
+    int ok = nblocks >= 0, all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, files.comm);
+    if (!all_ok)
+        return false;
+    table.resize(nblocks + 1);
+    MPI_Bcast(&table[0], 3 * nblocks, MPI_LONG_LONG, 0, files.group);
+    extra.buffer.resize(footer[0]);
+    if (footer[0])
+        MPI_Bcast(&extra.buffer[0], footer[0], MPI_BYTE, 0, files.group);
+
+    // range of the file that holds the blocks of this process
+    std::vector<int> gids;
+    std::vector<Entry> entries;
+    ok = find_blocks(files, nblocks, table, assigner, gids, entries);
+    long long lo = 0, hi = 0;
+    for (size_t i = 0; ok && i < entries.size(); ++i)
+    {
+        lo = i ? std::min(lo, entries[i].offset) : entries[i].offset;
+        hi = std::max(hi, entries[i].offset + entries[i].size);
+    }
+
+    diy::MemoryBuffer data;
+    data.buffer.resize(ok ? hi - lo : 0);
+    ok = file.read_at_all(lo, data.buffer.empty() ? NULL : &data.buffer[0],
+                          data.buffer.size()) && ok;
+    file.close();
+
+    for (size_t i = 0; ok && i < gids.size(); ++i)
+    {
+        const Entry& e = entries[i];
+        diy::MemoryBuffer bb;
+        bb.buffer.assign(data.buffer.begin() + (e.offset - lo),
+                         data.buffer.begin() + (e.offset - lo + e.size));
+        bb.reset();
+        void* b = master.create();
+        load(b, bb);
+        master.add(gids[i], b, new diy::Link);
+    }
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, files.comm);
+    return all_ok;
+}
+
+// read-only memory map of the file of a process (POSIX), whose pages are read from the file
+// when they are first accessed
+struct Mapping
+{
+    Mapping(): addr(NULL), bytes(0)                             {}
+    ~Mapping()                                                  { unmap(); }
+
+    bool        map(const std::string& name)
+        {
+            unmap();
+            int fd = ::open(name.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            bool ok = !fstat(fd, &st) && st.st_size > 0;
+            void* a = ok ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            ::close(fd);                     // the mapping keeps the file
+            if (a == MAP_FAILED)
+                return false;
+            addr  = static_cast<const char*>(a);
+            bytes = st.st_size;
+            return true;
+        }
+    void        unmap()
+        {
+            if (addr)
+                munmap(const_cast<char*>(addr), bytes);
+            addr  = NULL;
+            bytes = 0;
+        }
+
+    // same interface as File, for read_footer
+    long long   size() const                                    { return bytes; }
+    bool        read_at(long long offset, void* data, long long size) const
+        {
+            if (offset < 0 || offset + size > (long long) bytes)
+                return false;
+            memcpy(data, addr + offset, size);
+            return true;
+        }
+
+    const char* addr;
+    size_t      bytes;
+
+private:
+                Mapping(const Mapping&);
+    Mapping&    operator=(const Mapping&);
+};
+
+// drops the cached pages of the file of this process, so that they are read from storage
+// again when it is next read or mapped (collective over files.comm); false if some process
+// could not drop them
+inline bool drop_cache(const std::string& filename, const Files& files)
+{
+    int fd = ::open(files.name(filename).c_str(), O_RDONLY);
+    int ok = fd >= 0 && !fdatasync(fd) && !posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (fd >= 0)
+        ::close(fd);
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, files.comm);
+    return all_ok;
+}
+
+// constructs block b from the serialized bytes of a block in a mapping, pointing into them
+// instead of copying them; false if it cannot
+typedef bool (*ViewBlock)(void* b, const char* data, size_t size);
+
+// maps the file of this process and adds to master the blocks assigned to this process by
+// assigner, whose number of blocks is set from the files, constructed with view, and reads the
+// extra data of the footer (collective over files.comm); the blocks point into mapping, which
+// must outlive them; the same files as read_blocks
+inline bool map_blocks(const std::string& filename, const Files& files,
+                       diy::ContiguousAssigner& assigner, diy::Master& master,
+                       diy::MemoryBuffer& extra, ViewBlock view, Mapping& mapping)
+{
+    std::vector<Entry> table;
+    long long nblocks = mapping.map(files.name(filename)) ?
+        read_footer(mapping, table, extra) : -1;
+    int ok = nblocks >= 0, all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, files.comm);
+    if (!all_ok)
+        return false;
+
+    std::vector<int> gids;
+    std::vector<Entry> entries;
+    ok = find_blocks(files, nblocks, table, assigner, gids, entries);
+    for (size_t i = 0; ok && i < gids.size(); ++i)
+    {
+        void* b = master.create();
+        ok = view(b, mapping.addr + entries[i].offset, entries[i].size);
+        master.add(gids[i], b, new diy::Link);
+    }
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, files.comm);
+    return all_ok;
+}
+
+// same as above, with one shared file for all the processes of comm
+inline bool write_blocks(const std::string& filename, MPI_Comm comm, diy::Master& master,
+                         const diy::MemoryBuffer& extra, diy::Master::SaveBlock save,
+                         MPI_Info info)
+{
+    Files files(comm, 0);
+    return write_blocks(filename, files, master, extra, save, info);
+}
+
+inline bool read_blocks(const std::string& filename, MPI_Comm comm,
+                        diy::ContiguousAssigner& assigner, diy::Master& master,
+                        diy::MemoryBuffer& extra, diy::Master::LoadBlock load, MPI_Info info)
+{
+    Files files(comm, 0);
+    return read_blocks(filename, files, assigner, master, extra, load, info);
+}
+
+}
+
+#endif
@@ -0,0 +1,264 @@
+//--------------------------------------------------------------------------
+//
+// compression of the float values of blocks, for serializing them to files
+//
+// the values are split into chunks that are compressed independently, in parallel by the
+// OpenMP threads, and stored after a codec tag so that a reader needs no setting:
+//
+//   zlib:      deflate of the raw bytes
+//   shuffle:   byte shuffle (the first bytes of all the values of a chunk, then the second
+//              bytes, ...), which groups the slowly varying sign and exponent bytes of smooth
+//              data, followed by a fast deflate (level 1, run-length matches only)
+//
+// the apps call save() and load() from their block serialization, which accounts the bytes
+// and time in stats(), so that the compression ratio and codec throughput can be reported
+// separately from the I/O time
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_CODEC_H
+#define CIAN_CODEC_H
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "mpi.h"
+
+#ifndef CIAN_NO_ZLIB
+#include <zlib.h>
+#endif
+
+#include <diy/serialization.hpp>
+
+#include "timing.h"
+
+namespace codec
+{
+
+enum
+{
+    none,
+    zlib,
+    shuffle
+};
+
+// values per chunk
+const size_t chunk = 65536;
+
+// codec named s, or -1 if unknown or not built
+inline int parse(const std::string& s)
+{
+    if (s == "none")
+        return none;
+#ifndef CIAN_NO_ZLIB
+    if (s == "zlib")
+        return zlib;
+    if (s == "shuffle")
+        return shuffle;
+#endif
+    return -1;
+}
+
+inline const char* name(int c)
+{
+    return c == zlib ? "zlib" : c == shuffle ? "shuffle" : "none";
+}
+
+// totals for one run
+struct Totals
+{
+    Totals(): raw(0), packed(0), time_out(0), time_in(0), errors(0)   {}
+
+    double  raw;                             // bytes of values compressed or decompressed
+    double  packed;                          // their compressed bytes
+    double  time_out;                        // time spent compressing
+    double  time_in;                         // time spent decompressing
+    int     errors;                          // chunks that could not be decompressed
+
+    double  ratio() const                   { return packed > 0 ? raw / packed : 1.0; }
+};
+
+struct Stats
+{
+    void    reset()
+        {
+            timing::Lock l(mutex);
+            local = Totals();
+        }
+    void    compressed(size_t raw, size_t packed, double time)
+        {
+            timing::Lock l(mutex);
+            local.raw      += raw;
+            local.packed   += packed;
+            local.time_out += time;
+        }
+    void    decompressed(size_t raw, size_t packed, double time, int errors)
+        {
+            timing::Lock l(mutex);
+            local.raw     += raw;
+            local.packed  += packed;
+            local.time_in += time;
+            local.errors  += errors;
+        }
+
+    // bytes and errors summed and times maximized over the processes in comm, result valid on
+    // all the processes
+    Totals  reduce(MPI_Comm comm)
+        {
+            double sums[3] = { local.raw, local.packed, (double) local.errors };
+            double times[2] = { local.time_out, local.time_in };
+            double tot_sums[3], max_times[2];
+            MPI_Allreduce(sums, tot_sums, 3, MPI_DOUBLE, MPI_SUM, comm);
+            MPI_Allreduce(times, max_times, 2, MPI_DOUBLE, MPI_MAX, comm);
+            Totals res;
+            res.raw      = tot_sums[0];
+            res.packed   = tot_sums[1];
+            res.errors   = (int) tot_sums[2];
+            res.time_out = max_times[0];
+            res.time_in  = max_times[1];
+            return res;
+        }
+
+    Totals          local;
+    timing::Mutex   mutex;
+};
+
+inline Stats& stats()
+{
+    static Stats stats_;
+    return stats_;
+}
+
+#ifndef CIAN_NO_ZLIB
+
+// compresses n values of a chunk into out
+inline void compress_chunk(const float* v, size_t n, int c, std::vector<unsigned char>& out)
+{
+    const unsigned char* src = reinterpret_cast<const unsigned char*>(v);
+    size_t bytes = n * sizeof(float);
+    std::vector<unsigned char> shuffled;
+    if (c == shuffle)
+    {
+        shuffled.resize(bytes);
+        for (size_t j = 0; j < sizeof(float); ++j)
+            for (size_t i = 0; i < n; ++i)
+                shuffled[j * n + i] = src[i * sizeof(float) + j];
+        src = &shuffled[0];
+    }
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (c == shuffle)
+        deflateInit2(&z, Z_BEST_SPEED, Z_DEFLATED, 15, 8, Z_RLE);
+    else
+        deflateInit(&z, Z_DEFAULT_COMPRESSION);
+    out.resize(deflateBound(&z, bytes));
+    z.next_in   = const_cast<unsigned char*>(src);
+    z.avail_in  = bytes;
+    z.next_out  = &out[0];
+    z.avail_out = out.size();
+    deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+}
+
+// decompresses the n values of a chunk from in; false if the data are corrupt
+inline bool decompress_chunk(const unsigned char* in, size_t size, int c, float* v, size_t n)
+{
+    size_t bytes = n * sizeof(float);
+    std::vector<unsigned char> shuffled(c == shuffle ? bytes : 0);
+    unsigned char* dst = c == shuffle ? &shuffled[0] : reinterpret_cast<unsigned char*>(v);
+    uLongf len = bytes;
+    if (uncompress(dst, &len, in, size) != Z_OK || len != bytes)
+        return false;
+    if (c == shuffle)
+    {
+        unsigned char* out = reinterpret_cast<unsigned char*>(v);
+        for (size_t j = 0; j < sizeof(float); ++j)
+            for (size_t i = 0; i < n; ++i)
+                out[i * sizeof(float) + j] = shuffled[j * n + i];
+    }
+    return true;
+}
+
+#endif
+
+// serializes values with codec c: the codec, then, uncompressed, the vector as diy::save does,
+// or the number of values followed by the size and bytes of each compressed chunk
+inline void save(diy::BinaryBuffer& bb, const std::vector<float>& v, int c)
+{
+#ifdef CIAN_NO_ZLIB
+    c = none;
+#endif
+    diy::save(bb, c);
+    if (c == none)
+    {
+        diy::save(bb, v);
+        return;
+    }
+#ifndef CIAN_NO_ZLIB
+    double t0 = MPI_Wtime();
+    size_t n = v.size();
+    diy::save(bb, n);
+    long long nchunks = (n + chunk - 1) / chunk;
+    std::vector< std::vector<unsigned char> > out(nchunks);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (long long k = 0; k < nchunks; ++k)
+        compress_chunk(&v[k * chunk], std::min(chunk, n - (size_t) k * chunk), c, out[k]);
+    size_t packed = 0;
+    for (long long k = 0; k < nchunks; ++k)
+    {
+        size_t size = out[k].size();
+        diy::save(bb, size);
+        bb.save_binary((const char*) &out[k][0], size);
+        packed += size;
+    }
+    stats().compressed(n * sizeof(float), packed, MPI_Wtime() - t0);
+#endif
+}
+
+inline void load(diy::BinaryBuffer& bb, std::vector<float>& v)
+{
+    int c;
+    diy::load(bb, c);
+    if (c == none)
+    {
+        diy::load(bb, v);
+        return;
+    }
+#ifndef CIAN_NO_ZLIB
+    double t0 = MPI_Wtime();
+    size_t n;
+    diy::load(bb, n);
+    v.resize(n);
+    long long nchunks = (n + chunk - 1) / chunk;
+    std::vector< std::vector<unsigned char> > in(nchunks);
+    size_t packed = 0;
+    for (long long k = 0; k < nchunks; ++k)
+    {
+        size_t size;
+        diy::load(bb, size);
+        in[k].resize(size);
+        if (size)
+            bb.load_binary((char*) &in[k][0], size);
+        packed += size;
+    }
+    int errors = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:errors)
+#endif
+    for (long long k = 0; k < nchunks; ++k)
+        if (in[k].empty() || !decompress_chunk(&in[k][0], in[k].size(), c, &v[k * chunk],
+                              std::min(chunk, n - (size_t) k * chunk)))
+            errors++;
+    stats().decompressed(n * sizeof(float), packed, MPI_Wtime() - t0, errors);
+#else
+    stats().decompressed(0, 0, 0.0, 1);
+#endif
+}
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+//--------------------------------------------------------------------------
+//
+// "over" operator for image compositing of RGBA float pixels
+//
+// header-only; the SSE, AVX2, and AVX-512 paths are compiled with function-level target
+// attributes and selected at runtime from the cpu features, so no special compiler flags
+// are needed
+//
+// all paths evaluate out = front + back * (1 - front.a) with a separate multiply and add
+// (no fused multiply-add), so the result is bitwise identical regardless of which path or
+// how many pixels per call are used, and the DIY and MPI reductions can be compared exactly
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_COMPOSITE_H
+#define CIAN_COMPOSITE_H
+
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CIAN_COMPOSITE_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+namespace composite
+{
+
+enum Isa { SCALAR, SSE, AVX2, AVX512 };
+
+// out = front over back, for n pixels; out may alias front or back
+typedef void (*Kernel)(const float* front, const float* back, float* out, size_t n);
+
+inline void over_scalar(const float* front, const float* back, float* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        float t = 1.0f - front[4 * i + 3];
+        out[4 * i    ] = front[4 * i    ] + back[4 * i    ] * t;
+        out[4 * i + 1] = front[4 * i + 1] + back[4 * i + 1] * t;
+        out[4 * i + 2] = front[4 * i + 2] + back[4 * i + 2] * t;
+        out[4 * i + 3] = front[4 * i + 3] + back[4 * i + 3] * t;
+    }
+}
+
+#ifdef CIAN_COMPOSITE_X86
+
+// one pixel per register
+__attribute__((target("sse")))
+inline void over_sse(const float* front, const float* back, float* out, size_t n)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (size_t i = 0; i < n; ++i)
+    {
+        __m128 f = _mm_loadu_ps(front + 4 * i);
+        __m128 b = _mm_loadu_ps(back  + 4 * i);
+        __m128 t = _mm_sub_ps(one, _mm_shuffle_ps(f, f, _MM_SHUFFLE(3, 3, 3, 3)));
+        _mm_storeu_ps(out + 4 * i, _mm_add_ps(f, _mm_mul_ps(b, t)));
+    }
+}
+
+// two pixels per register, alpha broadcast within each 128-bit lane
+__attribute__((target("avx2")))
+inline void over_avx2(const float* front, const float* back, float* out, size_t n)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m256 f = _mm256_loadu_ps(front + 4 * i);
+        __m256 b = _mm256_loadu_ps(back  + 4 * i);
+        __m256 t = _mm256_sub_ps(one, _mm256_permute_ps(f, _MM_SHUFFLE(3, 3, 3, 3)));
+        _mm256_storeu_ps(out + 4 * i, _mm256_add_ps(f, _mm256_mul_ps(b, t)));
+    }
+    if (i < n)
+        over_sse(front + 4 * i, back + 4 * i, out + 4 * i, n - i);
+}
+
+// four pixels per register, alpha broadcast within each 128-bit lane
+__attribute__((target("avx512f")))
+inline void over_avx512(const float* front, const float* back, float* out, size_t n)
+{
+    const __m512 one = _mm512_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m512 f = _mm512_loadu_ps(front + 4 * i);
+        __m512 b = _mm512_loadu_ps(back  + 4 * i);
+        __m512 t = _mm512_sub_ps(one, _mm512_shuffle_ps(f, f, _MM_SHUFFLE(3, 3, 3, 3)));
+        _mm512_storeu_ps(out + 4 * i, _mm512_add_ps(f, _mm512_mul_ps(b, t)));
+    }
+    if (i < n)
+        over_sse(front + 4 * i, back + 4 * i, out + 4 * i, n - i);
+}
+
+#endif
+
+// best instruction set supported by this cpu
+inline Isa detect()
+{
+#ifdef CIAN_COMPOSITE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+    if (__builtin_cpu_supports("sse"))
+        return SSE;
+#endif
+    return SCALAR;
+}
+
+inline Kernel kernel(Isa isa)
+{
+    switch (isa)
+    {
+#ifdef CIAN_COMPOSITE_X86
+    case AVX512: return &over_avx512;
+    case AVX2:   return &over_avx2;
+    case SSE:    return &over_sse;
+#endif
+    default:     return &over_scalar;
+    }
+}
+
+inline const char* isa_name(Isa isa)
+{
+    switch (isa)
+    {
+    case AVX512: return "avx512";
+    case AVX2:   return "avx2";
+    case SSE:    return "sse";
+    default:     return "scalar";
+    }
+}
+
+// instruction set and kernel picked once, on first use
+inline Isa isa()
+{
+    static Isa isa_ = detect();
+    return isa_;
+}
+
+inline Kernel over()
+{
+    static Kernel kernel_ = kernel(isa());
+    return kernel_;
+}
+
+// back-to-front: the incoming pixels are in front of the accumulated ones
+// inout = in over inout
+inline void over_back_to_front(const float* in, float* inout, size_t npixels)
+{
+    over()(in, inout, inout, npixels);
+}
+
+// front-to-back: the incoming pixels are behind the accumulated ones
+// inout = inout over in
+inline void over_front_to_back(float* inout, const float* in, size_t npixels)
+{
+    over()(inout, in, inout, npixels);
+}
+
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+//--------------------------------------------------------------------------
+//
+// synthetic computation shared by the apps that overlap communication or i/o with compute
+//
+// run() is a compute kernel of multiply-adds on independent values held in registers, in
+// chunks; between chunks it calls a progress callback, so that the caller can test its
+// outstanding messages or writes, as a solver would between time steps
+//
+// hash01() is the integer finalizer of MurmurHash3 as a number in (0, 1), for drawing
+// reproducible values from small integers (gids, indices) without a random number generator
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_KERNEL_H
+#define CIAN_KERNEL_H
+
+#include "mpi.h"
+
+namespace kernel
+{
+
+//
+// hash of x and a seed (integer finalizer of MurmurHash3), as a number in (0, 1)
+//
+inline double hash01(unsigned x, unsigned seed)
+{
+    unsigned h = x * 0x9e3779b1u ^ (seed + 0x7f4a7c15u);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return (h + 0.5) / 4294967296.0;
+}
+
+// progress callback that does nothing
+struct NoProgress
+{
+    void        operator()() const                      {}
+};
+
+// progress callback that tests MPI requests
+struct TestRequests
+{
+                TestRequests(MPI_Request* reqs_, int nreqs_):
+                    reqs(reqs_), nreqs(nreqs_)          {}
+    void        operator()() const
+    {
+        if (nreqs)
+        {
+            int done;
+            MPI_Testall(nreqs, reqs, &done, MPI_STATUSES_IGNORE);
+        }
+    }
+
+    MPI_Request* reqs;
+    int          nreqs;
+};
+
+//
+// synthetic compute kernel: mflops million floating-point operations, as multiply-adds on
+// independent values held in registers, in chunks, calling progress() between chunks
+//
+// mflops: amount of computation, in Mflop
+// progress: callback run between chunks
+//
+// returns a result of the computation, to be kept by the caller
+//
+template<class Progress>
+double run(double mflops, const Progress& progress)
+{
+    const int chunks = 16;
+    const int lanes  = 8;
+    long long n = (long long)(mflops * 1e6 / (2 * lanes)); // iterations of all lanes
+    double v[lanes];
+    for (int i = 0; i < lanes; i++)
+        v[i] = i;
+    for (int c = 0; c < chunks; c++)
+    {
+        for (long long k = c * n / chunks; k < (c + 1) * n / chunks; k++)
+            for (int i = 0; i < lanes; i++)
+                v[i] = v[i] * 0.999999 + 1.0e-6;
+        progress();
+    }
+    double res = 0.0;
+    for (int i = 0; i < lanes; i++)
+        res += v[i];
+    return res;
+}
+
+inline double run(double mflops)
+{
+    return run(mflops, NoProgress());
+}
+
+}
+
+#endif
@@ -0,0 +1,194 @@
+//--------------------------------------------------------------------------
+//
+// machine-readable results, shared by all the proxy apps
+//
+// next to their human-readable tables, the apps emit one record per measured quantity of every
+// run: the run parameters, the minimum, mean, and maximum of the value over the processes (in
+// the median trial), the number of trials and the median, 95th percentile, and standard
+// deviation over the trials of the maximum over the processes, the imbalance (maximum over
+// mean) of the median trial (stats.h), and the git revision of the build; records are written
+// by rank 0 as JSON lines, or as CSV if the output file name ends in .csv, and flushed as soon
+// as they are complete, so that the records of a sweep that crashes are kept
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_RESULTS_H
+#define CIAN_RESULTS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "mpi.h"
+
+#include "stats.h"
+
+#ifdef CIAN_REVISION_HEADER
+#include "cian_revision.h"                  // generated at build time by cmake/revision.cmake
+#endif
+#ifndef CIAN_GIT_REVISION
+#define CIAN_GIT_REVISION "unknown"
+#endif
+
+namespace results
+{
+
+// parameters of a run, common to all its records
+struct Run
+{
+    Run(const std::string& app_ = ""):
+        app(app_), procs(0), blocks(0), elems(0), threads(1)    {}
+
+    std::string app;                         // proxy app
+    int         procs;                       // number of processes
+    int         blocks;                      // total number of blocks
+    long long   elems;                       // number of elements (per block unless noted)
+    std::string k;                           // k value or schedule of the rounds, if any
+    std::string op;                          // operation or variant measured
+    int         threads;                     // number of threads per process
+};
+
+// s as the contents of a JSON string: quotes, backslashes, and control characters escaped
+inline std::string json_escape(const std::string& s)
+{
+    std::string res;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            res += '\\';
+            res += c;
+        }
+        else if (c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            res += buf;
+        }
+        else
+            res += c;
+    }
+    return res;
+}
+
+struct Emitter
+{
+    Emitter(): enabled(false), csv(false), fd(NULL)             {}
+    ~Emitter()                                                  { close(); }
+
+    // opens the output file on rank 0 of MPI_COMM_WORLD (collective over MPI_COMM_WORLD); an
+    // empty file name disables the output
+    bool    open(const std::string& filename)
+        {
+            close();
+            enabled = !filename.empty();
+            if (!enabled)
+                return true;
+            csv = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".csv") == 0;
+
+            int rank;
+            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+            int ok = 1;
+            if (rank == 0)
+            {
+                fd = fopen(filename.c_str(), "w");
+                ok = fd != NULL;
+                if (fd && csv)
+                {
+                    fprintf(fd, "app,procs,blocks,elems,k,op,threads,metric,min,mean,max,trials,"
+                            "median,p95,stddev,imbalance,rev\n");
+                    fflush(fd);
+                }
+            }
+            MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            enabled = ok;
+            return ok;
+        }
+
+    void    close()
+        {
+            if (fd)
+                fclose(fd);
+            fd      = NULL;
+            enabled = false;
+        }
+
+    // one record of a value measured on every process of comm in a single trial (collective
+    // over comm); rank 0 of comm must be rank 0 of MPI_COMM_WORLD, as in all the apps' process
+    // groups
+    void    emit(MPI_Comm comm, const Run& run, const char* metric, double value)
+        {
+            if (!enabled)
+                return;
+            stats::Samples s;
+            s.add(value, comm);
+            emit(run, metric, s);
+        }
+
+    // one record of a value measured over several trials, already reduced over the processes
+    void    emit(const Run& run, const char* metric, const stats::Samples& s)
+        {
+            if (!fd || !s.size())
+                return;
+
+            int t = s.median_trial();
+            if (csv)
+                fprintf(fd, "%s,%d,%d,%lld,%s,%s,%d,%s,%g,%g,%g,%d,%g,%g,%g,%g,%s\n",
+                        run.app.c_str(), run.procs, run.blocks, run.elems, run.k.c_str(),
+                        run.op.c_str(), run.threads, metric, s.rank_min[t], s.rank_mean[t],
+                        s.rank_max[t], s.size(), s.median(), s.p95(), s.stddev(),
+                        s.imbalance(), CIAN_GIT_REVISION);
+            else
+                fprintf(fd, "{\"app\": \"%s\", \"procs\": %d, \"blocks\": %d, \"elems\": %lld, "
+                        "\"k\": \"%s\", \"op\": \"%s\", \"threads\": %d, \"metric\": \"%s\", "
+                        "\"min\": %g, \"mean\": %g, \"max\": %g, \"trials\": %d, \"median\": %g, "
+                        "\"p95\": %g, \"stddev\": %g, \"imbalance\": %g, \"rev\": \"%s\"}\n",
+                        json_escape(run.app).c_str(), run.procs, run.blocks, run.elems,
+                        json_escape(run.k).c_str(), json_escape(run.op).c_str(), run.threads,
+                        json_escape(metric).c_str(), s.rank_min[t], s.rank_mean[t],
+                        s.rank_max[t], s.size(), s.median(), s.p95(), s.stddev(),
+                        s.imbalance(), CIAN_GIT_REVISION);
+            fflush(fd);
+        }
+
+    bool    enabled;                         // output requested (same on all processes)
+    bool    csv;                             // CSV instead of JSON lines
+    FILE*   fd;                              // output file, rank 0 only
+
+private:
+            Emitter(const Emitter&);
+    Emitter& operator=(const Emitter&);
+};
+
+inline Emitter& emitter()
+{
+    static Emitter emitter_;
+    return emitter_;
+}
+
+// shorthands for the emitter shared by the app
+inline bool open(const std::string& filename)
+{
+    return emitter().open(filename);
+}
+
+inline void emit(MPI_Comm comm, const Run& run, const char* metric, double value)
+{
+    emitter().emit(comm, run, metric, value);
+}
+
+inline void emit(const Run& run, const char* metric, const stats::Samples& s)
+{
+    emitter().emit(run, metric, s);
+}
+
+// integer k value of a run
+inline std::string k_string(int k)
+{
+    char buf[16];
+    sprintf(buf, "%d", k);
+    return buf;
+}
+
+}
+
+#endif
@@ -0,0 +1,143 @@
+//--------------------------------------------------------------------------
+//
+// accounting of blocks moved out of core and back by diy::Master
+//
+// when the Master is limited to fewer in-memory blocks than it owns, it moves blocks and their
+// message queues out of core to its external storage and back; the apps give it a Storage,
+// which writes them to files as diy::FileStorage does and accounts the bytes and time,
+// serialization included, in stats(), so that they can be reported separately from the
+// communication time
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_SPILL_H
+#define CIAN_SPILL_H
+
+#include <stddef.h>
+#include <string>
+#include "mpi.h"
+
+#include <diy/storage.hpp>
+
+#include "timing.h"
+
+namespace spill
+{
+
+// totals for one run
+struct Totals
+{
+    Totals(): bytes_out(0), bytes_in(0), time_out(0), time_in(0), rest(0)     {}
+
+    double  bytes_out;                       // bytes written to storage
+    double  bytes_in;                        // bytes read back from storage
+    double  time_out;                        // time spent writing
+    double  time_in;                         // time spent reading
+    double  rest;                            // time of the run spent outside of the storage
+};
+
+struct Stats
+{
+    void    reset()
+        {
+            timing::Lock l(mutex);
+            local = Totals();
+        }
+    void    spilled(size_t bytes, double time)
+        {
+            timing::Lock l(mutex);
+            local.bytes_out += bytes;
+            local.time_out  += time;
+        }
+    void    reloaded(size_t bytes, double time)
+        {
+            timing::Lock l(mutex);
+            local.bytes_in += bytes;
+            local.time_in  += time;
+        }
+
+    // bytes summed and times maximized over the processes in comm, result valid on rank 0;
+    // the rest of the time is that of the local run, total, minus the local storage time, taken
+    // before maximizing, since the slowest process in the run and in the storage can differ
+    Totals  reduce(MPI_Comm comm, double total = 0.0)
+        {
+            double bytes[2] = { local.bytes_out, local.bytes_in };
+            double times[3] = { local.time_out, local.time_in,
+                                total - local.time_out - local.time_in };
+            double tot_bytes[2], max_times[3];
+            MPI_Reduce(bytes, tot_bytes, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+            MPI_Reduce(times, max_times, 3, MPI_DOUBLE, MPI_MAX, 0, comm);
+            Totals res;
+            res.bytes_out = tot_bytes[0];
+            res.bytes_in  = tot_bytes[1];
+            res.time_out  = max_times[0];
+            res.time_in   = max_times[1];
+            res.rest      = max_times[2];
+            return res;
+        }
+
+    Totals          local;
+    timing::Mutex   mutex;
+};
+
+inline Stats& stats()
+{
+    static Stats stats_;
+    return stats_;
+}
+
+// external storage of diy::Master: files, as diy::FileStorage, with the bytes and time of the
+// blocks and queues moved to and from them accounted in stats()
+struct Storage: public diy::ExternalStorage
+{
+    Storage(const std::string& filename_template): storage(filename_template)    {}
+
+    virtual int     put(diy::MemoryBuffer& bb)
+        {
+            size_t bytes = bb.buffer.size();
+            double t0 = MPI_Wtime();
+            int i = storage.put(bb);
+            stats().spilled(bytes, MPI_Wtime() - t0);
+            return i;
+        }
+    // serialized into memory first, for its size
+    virtual int     put(const void* x, diy::detail::Save save)
+        {
+            double t0 = MPI_Wtime();
+            diy::MemoryBuffer bb;
+            save(x, bb);
+            size_t bytes = bb.buffer.size();
+            int i = storage.put(bb);
+            stats().spilled(bytes, MPI_Wtime() - t0);
+            return i;
+        }
+    virtual void    get(int i, diy::MemoryBuffer& bb, size_t extra = 0)
+        {
+            double t0 = MPI_Wtime();
+            storage.get(i, bb, extra);
+            stats().reloaded(bb.buffer.size(), MPI_Wtime() - t0);
+        }
+    virtual void    get(int i, void* x, diy::detail::Load load)
+        {
+            double t0 = MPI_Wtime();
+            diy::MemoryBuffer bb;
+            storage.get(i, bb, 0);
+            load(x, bb);
+            stats().reloaded(bb.buffer.size(), MPI_Wtime() - t0);
+        }
+    virtual void    destroy(int i)                                      { storage.destroy(i); }
+
+    diy::FileStorage    storage;
+};
+
+// number of in-memory blocks to give diy::Master: -1 (all in core) is kept as is, otherwise
+// the Master needs room for at least one block per thread
+inline int mem_blocks(int requested, int num_threads)
+{
+    if (requested >= 0 && requested < num_threads)
+        return num_threads;
+    return requested;
+}
+
+}
+
+#endif
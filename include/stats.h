@@ -0,0 +1,151 @@
+//--------------------------------------------------------------------------
+//
+// repeated trials of a measurement and their statistics
+//
+// each point of a sweep (number of processes and elements) is run for a number of warmup
+// trials, which are not recorded, followed by the measured trials; every trial reduces the
+// value measured by each process over the processes, and a point is summarized by the
+// minimum, median, mean, 95th percentile, and standard deviation over the trials of the
+// slowest process, and by the imbalance (slowest process over the mean) of its median trial
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_STATS_H
+#define CIAN_STATS_H
+
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "mpi.h"
+
+namespace stats
+{
+
+// one quantity measured over the trials of a point
+struct Samples
+{
+    // records one trial of a value measured on every process of comm (collective over comm)
+    void    add(double local, MPI_Comm comm)
+        {
+            int groupsize;
+            MPI_Comm_size(comm, &groupsize);
+            double lo, hi, sum;
+            MPI_Allreduce(&local, &lo,  1, MPI_DOUBLE, MPI_MIN, comm);
+            MPI_Allreduce(&local, &hi,  1, MPI_DOUBLE, MPI_MAX, comm);
+            MPI_Allreduce(&local, &sum, 1, MPI_DOUBLE, MPI_SUM, comm);
+            rank_min.push_back(lo);
+            rank_max.push_back(hi);
+            rank_mean.push_back(sum / groupsize);
+        }
+
+    void    clear()
+        {
+            rank_min.clear();
+            rank_max.clear();
+            rank_mean.clear();
+        }
+
+    int     size() const                                { return rank_max.size(); }
+
+    // statistics over the trials of the maximum over the processes
+    double  min() const
+        { return size() ? *std::min_element(rank_max.begin(), rank_max.end()) : 0.0; }
+    double  median() const                              { return percentile(0.5); }
+    double  p95() const                                 { return percentile(0.95); }
+    double  mean() const
+        {
+            double sum = 0.0;
+            for (int i = 0; i < size(); ++i)
+                sum += rank_max[i];
+            return size() ? sum / size() : 0.0;
+        }
+    double  stddev() const
+        {
+            if (size() < 2)
+                return 0.0;
+            double m = mean(), sum = 0.0;
+            for (int i = 0; i < size(); ++i)
+                sum += (rank_max[i] - m) * (rank_max[i] - m);
+            return sqrt(sum / (size() - 1));
+        }
+
+    // nearest-rank percentile, p in [0, 1]
+    double  percentile(double p) const
+        {
+            if (!size())
+                return 0.0;
+            std::vector<double> sorted(rank_max);
+            std::sort(sorted.begin(), sorted.end());
+            int i = (int)ceil(p * size()) - 1;
+            return sorted[std::max(0, std::min(i, size() - 1))];
+        }
+
+    // trial whose maximum is the median (the lower one for an even number of trials)
+    int     median_trial() const
+        {
+            int res = 0;
+            double m = median();
+            for (int i = 0; i < size(); ++i)
+                if (rank_max[i] == m)
+                    res = i;
+            return res;
+        }
+
+    // maximum over the mean over the processes, in the median trial
+    double  imbalance() const
+        {
+            if (!size())
+                return 0.0;
+            int i = median_trial();
+            return rank_mean[i] > 0.0 ? rank_max[i] / rank_mean[i] : 1.0;
+        }
+
+    std::vector<double> rank_min;            // minimum over the processes, per trial
+    std::vector<double> rank_max;            // maximum over the processes, per trial
+    std::vector<double> rank_mean;           // mean over the processes, per trial
+};
+
+// summary of one quantity of one point, for the statistics table
+struct Row
+{
+    Row(const std::string& point_, const std::string& metric_, const Samples& s):
+        point(point_), metric(metric_), samples(s)              {}
+
+    std::string point;                       // e.g. "procs 4 elems 1024"
+    std::string metric;
+    Samples     samples;
+};
+
+// the rows of the app, in the order they were recorded
+inline std::vector<Row>& rows()
+{
+    static std::vector<Row> rows_;
+    return rows_;
+}
+
+inline void record(const std::string& point, const std::string& metric, const Samples& s)
+{
+    rows().push_back(Row(point, metric, s));
+}
+
+// prints the statistics table of the recorded rows (called by rank 0)
+inline void print(int warmup, int trials)
+{
+    fprintf(stderr, "----- Trial Statistics (%d warmup, %d trials, max over processes) -----\n\n",
+            warmup, trials);
+    fprintf(stderr, "# point \t\t\t metric \t min \t median \t mean \t p95 \t stddev \t "
+            "max/mean\n");
+    for (size_t i = 0; i < rows().size(); ++i)
+    {
+        const Row& r = rows()[i];
+        fprintf(stderr, "%-24s \t %-12s \t %.3lf \t %.3lf \t %.3lf \t %.3lf \t %.3lf \t %.3lf\n",
+                r.point.c_str(), r.metric.c_str(), r.samples.min(), r.samples.median(),
+                r.samples.mean(), r.samples.p95(), r.samples.stddev(), r.samples.imbalance());
+    }
+    fprintf(stderr, "\n--------------------------\n\n");
+}
+
+}
+
+#endif
@@ -0,0 +1,404 @@
+//--------------------------------------------------------------------------
+//
+// per-round, per-thread timing of the callbacks run by diy::Master::foreach and diy::reduce
+//
+// the callbacks of one round may run concurrently in several threads, so instead of
+// bracketing the whole operation with barriers, each callback records its start and end
+// times; a round spans from the first start to the last end among the local blocks, and
+// the busy time of each thread is accumulated separately
+//
+// the reduce callbacks also count the bytes they receive and send in each round; on request
+// (profile()), every run prints a per-round breakdown of bytes, compute time, and the time
+// spent waiting for the exchange that feeds the next round, and appends its callbacks and
+// exchanges to a Chrome trace-event file per process (chrome://tracing, Perfetto)
+//
+//--------------------------------------------------------------------------
+#ifndef CIAN_TIMING_H
+#define CIAN_TIMING_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "mpi.h"
+
+#include <diy/reduce.hpp>
+
+namespace timing
+{
+
+struct Mutex
+{
+                Mutex()                                 { pthread_mutex_init(&m, NULL); }
+                ~Mutex()                                { pthread_mutex_destroy(&m); }
+    void        lock()                                  { pthread_mutex_lock(&m); }
+    void        unlock()                                { pthread_mutex_unlock(&m); }
+
+    pthread_mutex_t m;
+
+private:
+                Mutex(const Mutex&);
+    Mutex&      operator=(const Mutex&);
+};
+
+struct Lock
+{
+                Lock(Mutex& m_): m(m_)                  { m.lock(); }
+                ~Lock()                                 { m.unlock(); }
+    Mutex&      m;
+};
+
+// optional per-round profile of the runs
+struct Profile
+{
+                Profile(): table(false), trace(NULL), origin(0), rank(0)    {}
+
+    bool        table;                      // print the per-round breakdown of every run
+    FILE*       trace;                      // trace-event file of this process, NULL = none
+    double      origin;                     // time origin of the trace (common to all processes)
+    int         rank;                       // rank in MPI_COMM_WORLD, the process id of the trace
+};
+
+inline Profile& profile()
+{
+    static Profile profile_;
+    return profile_;
+}
+
+struct RoundTimer
+{
+    // one callback, recorded for the trace
+    struct Event
+    {
+        int     round, thread, gid;
+        double  begin, end;
+    };
+
+                RoundTimer(): offset(0), local(0)       {}
+
+    // clears all rounds and threads; offset is added to the round numbers passed to begin/end,
+    // so that several consecutive reductions can be recorded as one sequence of rounds
+    void        reset()
+        {
+            Lock l(mutex);
+            offset = 0;
+            first_begin.clear();
+            last_end.clear();
+            busy_.clear();
+            sent_.clear();
+            received_.clear();
+            threads_.clear();
+            events_.clear();
+        }
+
+    // called at the start of a callback; returns the start time to pass to end()
+    double      begin(int round)
+        {
+            double t = MPI_Wtime();
+            Lock l(mutex);
+            round += offset;
+            grow(round);
+            if (first_begin[round] < 0 || t < first_begin[round])
+                first_begin[round] = t;
+            return t;
+        }
+
+    // called at the end of a callback (of block gid, if known)
+    void        end(int round, double t0, int gid = -1)
+        {
+            double t = MPI_Wtime();
+            Lock l(mutex);
+            round += offset;
+            grow(round);
+            if (t > last_end[round])
+                last_end[round] = t;
+            int th = thread();
+            busy_[round][th] += t - t0;
+            if (profile().trace)
+            {
+                Event e = { round, th, gid, t0, t };
+                events_.push_back(e);
+            }
+        }
+
+    // adds the bytes sent and received by a callback
+    void        bytes(int round, size_t sent, size_t received)
+        {
+            Lock l(mutex);
+            round += offset;
+            grow(round);
+            sent_[round]     += sent;
+            received_[round] += received;
+        }
+
+    int         rounds() const                          { return first_begin.size(); }
+    int         threads() const                         { return threads_.size(); }
+
+    // earliest start and latest end of any callback in a round
+    double      start(int round) const
+        { return round < rounds() ? first_begin[round] : -1.0; }
+    double      finish(int round) const
+        { return round < rounds() ? last_end[round] : 0.0; }
+    double      finish() const
+        { return last_end.empty() ? 0.0 : *std::max_element(last_end.begin(), last_end.end()); }
+
+    // wall time of a round, from its first callback to the first callback of the next round
+    // (i.e., including the communication that feeds the next round)
+    double      span(int round) const
+        {
+            if (first_begin[round] < 0)                 // no local callbacks in this round
+                return 0.0;
+            if (round + 1 < rounds() && first_begin[round + 1] >= 0)
+                return first_begin[round + 1] - first_begin[round];
+            return last_end[round] - first_begin[round];
+        }
+
+    // bytes sent in a round and received at its start (sent in the previous round)
+    size_t      sent(int round) const                   { return sent_[round]; }
+    size_t      received(int round) const               { return received_[round]; }
+
+    // gap from the last end of a callback of a round to the first start of the next round's,
+    // i.e., waiting for the exchange that feeds the next round (0 for the last round)
+    double      wait(int round) const
+        {
+            if (round + 1 >= rounds() || first_begin[round] < 0 || first_begin[round + 1] < 0)
+                return 0.0;
+            double w = first_begin[round + 1] - last_end[round];
+            return w > 0.0 ? w : 0.0;
+        }
+
+    const std::vector<Event>&   events() const          { return events_; }
+
+    // callback time of one thread, or of the busiest thread, in a round
+    double      busy(int round, int thread) const
+        { return thread < (int)busy_[round].size() ? busy_[round][thread] : 0.0; }
+    double      busy(int round) const
+        {
+            if (busy_[round].empty())
+                return 0.0;
+            return *std::max_element(busy_[round].begin(), busy_[round].end());
+        }
+
+    int         offset;
+    double      local;                      // local time of the last elapsed()
+
+private:
+    void        grow(int round)
+        {
+            if (round < (int)first_begin.size())
+                return;
+            first_begin.resize(round + 1, -1.0);
+            last_end.resize(round + 1, 0.0);
+            sent_.resize(round + 1, 0);
+            received_.resize(round + 1, 0);
+            busy_.resize(round + 1);
+            for (size_t i = 0; i < busy_.size(); ++i)
+                busy_[i].resize(threads_.size(), 0.0);
+        }
+
+    // index of the calling thread, assigned in order of first appearance; mutex must be held
+    int         thread()
+        {
+            pthread_t self = pthread_self();
+            for (size_t i = 0; i < threads_.size(); ++i)
+                if (pthread_equal(threads_[i], self))
+                    return i;
+            threads_.push_back(self);
+            for (size_t i = 0; i < busy_.size(); ++i)
+                busy_[i].resize(threads_.size(), 0.0);
+            return threads_.size() - 1;
+        }
+
+    Mutex                               mutex;
+    std::vector<double>                 first_begin;
+    std::vector<double>                 last_end;
+    std::vector< std::vector<double> >  busy_;      // [round][thread]
+    std::vector<size_t>                 sent_;
+    std::vector<size_t>                 received_;
+    std::vector<pthread_t>              threads_;
+    std::vector<Event>                  events_;
+};
+
+// the timer shared by all the callbacks of the current operation
+inline RoundTimer& round_timer()
+{
+    static RoundTimer timer;
+    return timer;
+}
+
+// bytes in the incoming and outgoing queues of a reduce callback, without messages to itself
+inline size_t received_bytes(const diy::ReduceProxy& rp)
+{
+    size_t bytes = 0;
+    const diy::Master::IncomingQueues& in = *rp.incoming();
+    for (diy::Master::IncomingQueues::const_iterator it = in.begin(); it != in.end(); ++it)
+        if (it->first != rp.gid())
+            bytes += it->second.buffer.size();
+    return bytes;
+}
+
+inline size_t sent_bytes(const diy::ReduceProxy& rp)
+{
+    size_t bytes = 0;
+    const diy::Master::OutgoingQueues& out = *rp.outgoing();
+    for (diy::Master::OutgoingQueues::const_iterator it = out.begin(); it != out.end(); ++it)
+        if (it->first.gid != rp.gid())
+            bytes += it->second.buffer.size();
+    return bytes;
+}
+
+// wraps a diy::reduce callback so that it is timed by round_timer(); the received bytes are
+// counted before the callback, which may take over the incoming buffers
+template<class Partners, void (*F)(void*, const diy::ReduceProxy&, const Partners&)>
+void timed(void* b, const diy::ReduceProxy& rp, const Partners& partners)
+{
+    size_t received = received_bytes(rp);
+    double t0 = round_timer().begin(rp.round());
+    F(b, rp, partners);
+    round_timer().end(rp.round(), t0, rp.gid());
+    round_timer().bytes(rp.round(), sent_bytes(rp), received);
+}
+
+// maximum over the processes in comm of the time from t0 to the end of the last callback; the
+// time of this process is kept in round_timer().local
+inline double elapsed(double t0, MPI_Comm comm)
+{
+    double local = round_timer().local = round_timer().finish() - t0;
+    double global;
+    MPI_Allreduce(&local, &global, 1, MPI_DOUBLE, MPI_MAX, comm);
+    return global;
+}
+
+// prints one line with the span and busiest-thread time of every round, maximum over the
+// processes in comm (collective; rank 0 prints)
+inline void print_rounds(const char* label, MPI_Comm comm)
+{
+    const RoundTimer& timer = round_timer();
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // processes whose blocks were inactive in the last rounds recorded fewer rounds
+    int nrounds, local_rounds = timer.rounds();
+    MPI_Allreduce(&local_rounds, &nrounds, 1, MPI_INT, MPI_MAX, comm);
+    std::vector<double> local(2 * nrounds, 0.0), global(2 * nrounds, 0.0);
+    for (int r = 0; r < local_rounds; ++r)
+    {
+        local[2 * r    ] = timer.span(r);
+        local[2 * r + 1] = timer.busy(r);
+    }
+    if (nrounds)
+        MPI_Reduce(&local[0], &global[0], 2 * nrounds, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+    if (rank == 0)
+    {
+        fprintf(stderr, "# %s threads %d round span/busy:", label, timer.threads());
+        for (int r = 0; r < nrounds; ++r)
+            fprintf(stderr, " %.3lf/%.3lf", global[2 * r], global[2 * r + 1]);
+        fprintf(stderr, "\n");
+    }
+}
+
+// opens the trace-event file prefix.<rank>.json of this process (collective over
+// MPI_COMM_WORLD, which sets the common time origin); false if it can't be written
+inline bool open_trace(const std::string& prefix)
+{
+    Profile& p = profile();
+    MPI_Comm_rank(MPI_COMM_WORLD, &p.rank);
+    char name[256];
+    snprintf(name, sizeof(name), "%s.%d.json", prefix.c_str(), p.rank);
+    p.trace = fopen(name, "w");
+    MPI_Barrier(MPI_COMM_WORLD);
+    p.origin = MPI_Wtime();
+    if (!p.trace)
+        return false;
+    fprintf(p.trace, "[\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+            "\"args\": {\"name\": \"rank %d\"}}", p.rank, p.rank);
+    return true;
+}
+
+inline void close_trace()
+{
+    Profile& p = profile();
+    if (!p.trace)
+        return;
+    fprintf(p.trace, "\n]\n");
+    fclose(p.trace);
+    p.trace = NULL;
+}
+
+// appends the callbacks of the last run to the trace, one lane per thread, and the exchanges
+// between rounds in a lane after the threads
+inline void trace_rounds(const char* label)
+{
+    Profile& p = profile();
+    const RoundTimer& timer = round_timer();
+    if (!p.trace)
+        return;
+
+    const std::vector<RoundTimer::Event>& events = timer.events();
+    for (size_t i = 0; i < events.size(); ++i)
+        fprintf(p.trace, ",\n{\"name\": \"round %d\", \"cat\": \"compute\", \"ph\": \"X\", "
+                "\"pid\": %d, \"tid\": %d, \"ts\": %.3lf, \"dur\": %.3lf, "
+                "\"args\": {\"run\": \"%s\", \"gid\": %d}}",
+                events[i].round, p.rank, events[i].thread, (events[i].begin - p.origin) * 1e6,
+                (events[i].end - events[i].begin) * 1e6, label, events[i].gid);
+
+    for (int r = 0; r + 1 < timer.rounds(); ++r)
+    {
+        if (timer.start(r) < 0 || timer.start(r + 1) < 0)
+            continue;
+        fprintf(p.trace, ",\n{\"name\": \"exchange %d\", \"cat\": \"wait\", \"ph\": \"X\", "
+                "\"pid\": %d, \"tid\": %d, \"ts\": %.3lf, \"dur\": %.3lf, "
+                "\"args\": {\"run\": \"%s\", \"sent\": %lu, \"received\": %lu}}",
+                r, p.rank, timer.threads(), (timer.finish(r) - p.origin) * 1e6,
+                (timer.start(r + 1) - timer.finish(r)) * 1e6, label,
+                (unsigned long)timer.sent(r), (unsigned long)timer.received(r + 1));
+    }
+    fflush(p.trace);
+}
+
+// per-round profile of the last run, if requested: prints the bytes sent and received (total
+// over the processes in comm) and the compute, wait, and span times (maximum over the
+// processes) of every round (collective; rank 0 prints), and appends the run to the trace
+inline void print_profile(const char* label, MPI_Comm comm)
+{
+    trace_rounds(label);
+    if (!profile().table)
+        return;
+
+    const RoundTimer& timer = round_timer();
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    int nrounds, local_rounds = timer.rounds();
+    MPI_Allreduce(&local_rounds, &nrounds, 1, MPI_INT, MPI_MAX, comm);
+    if (!nrounds)
+        return;
+    std::vector<double> local_bytes(2 * nrounds, 0.0), bytes(2 * nrounds, 0.0);
+    std::vector<double> local_times(3 * nrounds, 0.0), times(3 * nrounds, 0.0);
+    for (int r = 0; r < local_rounds; ++r)
+    {
+        local_bytes[2 * r    ] = timer.sent(r);
+        local_bytes[2 * r + 1] = timer.received(r);
+        local_times[3 * r    ] = timer.busy(r);
+        local_times[3 * r + 1] = timer.wait(r);
+        local_times[3 * r + 2] = timer.span(r);
+    }
+    MPI_Reduce(&local_bytes[0], &bytes[0], 2 * nrounds, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(&local_times[0], &times[0], 3 * nrounds, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+    if (rank == 0)
+    {
+        fprintf(stderr, "# %s round profile (MB total, times max over processes)\n", label);
+        fprintf(stderr, "# round \t sent_MB \t recv_MB \t compute \t wait \t\t span\n");
+        for (int r = 0; r < nrounds; ++r)
+            fprintf(stderr, "%d \t\t %.3lf \t %.3lf \t %.3lf \t\t %.3lf \t\t %.3lf\n", r,
+                    bytes[2 * r] / 1048576.0, bytes[2 * r + 1] / 1048576.0,
+                    times[3 * r], times[3 * r + 1], times[3 * r + 2]);
+    }
+}
+
+}
+
+#endif
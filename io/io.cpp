@@ -1,6 +1,5 @@
 // TODO:
 // empty file cache each time?
-// compare read and written blocks? (I checked the first tiny run manually)
 
 //--------------------------------------------------------------------------
 //
@@ -20,6 +19,8 @@
 #include <vector>
 #include <algorithm>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
 #include <diy/master.hpp>
 #include <diy/decomposition.hpp>
@@ -27,33 +28,110 @@
 #include <diy/io/block.hpp>
 
 #include "../include/opts.h"
+#include "../include/args.h"
+#include "../include/spill.h"
+#include "../include/results.h"
+#include "../include/stats.h"
+#include "../include/blockio.h"
+#include "../include/codec.h"
+#include "../include/kernel.h"
 
 using namespace std;
 
 typedef  diy::ContinuousBounds       Bounds;
 typedef  diy::RegularContinuousLink  RCLink;
 
+int data_codec = codec::none;                // codec of the serialized block values
+volatile double sink;                        // result of the computation and of the mapped reads
+
 //
 // block
 //
 struct Block
 {
-    Block()                                                     {}
+    Block(): view(NULL)                                         {}
     static void*    create()                                    { return new Block; }
     static void     destroy(void* b)                            { delete static_cast<Block*>(b); }
     static void     save(const void* b, diy::BinaryBuffer& bb)
         { diy::save(bb, *static_cast<const Block*>(b)); }
     static void     load(void* b, diy::BinaryBuffer& bb)
         { diy::load(bb, *static_cast<Block*>(b)); }
-    void generate_data(int n_)
+    // points the block into the serialized bytes of a block with uncompressed values, e.g., in a
+    // mapped file, instead of copying the values (blockio::ViewBlock)
+    static bool     view_bytes(void* b_, const char* bytes, size_t n_bytes)
+        {
+            Block* b = static_cast<Block*>(b_);
+            size_t head = sizeof(int) + sizeof(size_t); // codec, number of values
+            int c;
+            size_t n;
+            if (n_bytes < head)
+                return false;
+            memcpy(&c, bytes, sizeof(int));
+            memcpy(&n, bytes + sizeof(int), sizeof(size_t));
+            if (c != codec::none ||
+                n_bytes != head + n * sizeof(float) + sizeof(int) + sizeof(size_t) ||
+                (size_t)(bytes + head) % sizeof(float))
+                return false;
+            b->data.clear();
+            b->view = reinterpret_cast<const float*>(bytes + head);
+            memcpy(&b->gid, bytes + head + n * sizeof(float), sizeof(int));
+            memcpy(&b->size, bytes + head + n * sizeof(float) + sizeof(int), sizeof(size_t));
+            return b->size == n;
+        }
+
+    // 64-bit checksum of the values: the sum of the bits of value i times 2i + 1 (modulo 2^64,
+    // so that the order matters), mixed with the number of values; the loop vectorizes, and it
+    // is split among the OpenMP threads
+    unsigned long long checksum() const
+        {
+            long long n = view ? size : data.size();
+            const unsigned int* bits = (const unsigned int*) values();
+            unsigned long long sum = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:sum)
+#endif
+            for (long long i = 0; i < n; ++i)
+                sum += (unsigned long long) bits[i] * (2 * (unsigned long long) i + 1);
+            return sum ^ ((unsigned long long) n * 0x9e3779b97f4a7c15ULL);
+        }
+    // n_ values of a field over the global index, continued from block to block:
+    //   ramp: the global index
+    //   smooth: sum of four sine waves of halving amplitudes and incommensurate wavelengths,
+    //           from a few elements to thousands
+    //   noisy: smooth plus uniform noise of amplitude 0.001
+    void generate_data(int n_, const std::string& gen)
         {
             size = n_;
             data.resize(size);
+            view = NULL;
+            if (gen == "ramp")
+            {
+                for (int i = 0; i < size; ++i)
+                    data[i] = gid * size + i;
+                return;
+            }
+            bool noisy = gen == "noisy";
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
             for (int i = 0; i < size; ++i)
-                data[i] = gid * size + i;
+            {
+                long long j = (long long)gid * size + i;
+                double x = j;
+                double v = sin(x * 0.00153) + 0.5 * sin(x * 0.0117 + 1.3) +
+                    0.25 * sin(x * 0.0731 + 0.7) + 0.125 * sin(x * 0.293 + 2.1);
+                if (noisy)
+                    v += 0.001 * (2.0 * kernel::hash01((unsigned)j, 0) - 1.0);
+                data[i] = v;
+            }
         }
 
+    // values, owned or viewed
+    const float* values() const
+        { return view ? view : (data.empty() ? NULL : &data[0]); }
+
     std::vector<float> data;                 // block values
+    const float* view;                       // values in a mapped file instead of data, or NULL
     int gid;                                 // block global id
     size_t size;                             // number of values
 };
@@ -65,14 +143,14 @@ namespace diy
     {
         static void save(BinaryBuffer& bb, const Block& b)
         {
-            diy::save(bb, b.data);
+            codec::save(bb, b.data, data_codec);
             diy::save(bb, b.gid);
             diy::save(bb, b.size);
         }
 
         static void load(BinaryBuffer& bb, Block& b)
         {
-            diy::load(bb, b.data);
+            codec::load(bb, b.data);
             diy::load(bb, b.gid);
             diy::load(bb, b.size);
         }
@@ -100,18 +178,159 @@ struct AddBlock
     diy::Master&  master;
 };
 
+//
+// data values of the blocks
+//
+struct Data
+{
+    Data(): num_elems(0), sizes("equal")                        {}
+
+    // number of values of block gid, num_elems times a factor drawn for the gid:
+    //   equal: 1
+    //   uniform: uniform in [0.02, 1.98]
+    //   lognormal: lognormal with sigma 1 and mean 1, limited to [0.01, 20]
+    //   list: the factors of a list, in gid order, repeated as needed
+    int         elems(int gid) const
+        {
+            double f = 1.0;
+            if (sizes == "uniform")
+                f = 0.02 + 1.96 * kernel::hash01(gid, 1);
+            else if (sizes == "lognormal")
+            {
+                // normal draw by the Box-Muller transform
+                double z = sqrt(-2.0 * log(kernel::hash01(gid, 2))) *
+                    cos(6.283185307179586 * kernel::hash01(gid, 3));
+                f = std::min(std::max(exp(z - 0.5), 0.01), 20.0);
+            }
+            else if (sizes == "list" && !factors.empty())
+                f = factors[gid % factors.size()];
+            return std::max((int)(f * num_elems + 0.5), 1);
+        }
+
+    int                 num_elems;           // mean number of values per block
+    std::string         gen;                 // generator (Block::generate_data)
+    std::string         sizes;               // distribution of the block sizes
+    std::vector<double> factors;             // block sizes over num_elems, for the list
+};
+
 //
 // reset the size and data values in a block
-// args[0]: num_elems
-// args[1]: tot_blocks
+// args: Data
 //
 void ResetBlock(void* b_, const diy::Master::ProxyWithLink& cp, void* args)
 {
     Block* b   = static_cast<Block*>(b_);
-    int num_elems = *(int*)args;
-    b->generate_data(num_elems);
+    Data* d    = static_cast<Data*>(args);
+    b->generate_data(d->elems(cp.gid()), d->gen);
 }
 
+//
+// checksums of the local blocks, computed before writing them to the file footer, or after
+// reading them to verify them against the footer
+//
+struct Checksums
+{
+    Checksums(): bad(0)                                         {}
+
+    std::vector<long long>              gids;   // local blocks
+    std::vector<unsigned long long>     sums;   // checksums of the local blocks
+    std::vector<unsigned long long>     footer; // checksums of all the blocks, by gid, if known
+    int                                 bad;    // local blocks that do not match
+    std::string                         gen;    // generator of the data, for regenerating it
+};
+
+//
+// computes the checksum of a block, for the file footer
+// args: Checksums
+//
+void ChecksumBlock(void* b_, const diy::Master::ProxyWithLink& cp, void* args)
+{
+    Block* b = static_cast<Block*>(b_);
+    Checksums* c = static_cast<Checksums*>(args);
+    c->gids.push_back(cp.gid());
+    c->sums.push_back(b->checksum());
+}
+
+//
+// checks a block read back against the checksums of the file footer, if known, otherwise
+// against the data generate_data would have produced
+// args: Checksums
+//
+void VerifyBlock(void* b_, const diy::Master::ProxyWithLink& cp, void* args)
+{
+    Block* b = static_cast<Block*>(b_);
+    Checksums* c = static_cast<Checksums*>(args);
+    unsigned long long sum = b->checksum();
+
+    if (!c->footer.empty())
+    {
+        if (cp.gid() >= (int)c->footer.size() || sum != c->footer[cp.gid()])
+            c->bad++;
+    }
+    else
+    {
+        Block expected;
+        expected.gid = cp.gid();
+        expected.generate_data(b->size, c->gen);
+        if (b->gid != cp.gid() || sum != expected.checksum())
+            c->bad++;
+    }
+}
+
+//
+// sums the values of a block, accessing all of them
+// args: double sum
+//
+void SumBlock(void* b_, const diy::Master::ProxyWithLink& cp, void* args)
+{
+    Block* b = static_cast<Block*>(b_);
+    const float* v = b->values();
+    double sum = 0.0;
+    for (size_t i = 0; i < b->size; i++)
+        sum += v[i];
+    *static_cast<double*>(args) += sum;
+}
+
+//
+// gathers the checksums of all the blocks, by gid, into the footer data of a file
+// (collective over comm)
+//
+void SaveChecksums(const Checksums& c, int tot_blocks, MPI_Comm comm, diy::MemoryBuffer& extra)
+{
+    int groupsize;
+    MPI_Comm_size(comm, &groupsize);
+    int n = c.gids.size();
+    std::vector<int> counts(groupsize), displs(groupsize + 1, 0);
+    MPI_Allgather(&n, 1, MPI_INT, &counts[0], 1, MPI_INT, comm);
+    for (int i = 0; i < groupsize; i++)
+        displs[i + 1] = displs[i] + counts[i];
+    std::vector<long long> gids(displs[groupsize] + 1);
+    std::vector<unsigned long long> sums(displs[groupsize] + 1);
+    MPI_Allgatherv(n ? (void*)&c.gids[0] : NULL, n, MPI_LONG_LONG, &gids[0], &counts[0],
+                   &displs[0], MPI_LONG_LONG, comm);
+    MPI_Allgatherv(n ? (void*)&c.sums[0] : NULL, n, MPI_UNSIGNED_LONG_LONG, &sums[0],
+                   &counts[0], &displs[0], MPI_UNSIGNED_LONG_LONG, comm);
+
+    std::vector<unsigned long long> footer(tot_blocks, 0);
+    for (int i = 0; i < displs[groupsize]; i++)
+        if (gids[i] >= 0 && gids[i] < tot_blocks)
+            footer[gids[i]] = sums[i];
+    extra.buffer.clear();
+    extra.reset();
+    diy::save(extra, footer);
+}
+
+//
+// progress callback of the compute kernel: tests a background write, or nothing if NULL
+//
+struct TestWrite
+{
+                TestWrite(blockio::AsyncWrite* write_): write(write_)    {}
+    void        operator()() const                          { if (write) write->test(); }
+
+    blockio::AsyncWrite* write;
+};
+
 //
 // prints data values in a block (debugging)
 //
@@ -119,19 +338,52 @@ void PrintBlock(void* b_, const diy::Master::ProxyWithLink& cp, void*)
 {
     Block* b   = static_cast<Block*>(b_);
     for (int i = 0; i < b->size; i++)
-        fprintf(stderr, "gid %d size %lu data[%d] = %.1f\n", b->gid, b->size, i, b->data[i]);
+        fprintf(stderr, "gid %d size %lu data[%d] = %.1f\n", b->gid, b->size, i, b->values()[i]);
 }
 
 //
 // print results
 //
-// time: time
-// tot_b: total number of blocks
+// time: time per run and hint set, median over the trials
+// spill_totals: blocks moved out of core and back during each run and hint set
+// out_of_core: whether to print the spill columns
+// hints: MPI-IO hint sets, one row per set (empty = one row)
+// layout: file layout (blockio::Files::layout)
+// checksum_time: checksum time per run and hint set, median over the trials, or NULL
+// bad_blocks: blocks read that failed verification, per run and hint set (read only)
+// async_time, stall_time, compute_time: background write total, stall, and compute times per
+// run and hint set, medians over the trials, or NULL
+// ratio, codec_time: compression ratio and codec time per run and hint set, or NULL
+// first_time, mmap_time, faulted_mb: memory-mapped read time to the first access and to the
+// access of all the values, medians over the trials, and MB faulted in, per run and hint set, or
+// NULL
+// mmap_cold: the pages of the files were dropped from the page cache before mapping them
+// bytes: bytes of the values of all the blocks per run
+// imbalance: bytes of the values of the process with the most over the mean per run, or NULL
+// sizes: distribution of the block sizes
 // min_procs, max_procs: process range
 // min_elems, max_elems: data range
 //
 void PrintResults(double *time,
-                  int tot_b,
+                  spill::Totals *spill_totals,
+                  bool out_of_core,
+                  const std::vector<blockio::Hints>& hints,
+                  const std::string& layout,
+                  double *checksum_time,
+                  int *bad_blocks,
+                  double *async_time,
+                  double *stall_time,
+                  double *compute_time,
+                  double *ratio,
+                  double *codec_time,
+                  double *first_time,
+                  double *mmap_time,
+                  double *faulted_mb,
+                  bool mmap_cold,
+                  bool write,
+                  double *bytes,
+                  double *imbalance,
+                  const std::string& sizes,
                   int min_procs,
                   int max_procs,
                   int min_elems,
@@ -141,25 +393,73 @@ void PrintResults(double *time,
     int num_elem_iters = (int)(log2(max_elems / min_elems) + 1);  // number of element iterations
     int proc_iter = 0;                                            // process iteration number
     float gb = 1073741824.0f;                                     // 1 GB
+    int num_sets = std::max((int)hints.size(), 1);                // rows per process count
 
     fprintf(stderr, "----- Timing Results -----\n");
+    fprintf(stderr, "\n# file layout = %s\n", layout.c_str());
+    fprintf(stderr, "# block sizes = %s\n", sizes.c_str());
+    if (first_time)
+        fprintf(stderr, "# memory-mapped reads: %s\n", mmap_cold ?
+                "page cache dropped before mapping" :
+                "page cache could not be dropped, pages may be cached by the read");
 
     // iterate over number of elements
     int num_elems = min_elems;
     while (num_elems <= max_elems)
     {
-        fprintf(stderr, "\n# num_elemnts = %d   size @ 4 bytes / element = %d KB\n",
-                num_elems, num_elems * 4 / 1024);
-        fprintf(stderr, "# procs \t time(s) \t bw(GB/s)\n");
+        fprintf(stderr, "\n# num_elemnts = %d   size @ 4 bytes / element = %d KB%s\n",
+                num_elems, num_elems * 4 / 1024, imbalance ? " (mean)" : "");
+        fprintf(stderr, "# procs \t time(s) \t bw(GB/s)");
+        if (imbalance)
+            fprintf(stderr, " \t GB \t\t imbalance");
+        if (out_of_core)
+            fprintf(stderr, " \t spill_MB \t spill_time(s) \t reload_MB \t reload_time(s)");
+        if (checksum_time)
+            fprintf(stderr, " \t checksum(s)%s", write ? "" : " \t bad_blocks");
+        if (ratio)
+            fprintf(stderr, " \t ratio \t codec(s) \t codec_MB/s");
+        if (async_time)
+            fprintf(stderr, " \t async(s) \t stall(s) \t compute(s)");
+        if (first_time)
+            fprintf(stderr, " \t mmap_first(s) \t mmap_all(s) \t faulted_MB");
+        if (!hints.empty())
+            fprintf(stderr, " \t hints");
+        fprintf(stderr, "\n");
 
         // iterate over processes
         int groupsize = min_procs;
         proc_iter = 0;
         while (groupsize <= max_procs)
         {
-            int i = proc_iter * num_elem_iters + elem_iter; // index into times
-            fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf\n",
-                    groupsize, time[i], (float)num_elems * 4.0f * (float)tot_b / gb / time[i]);
+            for (int s = 0; s < num_sets; s++)
+            {
+                // index into times
+                int i = (proc_iter * num_elem_iters + elem_iter) * num_sets + s;
+                fprintf(stderr, "%d \t\t %.3lf \t\t %.3lf",
+                        groupsize, time[i], bytes[i] / gb / time[i]);
+                if (imbalance)
+                    fprintf(stderr, " \t\t %.3lf \t\t %.2lf", bytes[i] / gb, imbalance[i]);
+                if (out_of_core)
+                    fprintf(stderr, " \t\t %.1lf \t\t %.3lf \t\t %.1lf \t\t %.3lf",
+                            spill_totals[i].bytes_out / 1048576.0, spill_totals[i].time_out,
+                            spill_totals[i].bytes_in / 1048576.0, spill_totals[i].time_in);
+                if (checksum_time)
+                    fprintf(stderr, " \t %.3lf", checksum_time[i]);
+                if (checksum_time && !write)
+                    fprintf(stderr, " \t\t %d", bad_blocks[i]);
+                if (ratio)
+                    fprintf(stderr, " \t %.2lf \t %.3lf \t\t %.1lf", ratio[i], codec_time[i],
+                            bytes[i] / 1048576.0 / codec_time[i]);
+                if (async_time)
+                    fprintf(stderr, " \t %.3lf \t\t %.3lf \t\t %.3lf",
+                            async_time[i], stall_time[i], compute_time[i]);
+                if (first_time)
+                    fprintf(stderr, " \t %.3lf \t\t %.3lf \t\t %.1lf",
+                            first_time[i], mmap_time[i], faulted_mb[i]);
+                if (!hints.empty())
+                    fprintf(stderr, " \t\t %s", hints[s].name.c_str());
+                fprintf(stderr, "\n");
+            }
 
             groupsize *= 2; // double the number of processes every time
             proc_iter++;
@@ -182,6 +482,23 @@ void PrintResults(double *time,
 // nb: number of blocks per process (output)
 // target_k: target k-value (output)
 // write: write (true) or read (false)
+// procs_per_file: processes per file, 0 = one shared file, 1 = one POSIX file per process, n > 1 =
+// one MPI-IO file per n processes (output)
+// mem_blocks: number of blocks to keep in memory, -1 = all (output)
+// out_file: file for the machine-readable results (results.h), empty = none (output)
+// warmup: number of untimed trials before the timed ones of each run (output)
+// trials: number of timed trials of each run, summarized by their median (output)
+// hints: MPI-IO hint sets to compare, starting with the default set, or empty to use diy::io
+// (output)
+// verify: store block checksums in the file footer (write), or check the blocks read (output)
+// async_mflops: Mflop per block of computation during a background write after each write, 0 =
+// no background write (output)
+// gen: generator of the data values (Block::generate_data) (output)
+// compress: whether the block values are compressed; the codec is set in data_codec (output)
+// mmap_read: write files that can be memory mapped, or read them again through a memory map
+// (output)
+// sizes: distribution of the block sizes (Data::elems) (output)
+// factors: block sizes over the mean, by gid, for the list distribution (output)
 //
 void GetArgs(int argc,
              char **argv,
@@ -189,16 +506,49 @@ void GetArgs(int argc,
              int &min_elems,
              int &max_elems,
              int &nb,
-             bool &write)
+             bool &write,
+             int &procs_per_file,
+             int &mem_blocks,
+             std::string &out_file,
+             int &warmup,
+             int &trials,
+             std::vector<blockio::Hints> &hints,
+             bool &verify,
+             double &async_mflops,
+             std::string &gen,
+             bool &compress,
+             bool &mmap_read,
+             std::string &sizes,
+             std::vector<double> &factors)
 {
     using namespace opts;
     Options ops(argc, argv);
     int max_procs;
     int rank;
-    char op;                                 // w or r (write or read)
+    std::string op;                          // w or r (write or read), followed by the layout
     MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
+    mem_blocks = -1;
+    ops >> Option('m', "mem-blocks", mem_blocks, "number of blocks to keep in memory");
+    args::run_options(ops, out_file, warmup, trials);
+    std::string hint_set, hint_file;
+    ops >> Option('i', "hints", hint_set, "MPI-IO hints key=value,... (\"default\" for none)");
+    ops >> Option('I', "hint-file", hint_file, "file with one set of MPI-IO hints per line");
+    verify = ops >> Present('v', "verify", "checksum the blocks written or read");
+    async_mflops = 0.0;
+    ops >> Option('a', "async", async_mflops,
+                  "also write in the background during this many Mflop per block");
+    gen = "smooth";
+    ops >> Option('g', "generator", gen, "data values: ramp, smooth, or noisy");
+    std::string codec_name = "none";
+    ops >> Option('z', "compress", codec_name, "codec of the block values: none, zlib, or shuffle");
+    mmap_read = ops >> Present('M', "mmap", "also read through a memory map");
+    sizes = "equal";
+    ops >> Option('s', "sizes", sizes, "block sizes: equal, uniform, or lognormal");
+    std::string sizes_file;
+    ops >> Option('S', "sizes-file", sizes_file, "file with the block sizes over the mean by gid");
+
     if (ops >> Present('h', "help", "show help") ||
         !(ops >> PosOption(min_procs)
           >> PosOption(min_elems)
@@ -207,7 +557,9 @@ void GetArgs(int argc,
           >> PosOption(op)))
     {
         if (rank == 0)
-            fprintf(stderr, "Usage: %s min_procs min_elems max_elems nb\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-m mem_blocks] [-o results] [-w warmup] [-n trials] "
+                    "[-i hints] [-I hint_file] [-v] [-a mflops] [-g gen] [-z codec] [-M] "
+                    "[-s sizes] [-S sizes_file] min_procs min_elems max_elems nb op\n", argv[0]);
         exit(1);
     }
 
@@ -219,11 +571,111 @@ void GetArgs(int argc,
         exit(1);
     }
 
-    write = (op == 'w' || op == 'W') ? true : false;
+    // layout: none (one shared file), f (file per process), or sN (one file per N processes)
+    write = (op[0] == 'w' || op[0] == 'W') ? true : false;
+    procs_per_file = 0;
+    std::string layout = op.substr(1);
+    if (layout == "f")
+        procs_per_file = 1;
+    else if (layout.size() > 1 && layout[0] == 's')
+        procs_per_file = atoi(layout.c_str() + 1);
+    if ((op[0] != 'w' && op[0] != 'W' && op[0] != 'r' && op[0] != 'R') ||
+        (!layout.empty() && procs_per_file < 1))
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: op must be w or r, optionally followed by f (file per "
+                    "process) or sN (one file per N processes), e.g. ws8\n");
+        exit(1);
+    }
+
+    if (gen != "ramp" && gen != "smooth" && gen != "noisy")
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: unknown generator %s\n", gen.c_str());
+        exit(1);
+    }
+    factors.clear();
+    if (!sizes_file.empty())
+    {
+        sizes = "list";
+        FILE* fd = fopen(sizes_file.c_str(), "r");
+        double f;
+        while (fd && fscanf(fd, "%lf", &f) == 1)
+            factors.push_back(f);
+        if (fd)
+            fclose(fd);
+        if (factors.empty())
+        {
+            if (rank == 0)
+                fprintf(stderr, "Error: cannot read the block sizes in %s\n",
+                        sizes_file.c_str());
+            exit(1);
+        }
+    }
+    if (sizes != "equal" && sizes != "uniform" && sizes != "lognormal" && sizes != "list")
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: unknown block size distribution %s\n", sizes.c_str());
+        exit(1);
+    }
+    data_codec = codec::parse(codec_name);
+    if (data_codec < 0)
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: unknown codec %s (zlib and shuffle need zlib)\n",
+                    codec_name.c_str());
+        exit(1);
+    }
+    compress = data_codec != codec::none;
+
+    // mapped blocks point into their file, they cannot be compressed or moved out of core
+    if (mmap_read && (compress || mem_blocks >= 0))
+    {
+        if (rank == 0)
+            fprintf(stderr, "Error: the memory-mapped read needs uncompressed, in-core blocks\n");
+        exit(1);
+    }
+
+    if (!write || async_mflops < 0.0)
+        async_mflops = 0.0;
+    args::check_trials(warmup, trials);
+
+    // with hints, every run is repeated with the default hints and each given set, through
+    // blockio instead of diy::io
+    hints.clear();
+    if (procs_per_file == 1 && (!hint_set.empty() || !hint_file.empty()) && rank == 0)
+        fprintf(stderr, "Warning: MPI-IO hints are ignored by the POSIX file per process\n");
+    if ((!hint_set.empty() || !hint_file.empty()) && procs_per_file != 1)
+    {
+        hints.push_back(blockio::Hints());
+        blockio::Hints h;
+        if (!hint_set.empty() && !h.parse(hint_set))
+        {
+            if (rank == 0)
+                fprintf(stderr, "Error: cannot parse the hints %s\n", hint_set.c_str());
+            exit(1);
+        }
+        if (!h.values.empty())
+            hints.push_back(h);
+        if (!hint_file.empty() && !blockio::read_hints(hint_file, hints))
+        {
+            if (rank == 0)
+                fprintf(stderr, "Error: cannot read the hints in %s\n", hint_file.c_str());
+            exit(1);
+        }
+    }
 
     if (rank == 0)
-        fprintf(stderr, "min_procs = %d min_elems = %d max_elems = %d nb = %d write = %d\n",
-                min_procs, min_elems, max_elems, nb, write);
+    {
+        fprintf(stderr, "min_procs = %d min_elems = %d max_elems = %d nb = %d write = %d "
+                "procs_per_file = %d mem_blocks = %d warmup = %d trials = %d verify = %d "
+                "async_mflops = %.1lf gen = %s codec = %s mmap = %d sizes = %s\n", min_procs,
+                min_elems, max_elems, nb, write, procs_per_file, mem_blocks, warmup, trials,
+                verify, async_mflops, gen.c_str(), codec::name(data_codec), mmap_read,
+                sizes.c_str());
+        for (size_t i = 0; i < hints.size(); i++)
+            fprintf(stderr, "hints %d: %s\n", (int)i, hints[i].name.c_str());
+    }
 }
 
 //
@@ -242,11 +694,37 @@ int main(int argc, char **argv)
     double t0;                // start time
     char buf[256];            // filename
     bool write;               // write or read
+    int procs_per_file;       // processes per file (0 = one shared file)
+    std::string layout;       // file layout
+    int mem_blocks;           // number of blocks to keep in memory (-1 = all)
+    std::string out_file;     // machine-readable results
+    int warmup, trials;       // number of untimed and timed trials per run
+    std::vector<blockio::Hints> hints; // MPI-IO hint sets
+    bool verify;              // checksum the blocks written or read
+    double async_mflops;      // computation per block during the background write (0 = none)
+    Data data;                // data values of the blocks
+    bool compress;            // compress the block values (codec in data_codec)
+    bool mmap_read;           // write mappable files, or also read them through a memory map
 
     MPI_Init(&argc, &argv);
     MPI_Comm_size(MPI_COMM_WORLD, &max_procs);
 
-    GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, write);
+    GetArgs(argc, argv, min_procs, min_elems, max_elems, nblocks, write, procs_per_file,
+            mem_blocks, out_file, warmup, trials, hints, verify, async_mflops, data.gen,
+            compress, mmap_read, data.sizes, data.factors);
+    int num_sets = std::max((int)hints.size(), 1); // hint sets per run
+
+    // diy::io writes one shared file with the default MPI-IO settings; hints, the other
+    // layouts, background writes, and memory-mapped reads go through blockio
+    bool async = async_mflops > 0.0;
+    bool use_blockio = !hints.empty() || procs_per_file > 0 || async || mmap_read;
+    mmap_read = mmap_read && !write;
+    bool variable_sizes = data.sizes != "equal";
+    if (!results::open(out_file))
+    {
+        fprintf(stderr, "Error: cannot write results to %s\n", out_file.c_str());
+        exit(1);
+    }
 
     // data extents, unused
     Bounds domain;
@@ -259,7 +737,21 @@ int main(int argc, char **argv)
     int num_runs = (int)((log2(max_procs / min_procs) + 1) *
                          (log2(max_elems / min_elems) + 1));
 
-    double io_time[num_runs];                // timing
+    double io_time[num_runs * num_sets];              // timing
+    spill::Totals spill_totals[num_runs * num_sets];  // blocks moved out of core and back
+    double checksum_time[num_runs * num_sets];        // checksum timing
+    int bad_blocks[num_runs * num_sets];              // blocks read that failed verification
+    double async_time[num_runs * num_sets];           // background write total time
+    double stall_time[num_runs * num_sets];           // background write time not overlapped
+    double compute_time[num_runs * num_sets];         // computation during background write
+    int mmap_cold = 1;                                // mapped reads found no cached pages
+    double ratio[num_runs * num_sets];                // compression ratio
+    double codec_time[num_runs * num_sets];           // compression or decompression time
+    double first_time[num_runs * num_sets];           // memory map to the first access
+    double mmap_time[num_runs * num_sets];            // memory map to the access of all values
+    double faulted_mb[num_runs * num_sets];           // MB faulted in by the memory map
+    double bytes[num_runs * num_sets];                // bytes of the values of all the blocks
+    double imbalance[num_runs * num_sets];            // max bytes per process over the mean
 
     // iterate over processes
     int run = 0; // run number
@@ -277,15 +769,20 @@ int main(int argc, char **argv)
             continue;
         }
 
+        // processes sharing each file
+        blockio::Files files(comm, procs_per_file);
+        int file_rank;
+        MPI_Comm_rank(files.group, &file_rank);
+        layout = files.layout();
+
         // initialize DIY
         tot_blocks = nblocks * groupsize;
-        int mem_blocks = -1; // everything in core for now
         int num_threads = 1; // needed in order to do timing
         diy::mpi::communicator    world(comm);
-        diy::FileStorage          storage("./DIY.XXXXXX");
+        spill::Storage            storage("./DIY.XXXXXX");
         diy::Master               master(world,
                                          num_threads,
-                                         mem_blocks,
+                                         spill::mem_blocks(mem_blocks, num_threads),
                                          &Block::create,
                                          &Block::destroy,
                                          &storage,
@@ -306,7 +803,9 @@ int main(int argc, char **argv)
         while (num_elems <= max_elems)
         {
             // initialize input data
-            master.foreach(&ResetBlock, &num_elems);
+            data.num_elems = num_elems;
+            master.foreach(&ResetBlock, &data);
+            spill::stats().reset();
 
             // debug
 //             master.foreach(&PrintBlock);
@@ -317,24 +816,273 @@ int main(int argc, char **argv)
             MPI_Bcast(&run, 1, MPI_INT, 0, comm);
             sprintf(buf, "%d.out", run);
 
-            // write the data
-            if (write)
-            {
-                MPI_Barrier(comm);
-                t0 = MPI_Wtime();
-                diy::io::write_blocks(buf, world, master);
-                MPI_Barrier(comm);
-                io_time[run] = MPI_Wtime() - t0;
-            }
+            // bytes of the values of the blocks, from their sizes, which the reader draws with
+            // the same parameters as the writer
+            diy::ContiguousAssigner sizes_assigner(world.size(), tot_blocks);
+            std::vector<int> local_gids;
+            sizes_assigner.local_gids(world.rank(), local_gids);
+            double local_bytes = 0.0, run_bytes, max_bytes;
+            for (size_t j = 0; j < local_gids.size(); j++)
+                local_bytes += (double)data.elems(local_gids[j]) * sizeof(float);
+            MPI_Allreduce(&local_bytes, &run_bytes, 1, MPI_DOUBLE, MPI_SUM, comm);
+            MPI_Allreduce(&local_bytes, &max_bytes, 1, MPI_DOUBLE, MPI_MAX, comm);
 
-            // read the data
-            else
+            // every trial writes the same file, or reads it into an empty master, once per hint
+            // set
+            for (int s = 0; s < num_sets; s++)
             {
-                MPI_Barrier(comm);
-                t0 = MPI_Wtime();
-                diy::io::read_blocks(buf, world, *assigner, master);
-                MPI_Barrier(comm);
-                io_time[run] = MPI_Wtime() - t0;
+                int i = run * num_sets + s; // index into times
+                MPI_Info info = hints.empty() ? MPI_INFO_NULL : hints[s].info();
+                stats::Samples samples, checksum_samples;
+                stats::Samples async_samples, stall_samples, compute_samples;
+                stats::Samples codec_samples;
+                stats::Samples first_samples, mmap_samples;
+                faulted_mb[i] = 0.0;
+                bytes[i]      = run_bytes;
+                imbalance[i]  = run_bytes > 0.0 ? max_bytes * groupsize / run_bytes : 1.0;
+                codec::Totals codec_totals;
+                bad_blocks[i] = 0;
+                for (int t = -warmup; t < trials; t++)
+                {
+                    spill::stats().reset();
+                    bool ok = true;
+                    diy::MemoryBuffer extra; // footer data: checksums of the blocks, by gid
+                    Checksums checksums;
+                    checksums.gen = data.gen;
+                    double checksum = 0.0;
+                    double codec = 0.0;     // compression or decompression time
+
+                    // checksum the data for the footer
+                    if (write && verify)
+                    {
+                        MPI_Barrier(comm);
+                        t0 = MPI_Wtime();
+                        master.foreach(&ChecksumBlock, &checksums);
+                        checksum = MPI_Wtime() - t0;
+                        SaveChecksums(checksums, tot_blocks, comm, extra);
+                    }
+
+                    // write the data
+                    if (write)
+                    {
+                        // striping hints only apply to a new file
+                        if (use_blockio && file_rank == 0)
+                            MPI_File_delete((char*)files.name(buf).c_str(), MPI_INFO_NULL);
+                        MPI_Barrier(comm);
+                        codec::stats().reset();
+                        t0 = MPI_Wtime();
+                        if (!use_blockio)
+                            diy::io::write_blocks(buf, world, master, extra, &Block::save);
+                        else
+                            ok = blockio::write_blocks(buf, files, master, extra,
+                                                       &Block::save, info);
+                        MPI_Barrier(comm);
+                        io_time[i] = MPI_Wtime() - t0;
+                        codec = codec::stats().local.time_out;
+                        codec_totals = codec::stats().reduce(comm);
+
+                        // write the same data in the background while computing; the stall is
+                        // the time of the snapshot and start of the write and of its completion
+                        // after the computation
+                        if (async && ok)
+                        {
+                            if (file_rank == 0)
+                                MPI_File_delete((char*)files.name(buf).c_str(), MPI_INFO_NULL);
+                            MPI_Barrier(comm);
+                            t0 = MPI_Wtime();
+                            blockio::AsyncWrite background(files);
+                            ok = background.start(buf, master, extra, &Block::save, info);
+                            double t1 = MPI_Wtime();
+                            sink = kernel::run(async_mflops * master.size(),
+                                               TestWrite(ok ? &background : NULL));
+                            double t2 = MPI_Wtime();
+                            ok = background.finish() && ok;
+                            double t3 = MPI_Wtime();
+                            async_time[i]   = t3 - t0;
+                            stall_time[i]   = (t1 - t0) + (t3 - t2);
+                            compute_time[i] = t2 - t1;
+                        }
+                    }
+
+                    // read the data
+                    else
+                    {
+                        master.clear();
+                        MPI_Barrier(comm);
+                        codec::stats().reset();
+                        t0 = MPI_Wtime();
+                        if (!use_blockio)
+                            diy::io::read_blocks(buf, world, *assigner, master, extra,
+                                                 &Block::load);
+                        else
+                            ok = blockio::read_blocks(buf, files, *assigner, master, extra,
+                                                      &Block::load, info);
+                        MPI_Barrier(comm);
+                        io_time[i] = MPI_Wtime() - t0;
+                        codec = codec::stats().local.time_in;
+                        codec_totals = codec::stats().reduce(comm);
+                        ok = ok && !codec_totals.errors;
+
+                        // verify the data against the checksums of the footer, if any
+                        if (ok && verify)
+                        {
+                            if (extra.buffer.size())
+                            {
+                                extra.reset();
+                                diy::load(extra, checksums.footer);
+                            }
+                            MPI_Barrier(comm);
+                            t0 = MPI_Wtime();
+                            master.foreach(&VerifyBlock, &checksums);
+                            checksum = MPI_Wtime() - t0;
+                            MPI_Allreduce(&checksums.bad, &bad_blocks[i], 1, MPI_INT, MPI_SUM,
+                                          comm);
+                        }
+
+                        // read the data again through a memory map of the file, whose pages
+                        // are faulted in when the values are first accessed; the pages cached
+                        // by the read above are dropped first, so that they come from storage
+                        if (ok && mmap_read)
+                        {
+                            master.clear();
+                            blockio::Mapping mapping;
+                            struct rusage r0, r1;
+                            if (!blockio::drop_cache(buf, files))
+                                mmap_cold = 0;
+                            MPI_Barrier(comm);
+                            getrusage(RUSAGE_SELF, &r0);
+                            t0 = MPI_Wtime();
+                            ok = blockio::map_blocks(buf, files, *assigner, master, extra,
+                                                     &Block::view_bytes, mapping);
+                            Block* first = ok && master.size() ?
+                                static_cast<Block*>(master.block(0)) : NULL;
+                            if (first && first->size)
+                                sink = first->values()[0];
+                            first_time[i] = MPI_Wtime() - t0;
+                            double sum = 0.0;
+                            if (ok)
+                                master.foreach(&SumBlock, &sum);
+                            sink = sum;
+                            mmap_time[i] = MPI_Wtime() - t0;
+                            getrusage(RUSAGE_SELF, &r1);
+                            double faulted = (double)(r1.ru_minflt + r1.ru_majflt -
+                                                      r0.ru_minflt - r0.ru_majflt) *
+                                sysconf(_SC_PAGESIZE) / 1048576.0;
+                            MPI_Allreduce(&faulted, &faulted_mb[i], 1, MPI_DOUBLE, MPI_SUM,
+                                          comm);
+
+                            // verify the mapped data too
+                            if (ok && verify)
+                            {
+                                Checksums mapped;
+                                mapped.footer = checksums.footer;
+                                mapped.gen    = data.gen;
+                                master.foreach(&VerifyBlock, &mapped);
+                                int bad;
+                                MPI_Allreduce(&mapped.bad, &bad, 1, MPI_INT, MPI_SUM, comm);
+                                bad_blocks[i] += bad;
+                            }
+                            master.clear(); // before unmapping the values of the blocks
+                        }
+                    }
+
+                    if (!ok)
+                    {
+                        if (world.rank() == 0)
+                            fprintf(stderr, "Error: cannot %s %s (%s) with the hints %s\n",
+                                    write ? "write" : "read", buf, layout.c_str(),
+                                    hints.empty() ? "default" : hints[s].name.c_str());
+                        MPI_Abort(MPI_COMM_WORLD, 1);
+                    }
+                    if (t >= 0)
+                    {
+                        samples.add(io_time[i], comm);
+                        if (verify)
+                            checksum_samples.add(checksum, comm);
+                        if (compress)
+                            codec_samples.add(codec, comm);
+                        if (mmap_read)
+                        {
+                            first_samples.add(first_time[i], comm);
+                            mmap_samples.add(mmap_time[i], comm);
+                        }
+                        if (async)
+                        {
+                            async_samples.add(async_time[i], comm);
+                            stall_samples.add(stall_time[i], comm);
+                            compute_samples.add(compute_time[i], comm);
+                        }
+                    }
+                }
+                io_time[i]       = samples.median();
+                checksum_time[i] = checksum_samples.median();
+                async_time[i]    = async_samples.median();
+                stall_time[i]    = stall_samples.median();
+                compute_time[i]  = compute_samples.median();
+                codec_time[i]    = codec_samples.median();
+                ratio[i]         = codec_totals.ratio();
+                first_time[i]    = first_samples.median();
+                mmap_time[i]     = mmap_samples.median();
+                if (bad_blocks[i] && world.rank() == 0)
+                    fprintf(stderr, "Error: %d blocks of %s do not match their checksums\n",
+                            bad_blocks[i], buf);
+                if (info != MPI_INFO_NULL)
+                    MPI_Info_free(&info);
+
+                spill_totals[i] = spill::stats().reduce(comm);
+
+                results::Run res("io");
+                res.procs  = groupsize;
+                res.blocks = tot_blocks;
+                res.elems  = num_elems;
+                res.op     = write ? "write" : "read";
+                if (procs_per_file)
+                    res.op += " " + layout;
+                if (compress)
+                    res.op += std::string(" ") + codec::name(data_codec);
+                if (variable_sizes)
+                    res.op += " sizes " + data.sizes;
+                if (!hints.empty())
+                    res.op += " " + hints[s].name;
+                results::emit(res, "io_time", samples);
+                results::emit(comm, res, "bw_GB/s", bytes[i] / 1073741824.0 / io_time[i]);
+                if (variable_sizes)
+                {
+                    results::emit(comm, res, "bytes", local_bytes);
+                    results::emit(comm, res, "bytes_imbalance", imbalance[i]);
+                }
+                if (verify)
+                {
+                    results::emit(res, "checksum_time", checksum_samples);
+                    if (!write)
+                        results::emit(comm, res, "bad_blocks", (double)bad_blocks[i]);
+                }
+                char point[256];
+                sprintf(point, "procs %d elems %d", groupsize, num_elems);
+                stats::record(point, hints.empty() ? "io_time" : hints[s].name, samples);
+                if (verify)
+                    stats::record(point, "checksum_time", checksum_samples);
+                if (compress)
+                {
+                    results::emit(comm, res, "compression_ratio", ratio[i]);
+                    results::emit(res, "codec_time", codec_samples);
+                    results::emit(comm, res, "codec_MB/s", bytes[i] / 1048576.0 / codec_time[i]);
+                    stats::record(point, "codec_time", codec_samples);
+                }
+                if (mmap_read)
+                {
+                    results::emit(res, "mmap_first_time", first_samples);
+                    results::emit(res, "mmap_time", mmap_samples);
+                    results::emit(comm, res, "faulted_MB", faulted_mb[i]);
+                    stats::record(point, "mmap_time", mmap_samples);
+                }
+                if (async)
+                {
+                    results::emit(res, "async_time", async_samples);
+                    results::emit(res, "stall_time", stall_samples);
+                    results::emit(res, "compute_time", compute_samples);
+                    stats::record(point, "stall_time", stall_samples);
+                }
             }
 
             // debug
@@ -355,7 +1103,16 @@ int main(int argc, char **argv)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     fflush(stderr);
     if (rank == 0)
-        PrintResults(io_time, tot_blocks, min_procs, max_procs, min_elems, max_elems);
+    {
+        PrintResults(io_time, spill_totals, mem_blocks >= 0, hints, layout,
+                     verify ? checksum_time : NULL, bad_blocks, async ? async_time : NULL,
+                     stall_time, compute_time, compress ? ratio : NULL, codec_time,
+                     mmap_read ? first_time : NULL, mmap_time, faulted_mb, mmap_cold, write,
+                     bytes,
+                     variable_sizes ? imbalance : NULL, data.sizes, min_procs, max_procs,
+                     min_elems, max_elems);
+        stats::print(warmup, trials);
+    }
 
     // cleanup
     MPI_Finalize();